@@ -0,0 +1,1047 @@
+/*
+ * Simulated ALE102 power supply behind the IO plugin interface
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The plugin exports the same descriptor as pcidas1602_16.so and wires
+ * the same channels, so ps_prog can not tell the difference. Instead of a card
+ * it models an ALE102 charging a capacitor with constant current up to the
+ * programmed voltage:
+ *
+ *    DIO 4 high  - enable
+ *    DIO 0 high  - inhibit asserted
+ *    DIO 2 high  - interlock closed
+ *    AO 0        - voltage program, 0..10V for 0..full output
+ *    AI 0        - voltage monitor, 0..10V for 0..full output
+ *    AI 8..13    - overload, thermal, interlock open, overvoltage,
+ *                  end of charge, inhibit; active low (open collector)
+ *
+ * Everything is tuned through [plugin] options, name=value separated by
+ * spaces, names without the ALE102_SIM_ prefix and in any case, e.g.
+ * "current=0.2 faults=thermal@5:2". Names missing there come from
+ * environment variables:
+ *
+ *    ALE102_SIM_FULL_OUTPUT   full output voltage [V], default 25000
+ *    ALE102_SIM_CURRENT       charging current [A], default 0.4
+ *    ALE102_SIM_CAPACITANCE   load capacitance [F], default 1e-6
+ *    ALE102_SIM_BLEED         bleeder resistance [ohm], default 1e8
+ *    ALE102_SIM_REP_RATE      load discharges per second, default 0 (none)
+ *    ALE102_SIM_NOISE         peak noise on analog inputs [V], default 0
+ *    ALE102_SIM_LATENCY_US    delay added to every IO call [us], default 0
+ *    ALE102_SIM_IO_ERRORS     probability of a failing IO call, default 0
+ *    ALE102_SIM_FAULTS        list of name@start[:duration] in seconds
+ *                             since open, name is one of overload,
+ *                             thermal, overvoltage, e.g.
+ *                             "thermal@5:2,overload@20"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+
+#include "types.h"
+#include "io_plugin.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+/* mirror of pcidas1602_16 channel numbering */
+enum {
+   AI_CHANNEL_0 = 0,
+   AI_CHANNEL_8 = 8,
+   AI_CHANNEL_15 = 15,
+};
+
+enum {
+   AO_CHANNEL_0 = 0,
+   AO_CHANNEL_1,
+};
+
+enum {
+   DIO_CHANNEL_0 = 0,
+   DIO_CHANNEL_2 = 2,
+   DIO_CHANNEL_4 = 4,
+   DIO_CHANNEL_23 = 23,
+};
+
+/* status outputs in the order of AI 8..13 */
+enum {
+   status_overload = 0,
+   status_thermal,
+   status_interlock,
+   status_overvoltage,
+   status_end_of_charge,
+   status_inhibit,
+   STATUS_N,
+};
+
+#define DIO_CHANNELS_MASK ((1 << (DIO_CHANNEL_23 + 1)) - 1)
+
+#define STATUS_ACTIVE_V 0.4
+#define STATUS_INACTIVE_V 5.0
+
+#define V_PROGRAM_MAX 10.0
+#define V_MONITOR_MAX 10.0
+
+/* end of charge within 1%, overvoltage above 110% of programmed */
+#define END_OF_CHARGE_RATIO 0.99
+#define OVERVOLTAGE_RATIO 1.10
+
+#define FAULTS_MAX 16
+#define SCAN_CHANNELS_MAX 16
+/* scans the simulated buffer holds before old ones are dropped */
+#define SCAN_BACKLOG_MAX 65536
+/* codes handed to a scan tap, like a 16 bit card on -10..10 V */
+#define SCAN_RANGE_MIN -10.0
+#define SCAN_RANGE_MAX 10.0
+#define SCAN_MAXDATA 0xffff
+#define BURST_CHANNELS_MAX 4
+#define BURST_SCANS_MAX 65536
+
+typedef struct sim_fault {
+   uint32_t status;
+   double start;
+   double end;
+} sim_fault_t;
+
+/* one simulated supply, every call works on one of these only */
+struct ps_io {
+   /* parameters */
+   double full_output;
+   double current;
+   double capacitance;
+   double bleed;
+   double rep_rate;
+   double noise;
+   long latency_us;
+   double io_errors;
+   sim_fault_t faults[FAULTS_MAX];
+   uint32_t faults_n;
+   /* model state */
+   double t0;
+   double t;
+   double v_cap;
+   double v_program;
+   double next_shot;
+   uint32_t dio_state;
+   unsigned int seed;
+   /* simulated scan */
+   bool scan_running;
+   uint32_t scan_n;
+   uint32_t scan_channels[SCAN_CHANNELS_MAX];
+   double scan_lower[SCAN_CHANNELS_MAX];
+   double scan_upper[SCAN_CHANNELS_MAX];
+   double scan_period;
+   double scan_next;
+   scan_tap_t scan_tap;
+   void *scan_tap_ctx;
+   /* newest status scan, and what peeks walked past for classify */
+   bool scan_last_valid;
+   double scan_last[SCAN_CHANNELS_MAX];
+   uint32_t peek_state;
+   uint32_t peek_seen;
+   int peek_scans;
+   /* status part of the scan, burst channels follow it */
+   uint32_t status_n;
+   double status_period;
+   /* the tap gets every tap_decimation-th scan */
+   uint32_t tap_decimation;
+   uint32_t tap_phase;
+   /* simulated burst capture */
+   int burst_state;
+   uint32_t burst_n;
+   uint32_t burst_capacity;
+   uint32_t burst_post;
+   uint32_t burst_post_left;
+   uint32_t burst_written;
+   uint32_t burst_trigger;
+   int burst_edge;
+   double burst_level;
+   double burst_last;
+   bool burst_soft;
+   double burst_ring[BURST_SCANS_MAX * BURST_CHANNELS_MAX];
+   /* simulated output profile, sample profile_index is due at
+    * profile_next */
+   bool profile_running;
+   double *profile;
+   uint32_t profile_n;
+   uint32_t profile_channel;
+   uint32_t profile_index;
+   double profile_period;
+   double profile_next;
+};
+
+static void burst_capture(ps_io_t *sim, double *values);
+static void scan_restart(ps_io_t *sim, uint32_t n, double period);
+
+static double sim_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* name=value out of the space separated plugin options, name compared
+ * without case, else ALE102_SIM_<name> from the environment */
+static const char *sim_setting(const char *options, const char *name, char *buf,
+                               size_t size)
+{
+   char env[64];
+   size_t len = strlen(name), n;
+   const char *p;
+
+   for (p = options; (p != NULL) && (*p != 0); p += n) {
+      p += strspn(p, " \t");
+      n = strcspn(p, " \t");
+      if ((n > len) && (p[len] == '=') && !strncasecmp(p, name, len)) {
+         snprintf(buf, size, "%.*s", (int)(n - len - 1), p + len + 1);
+         return buf;
+      }
+   }
+
+   snprintf(env, sizeof(env), "ALE102_SIM_%s", name);
+   return getenv(env);
+}
+
+static double sim_param(const char *options, const char *name, double def)
+{
+   char buf[64];
+   const char *str = sim_setting(options, name, buf, sizeof(buf));
+
+   if (str == NULL)
+      return def;
+   return strtod(str, NULL);
+}
+
+static void parse_faults(ps_io_t *sim, const char *str)
+{
+   char buf[256];
+   char *tok, *save, *at, *colon;
+   sim_fault_t *fault;
+
+   if (str == NULL)
+      return;
+
+   snprintf(buf, sizeof(buf), "%s", str);
+   for (tok = strtok_r(buf, ",", &save); tok != NULL;
+        tok = strtok_r(NULL, ",", &save)) {
+      if (sim->faults_n == FAULTS_MAX) {
+         fprintf(stderr, "too many simulated faults\n");
+         return;
+      }
+      at = strchr(tok, '@');
+      if (at == NULL) {
+         fprintf(stderr, "simulated fault[%s] without start time\n", tok);
+         continue;
+      }
+      *at++ = 0;
+      fault = &sim->faults[sim->faults_n];
+      if (!strcmp(tok, "overload"))
+         fault->status = status_overload;
+      else if (!strcmp(tok, "thermal"))
+         fault->status = status_thermal;
+      else if (!strcmp(tok, "overvoltage"))
+         fault->status = status_overvoltage;
+      else {
+         fprintf(stderr, "unknown simulated fault[%s]\n", tok);
+         continue;
+      }
+      fault->start = strtod(at, NULL);
+      colon = strchr(at, ':');
+      fault->end = (colon != NULL) ? fault->start + strtod(colon + 1, NULL) : INFINITY;
+      sim->faults_n++;
+   }
+}
+
+/* injected fault active at absolute time t */
+static bool fault_active(ps_io_t *sim, uint32_t status, double t)
+{
+   uint32_t i;
+
+   t -= sim->t0;
+   for (i = 0; i < sim->faults_n; i++) {
+      if ((sim->faults[i].status == status) &&
+          (t >= sim->faults[i].start) && (t < sim->faults[i].end))
+         return true;
+   }
+
+   return false;
+}
+
+static bool dio_high(ps_io_t *sim, uint32_t channel)
+{
+   return (sim->dio_state & (1 << channel)) != 0;
+}
+
+static double target_voltage(ps_io_t *sim)
+{
+   return sim->v_program * sim->full_output / V_PROGRAM_MAX;
+}
+
+static bool charging(ps_io_t *sim, double t)
+{
+   return dio_high(sim, DIO_CHANNEL_4) && !dio_high(sim, DIO_CHANNEL_0) &&
+          dio_high(sim, DIO_CHANNEL_2) &&
+          !fault_active(sim, status_overload, t) && !fault_active(sim, status_thermal, t);
+}
+
+/* integrate one stretch without discharges in it */
+static void advance_segment(ps_io_t *sim, double dt)
+{
+   double target = target_voltage(sim);
+
+   if (fault_active(sim, status_overload, sim->t)) {
+      /* shorted load */
+      sim->v_cap = 0;
+   } else if (charging(sim, sim->t) && (sim->v_cap < target)) {
+      sim->v_cap += sim->current / sim->capacitance * dt;
+      if (sim->v_cap > target)
+         sim->v_cap = target;
+   } else {
+      sim->v_cap *= exp(-dt / (sim->bleed * sim->capacitance));
+   }
+}
+
+/* bring the model forward to absolute time now */
+static void advance(ps_io_t *sim, double now)
+{
+   double end;
+
+   while (sim->t < now) {
+      end = now;
+      if ((sim->rep_rate > 0) && (sim->next_shot < end))
+         end = sim->next_shot;
+      if ((sim->profile_running == true) && (sim->profile_next < end))
+         end = sim->profile_next;
+      advance_segment(sim, end - sim->t);
+      sim->t = end;
+      if ((sim->rep_rate > 0) && (sim->t >= sim->next_shot)) {
+         /* the load fires only when charged */
+         if (charging(sim, sim->t))
+            sim->v_cap = 0;
+         sim->next_shot += 1 / sim->rep_rate;
+      }
+      /* profile samples take effect on their own clock */
+      if ((sim->profile_running == true) && (sim->t >= sim->profile_next)) {
+         if (sim->profile_channel == AO_CHANNEL_0)
+            sim->v_program = sim->profile[sim->profile_index];
+         sim->profile_index++;
+         sim->profile_next += sim->profile_period;
+         if (sim->profile_index == sim->profile_n)
+            sim->profile_running = false;
+      }
+   }
+}
+
+static bool status_active(ps_io_t *sim, uint32_t status)
+{
+   double t = sim->t;
+   double target = target_voltage(sim);
+
+   switch(status) {
+   case status_overload:
+   case status_thermal:
+      return fault_active(sim, status, t);
+   case status_interlock:
+      return !dio_high(sim, DIO_CHANNEL_2);
+   case status_overvoltage:
+      return fault_active(sim, status, t) ||
+             ((target > 0) && (sim->v_cap > OVERVOLTAGE_RATIO * target));
+   case status_end_of_charge:
+      return charging(sim, t) && (target > 0) &&
+             (sim->v_cap >= END_OF_CHARGE_RATIO * target) &&
+             (sim->v_cap <= OVERVOLTAGE_RATIO * target);
+   case status_inhibit:
+      return dio_high(sim, DIO_CHANNEL_0);
+   default:
+      return false;
+   }
+}
+
+static double noise(ps_io_t *sim)
+{
+   if (sim->noise == 0)
+      return 0;
+   return sim->noise * (2.0 * rand_r(&sim->seed) / RAND_MAX - 1.0);
+}
+
+/* voltage present on analog input channel at current model time */
+static double channel_voltage(ps_io_t *sim, uint32_t channel)
+{
+   double v;
+
+   if (channel == AI_CHANNEL_0)
+      v = sim->v_cap * V_MONITOR_MAX / sim->full_output;
+   else if ((channel >= AI_CHANNEL_8) && (channel < AI_CHANNEL_8 + STATUS_N))
+      v = status_active(sim, channel - AI_CHANNEL_8) ? STATUS_ACTIVE_V : STATUS_INACTIVE_V;
+   else
+      v = 0;
+
+   return v + noise(sim);
+}
+
+/* per call latency and injected IO errors */
+static bool io_call(ps_io_t *sim)
+{
+   struct timespec ts;
+
+   if (sim->latency_us > 0) {
+      ts.tv_sec = sim->latency_us / 1000000;
+      ts.tv_nsec = (sim->latency_us % 1000000) * 1000;
+      nanosleep(&ts, NULL);
+   }
+
+   if ((sim->io_errors > 0) &&
+       ((double)rand_r(&sim->seed) / RAND_MAX < sim->io_errors)) {
+      fprintf(stderr, "simulated io error\n");
+      return false;
+   }
+
+   return true;
+}
+
+static bool analog_channel_input(ps_io_t *sim, uint32_t channel, double *value)
+{
+   if (channel > AI_CHANNEL_15) {
+      fprintf(stderr, "channel[%d] out or range\n", channel);
+      return false;
+   }
+
+   if (io_call(sim) == false)
+      return false;
+
+   advance(sim, sim_now());
+   *value = channel_voltage(sim, channel);
+#ifdef DEBUG
+   printf("channel[%d] %g V\n", channel, *value);
+#endif
+
+   return true;
+}
+
+static bool analog_channel_output(ps_io_t *sim, uint32_t channel, double value,
+                                  double v_max, double v_min)
+{
+   if (channel > AO_CHANNEL_1) {
+      fprintf(stderr, "channel[%d] out or range\n", channel);
+      return false;
+   }
+
+   if ((value > v_max) || (value < v_min)) {
+      fprintf(stderr, "voltage[%g] out or range\n", value);
+      return false;
+   }
+
+   if (io_call(sim) == false)
+      return false;
+
+   advance(sim, sim_now());
+   if (channel == AO_CHANNEL_0)
+      sim->v_program = value;
+
+   return true;
+}
+
+/* same contract as the card plugin, the samples are stepped through by
+ * the model clock
+ */
+static bool analog_profile_load(ps_io_t *sim, uint32_t channel, const double *values,
+                                uint32_t n, double *rate, double v_max, double v_min)
+{
+   double *profile;
+   uint32_t i;
+
+   if ((sim->profile_running == true) || (channel > AO_CHANNEL_1) ||
+       (n == 0) || (*rate <= 0)) {
+      fprintf(stderr, "profile of %d samples at %g Hz on channel[%d] not possible\n",
+              n, *rate, channel);
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      if ((values[i] > v_max) || (values[i] < v_min)) {
+         fprintf(stderr, "profile voltage[%g] out or range\n", values[i]);
+         return false;
+      }
+   }
+
+   profile = realloc(sim->profile, n * sizeof(double));
+   if (profile == NULL) {
+      fprintf(stderr, "no memory for a profile of %d samples\n", n);
+      return false;
+   }
+   memcpy(profile, values, n * sizeof(double));
+   sim->profile = profile;
+   sim->profile_n = n;
+   sim->profile_channel = channel;
+   sim->profile_period = 1 / *rate;
+
+   return true;
+}
+
+static bool analog_profile_run(ps_io_t *sim)
+{
+   if ((sim->profile_n == 0) || (sim->profile_running == true)) {
+      fprintf(stderr, "no profile loaded or profile running\n");
+      return false;
+   }
+
+   if (io_call(sim) == false)
+      return false;
+
+   advance(sim, sim_now());
+   sim->profile_index = 0;
+   sim->profile_next = sim->t;
+   sim->profile_running = true;
+   advance(sim, sim_now());
+
+   return true;
+}
+
+static int analog_profile_poll(ps_io_t *sim)
+{
+   if (sim->profile_running == false)
+      return 0;
+
+   advance(sim, sim_now());
+
+   return sim->profile_n - sim->profile_index;
+}
+
+static void analog_profile_stop(ps_io_t *sim)
+{
+   advance(sim, sim_now());
+   sim->profile_running = false;
+}
+
+static bool digital_channels_output(ps_io_t *sim, uint32_t mask, uint32_t bits)
+{
+   if (mask & ~DIO_CHANNELS_MASK) {
+      fprintf(stderr, "mask[0x%x] out or range\n", mask);
+      return false;
+   }
+
+   if (io_call(sim) == false)
+      return false;
+
+   advance(sim, sim_now());
+   sim->dio_state = (sim->dio_state & ~mask) | (bits & mask);
+
+   return true;
+}
+
+static bool digital_channel_output_high(ps_io_t *sim, uint32_t channel)
+{
+   if (channel > DIO_CHANNEL_23) {
+      fprintf(stderr, "channel[%d] out or range\n", channel);
+      return false;
+   }
+
+   return digital_channels_output(sim, 1 << channel, 1 << channel);
+}
+
+static bool digital_channel_output_low(ps_io_t *sim, uint32_t channel)
+{
+   if (channel > DIO_CHANNEL_23) {
+      fprintf(stderr, "channel[%d] out or range\n", channel);
+      return false;
+   }
+
+   return digital_channels_output(sim, 1 << channel, 0);
+}
+
+/* simulated scans are evaluated lazily at their sample times */
+static bool analog_scan_start(ps_io_t *sim, const uint32_t *channels, uint32_t n,
+                              double scan_rate)
+{
+   uint32_t i;
+
+   if ((n == 0) || (n > SCAN_CHANNELS_MAX) || (scan_rate <= 0)) {
+      fprintf(stderr, "scan of %d channels at %g Hz not possible\n", n, scan_rate);
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      if (channels[i] > AI_CHANNEL_15) {
+         fprintf(stderr, "channel[%d] out or range\n", channels[i]);
+         return false;
+      }
+      sim->scan_channels[i] = channels[i];
+      sim->scan_lower[i] = 0;
+      sim->scan_upper[i] = 0;
+   }
+   sim->scan_n = n;
+   sim->scan_period = 1 / scan_rate;
+   sim->scan_next = sim_now() + sim->scan_period;
+   sim->scan_running = true;
+   sim->scan_last_valid = false;
+   sim->peek_state = 0;
+   sim->peek_seen = 0;
+   sim->peek_scans = 0;
+   sim->status_n = n;
+   sim->status_period = sim->scan_period;
+   sim->burst_state = burst_idle;
+   sim->tap_decimation = 1;
+   sim->tap_phase = 0;
+
+   return true;
+}
+
+static bool analog_scan_window(ps_io_t *sim, const double *lower, const double *upper,
+                               uint32_t n)
+{
+   uint32_t i;
+
+   if ((sim->scan_running == false) || (n != sim->status_n)) {
+      fprintf(stderr, "scan needs %d thresholds\n", sim->status_n);
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      sim->scan_lower[i] = lower[i];
+      sim->scan_upper[i] = upper[i];
+   }
+
+   return true;
+}
+
+/* walk the model through every scan that became due, fn gets each one */
+static int scan_walk(ps_io_t *sim, void (*fn)(ps_io_t *sim, double *values, void *arg),
+                     void *arg)
+{
+   double values[SCAN_CHANNELS_MAX];
+   uint32_t codes[SCAN_CHANNELS_MAX];
+   double now, code;
+   uint32_t total, tap_first, tap_total, tapped = 0, i;
+   uint32_t k = sim->tap_decimation;
+   int scans = 0;
+
+   if (sim->scan_running == false) {
+      fprintf(stderr, "scan not running\n");
+      return -1;
+   }
+
+   if (io_call(sim) == false)
+      return -1;
+
+   now = sim_now();
+   /* like a real buffer the backlog is bounded */
+   if ((now - sim->scan_next) / sim->scan_period > SCAN_BACKLOG_MAX)
+      sim->scan_next = now - SCAN_BACKLOG_MAX * sim->scan_period;
+
+   total = (sim->scan_next <= now) ? (now - sim->scan_next) / sim->scan_period + 1 : 0;
+   /* during a burst the tap gets every k-th scan, at the status rate */
+   tap_first = (k - sim->tap_phase % k) % k;
+   tap_total = (total > tap_first) ? (total - 1 - tap_first) / k + 1 : 0;
+   while (sim->scan_next <= now) {
+      advance(sim, sim->scan_next);
+      for (i = 0; i < sim->scan_n; i++)
+         values[i] = channel_voltage(sim, sim->scan_channels[i]);
+      fn(sim, values, arg);
+      if (sim->scan_n != sim->status_n)
+         burst_capture(sim, values + sim->status_n);
+      if ((sim->scan_tap != NULL) && (tapped < tap_total) &&
+          ((sim->tap_phase + scans) % k == 0)) {
+         for (i = 0; i < sim->status_n; i++) {
+            code = (values[i] - SCAN_RANGE_MIN) / (SCAN_RANGE_MAX - SCAN_RANGE_MIN) *
+                   SCAN_MAXDATA + 0.5;
+            codes[i] = (code < 0) ? 0 : (code > SCAN_MAXDATA) ? SCAN_MAXDATA : code;
+         }
+         sim->scan_tap(sim->scan_tap_ctx, codes, tapped, 1, tap_total);
+         tapped++;
+      }
+      sim->scan_next += sim->scan_period;
+      scans++;
+   }
+   advance(sim, now);
+   sim->tap_phase = (sim->tap_phase + scans) % k;
+
+   /* window complete, back to the status scan alone */
+   if ((sim->burst_state == burst_done) && (sim->scan_n != sim->status_n))
+      scan_restart(sim, sim->status_n, sim->status_period);
+
+   return scans;
+}
+
+static void scan_copy(ps_io_t *sim, double *values, void *arg)
+{
+   memcpy(arg, values, sim->status_n * sizeof(double));
+}
+
+static int analog_scan_read(ps_io_t *sim, double *values, uint32_t n)
+{
+   if (n < sim->status_n) {
+      fprintf(stderr, "scan needs %d values\n", sim->status_n);
+      return -1;
+   }
+
+   return scan_walk(sim, scan_copy, values);
+}
+
+typedef struct scan_masks {
+   uint32_t state;
+   uint32_t seen;
+} scan_masks_t;
+
+static void scan_classify(ps_io_t *sim, double *values, void *arg)
+{
+   scan_masks_t *masks = arg;
+   uint32_t i;
+
+   masks->state = 0;
+   for (i = 0; i < sim->status_n; i++) {
+      if ((values[i] > sim->scan_lower[i]) && (values[i] < sim->scan_upper[i]))
+         masks->state |= 1 << i;
+   }
+   masks->seen |= masks->state;
+   memcpy(sim->scan_last, values, sim->status_n * sizeof(double));
+   sim->scan_last_valid = true;
+}
+
+static int analog_scan_classify(ps_io_t *sim, uint32_t *state, uint32_t *seen)
+{
+   scan_masks_t masks = { 0, 0 };
+   int scans;
+
+   scans = scan_walk(sim, scan_classify, &masks);
+   if (scans < 0)
+      return scans;
+
+   /* scans a peek walked past count as well */
+   if (scans == 0)
+      masks.state = sim->peek_state;
+   masks.seen |= sim->peek_seen;
+   scans += sim->peek_scans;
+   sim->peek_seen = 0;
+   sim->peek_scans = 0;
+   if (scans > 0) {
+      *state = masks.state;
+      *seen = masks.seen;
+   }
+
+   return scans;
+}
+
+/* the model has to be walked to the newest scan, the classification of
+ * the scans on the way is kept for the next analog_scan_classify()
+ */
+static int analog_scan_peek(ps_io_t *sim, double *values, uint32_t n)
+{
+   scan_masks_t masks = { 0, 0 };
+   int scans;
+
+   if ((sim->scan_running == false) || (n < sim->status_n)) {
+      fprintf(stderr, "scan needs %d values\n", sim->status_n);
+      return -1;
+   }
+
+   scans = scan_walk(sim, scan_classify, &masks);
+   if (scans < 0)
+      return scans;
+   if (scans > 0) {
+      sim->peek_state = masks.state;
+      sim->peek_seen |= masks.seen;
+      sim->peek_scans += scans;
+   }
+
+   if (sim->scan_last_valid == false)
+      return 0;
+   memcpy(values, sim->scan_last, sim->status_n * sizeof(double));
+
+   return 1;
+}
+
+static bool analog_scan_tap(ps_io_t *sim, scan_tap_t tap, void *ctx, double *range_min,
+                            double *range_max, uint32_t *maxdata, uint32_t n)
+{
+   uint32_t i;
+
+   if ((sim->scan_running == false) || (n < sim->status_n)) {
+      fprintf(stderr, "scan needs %d ranges\n", sim->status_n);
+      return false;
+   }
+
+   for (i = 0; i < sim->status_n; i++) {
+      range_min[i] = SCAN_RANGE_MIN;
+      range_max[i] = SCAN_RANGE_MAX;
+      maxdata[i] = SCAN_MAXDATA;
+   }
+   sim->scan_tap = tap;
+   sim->scan_tap_ctx = ctx;
+
+   return true;
+}
+
+/* scan over the first n channels with a new period, from now on */
+static void scan_restart(ps_io_t *sim, uint32_t n, double period)
+{
+   sim->scan_n = n;
+   sim->scan_period = period;
+   sim->scan_next = sim_now() + period;
+   sim->tap_decimation = lround(sim->status_period / period);
+   if (sim->tap_decimation == 0)
+      sim->tap_decimation = 1;
+   sim->tap_phase = 0;
+}
+
+/* same contract as the card plugin, the burst channels are appended to
+ * the simulated scan which runs at the burst rate until the window is in
+ */
+static bool analog_burst_arm(ps_io_t *sim, const uint32_t *channels, uint32_t n,
+                             double *scan_rate, uint32_t pre_scans, uint32_t post_scans,
+                             int edge_channel, double level)
+{
+   uint32_t i;
+
+   if ((sim->scan_running == false) || (sim->burst_state != burst_idle)) {
+      fprintf(stderr, "burst needs the status scan running and no burst armed\n");
+      return false;
+   }
+   if ((n == 0) || (n > BURST_CHANNELS_MAX) || (sim->status_n + n > SCAN_CHANNELS_MAX) ||
+       (post_scans == 0) || (pre_scans + post_scans > BURST_SCANS_MAX) ||
+       (*scan_rate <= 0) || (edge_channel >= (int)n)) {
+      fprintf(stderr, "burst of %d channels, %d+%d scans at %g Hz not possible\n",
+              n, pre_scans, post_scans, *scan_rate);
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      if (channels[i] > AI_CHANNEL_15) {
+         fprintf(stderr, "channel[%d] out or range\n", channels[i]);
+         return false;
+      }
+      sim->scan_channels[sim->status_n + i] = channels[i];
+   }
+
+   sim->burst_n = n;
+   sim->burst_capacity = pre_scans + post_scans;
+   sim->burst_post = post_scans;
+   sim->burst_written = 0;
+   sim->burst_edge = edge_channel;
+   sim->burst_level = level;
+   sim->burst_last = INFINITY;
+   sim->burst_soft = false;
+   sim->burst_state = burst_armed;
+
+   scan_restart(sim, sim->status_n + n, 1 / *scan_rate);
+
+   return true;
+}
+
+static void analog_burst_trigger(ps_io_t *sim)
+{
+   if (sim->burst_state == burst_armed)
+      sim->burst_soft = true;
+}
+
+static int analog_burst_state(ps_io_t *sim)
+{
+   return sim->burst_state;
+}
+
+static void burst_capture(ps_io_t *sim, double *values)
+{
+   double *slot;
+   uint32_t i;
+
+   if (sim->burst_state == burst_done)
+      return;
+
+   slot = &sim->burst_ring[(sim->burst_written % sim->burst_capacity) * sim->burst_n];
+   for (i = 0; i < sim->burst_n; i++)
+      slot[i] = values[i];
+
+   if (sim->burst_state == burst_armed) {
+      if (sim->burst_edge >= 0) {
+         if ((sim->burst_last < sim->burst_level) &&
+             (values[sim->burst_edge] >= sim->burst_level))
+            sim->burst_soft = true;
+         sim->burst_last = values[sim->burst_edge];
+      }
+      if (sim->burst_soft == true) {
+         sim->burst_state = burst_triggered;
+         sim->burst_trigger = sim->burst_written;
+         sim->burst_post_left = sim->burst_post;
+      }
+   }
+
+   sim->burst_written++;
+   if (sim->burst_state == burst_triggered) {
+      sim->burst_post_left--;
+      if (sim->burst_post_left == 0)
+         sim->burst_state = burst_done;
+   }
+}
+
+static int analog_burst_read(ps_io_t *sim, double *values, uint32_t size,
+                             uint32_t *trigger)
+{
+   uint32_t scans, first, s;
+
+   if (sim->burst_state != burst_done)
+      return 0;
+
+   scans = (sim->burst_written < sim->burst_capacity) ? sim->burst_written :
+                                                      sim->burst_capacity;
+   if (size < scans * sim->burst_n) {
+      fprintf(stderr, "burst needs %d values\n", scans * sim->burst_n);
+      return -1;
+   }
+
+   first = sim->burst_written - scans;
+   for (s = 0; s < scans; s++)
+      memcpy(&values[s * sim->burst_n],
+             &sim->burst_ring[((first + s) % sim->burst_capacity) * sim->burst_n],
+             sim->burst_n * sizeof(double));
+   *trigger = sim->burst_trigger - first;
+   sim->burst_state = burst_idle;
+
+   return scans;
+}
+
+static void analog_burst_disarm(ps_io_t *sim)
+{
+   if (sim->scan_n != sim->status_n)
+      scan_restart(sim, sim->status_n, sim->status_period);
+   sim->burst_state = burst_idle;
+}
+
+static void analog_scan_stop(ps_io_t *sim)
+{
+   sim->scan_running = false;
+   sim->scan_tap = NULL;
+   sim->burst_state = burst_idle;
+}
+
+static ps_io_t *sim_open(const char *device, const char *options)
+{
+   char faults[256];
+   ps_io_t *sim;
+
+   /* nothing to open, the device only tells supplies apart */
+   (void)device;
+
+   sim = calloc(1, sizeof(*sim));
+   if (sim == NULL) {
+      perror("calloc error");
+      return NULL;
+   }
+
+   sim->full_output = sim_param(options, "FULL_OUTPUT", 25000);
+   sim->current = sim_param(options, "CURRENT", 0.4);
+   sim->capacitance = sim_param(options, "CAPACITANCE", 1e-6);
+   sim->bleed = sim_param(options, "BLEED", 1e8);
+   sim->rep_rate = sim_param(options, "REP_RATE", 0);
+   sim->noise = sim_param(options, "NOISE", 0);
+   sim->latency_us = sim_param(options, "LATENCY_US", 0);
+   sim->io_errors = sim_param(options, "IO_ERRORS", 0);
+   parse_faults(sim, sim_setting(options, "FAULTS", faults, sizeof(faults)));
+
+   if ((sim->full_output <= 0) || (sim->capacitance <= 0) || (sim->bleed <= 0)) {
+      fprintf(stderr, "invalid simulation parameters\n");
+      free(sim);
+      return NULL;
+   }
+
+   sim->t0 = sim_now();
+   sim->t = sim->t0;
+   sim->next_shot = sim->t0 + ((sim->rep_rate > 0) ? 1 / sim->rep_rate : 0);
+   /* inhibit, interlock and enable start low like on the card */
+   sim->dio_state = 0;
+   sim->seed = 1;
+
+   return sim;
+}
+
+static void sim_close(ps_io_t *sim)
+{
+   analog_scan_stop(sim);
+   free(sim->profile);
+   free(sim);
+}
+
+/* same wiring as the prototype board for pcidas1602_16 */
+
+static int convert_knob_to_channel(uint32_t knob)
+{
+   switch(knob) {
+   case voltage_program_knob:
+      return AO_CHANNEL_0;
+   default:
+      fprintf(stderr, "knob out of bounds[%d]\n", knob);
+      return -1;
+   }
+
+   return 0;
+}
+
+static int convert_button_to_channel(uint32_t button)
+{
+   switch(button) {
+   case enable_key:
+      return DIO_CHANNEL_4;
+   case inhibit_key:
+      return DIO_CHANNEL_0;
+   case interlock_key:
+      return DIO_CHANNEL_2;
+   default:
+      fprintf(stderr, "button out of bounds[%d]\n", button);
+      return -1;
+   }
+
+   return 0;
+}
+
+const ps_plugin_t ps_plugin = {
+   .abi = PS_PLUGIN_ABI,
+   .size = sizeof(ps_plugin_t),
+   .name = "ale102_sim",
+   .caps = ps_cap_scan | ps_cap_scan_peek | ps_cap_scan_tap | ps_cap_dio_mask |
+           ps_cap_burst | ps_cap_profile | ps_cap_reentrant,
+   .ops = {
+      .open = sim_open,
+      .close = sim_close,
+      .convert_button_to_channel = convert_button_to_channel,
+      .convert_knob_to_channel = convert_knob_to_channel,
+      .analog_channel_input = analog_channel_input,
+      .analog_channel_output = analog_channel_output,
+      .digital_channel_output_high = digital_channel_output_high,
+      .digital_channel_output_low = digital_channel_output_low,
+      .digital_channels_output = digital_channels_output,
+      .analog_scan_start = analog_scan_start,
+      .analog_scan_read = analog_scan_read,
+      .analog_scan_stop = analog_scan_stop,
+      .analog_scan_window = analog_scan_window,
+      .analog_scan_classify = analog_scan_classify,
+      .analog_scan_peek = analog_scan_peek,
+      .analog_scan_tap = analog_scan_tap,
+      .analog_burst_arm = analog_burst_arm,
+      .analog_burst_trigger = analog_burst_trigger,
+      .analog_burst_state = analog_burst_state,
+      .analog_burst_read = analog_burst_read,
+      .analog_burst_disarm = analog_burst_disarm,
+      .analog_profile_load = analog_profile_load,
+      .analog_profile_run = analog_profile_run,
+      .analog_profile_poll = analog_profile_poll,
+      .analog_profile_stop = analog_profile_stop,
+   },
+};
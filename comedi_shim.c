@@ -0,0 +1,544 @@
+/*
+ * Stub comedi library for benchmarking without an IO card
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Preloaded in front of libcomedi it takes over every call the
+ * pcidas1602_16 plugin makes, so the plugin runs unmodified:
+ *
+ *    LD_PRELOAD=./comedi_shim.so ./ps_bench
+ *
+ * Writes to the analog output and the digital lines are timestamped,
+ * ps_bench looks the timestamps up to measure how long an operator
+ * action takes to reach the card. Every comedi_open() gets a device of
+ * its own. Streaming commands on the analog input and the analog output
+ * run independently: the input fills a memfd standing in for the comedi
+ * buffer, the output takes what the plugin write()s to the device and
+ * converts it at the command rate once internally triggered.
+ *
+ *    COMEDI_SHIM_LATENCY_US   delay added to every device call [us]
+ *    COMEDI_SHIM_AI_VOLTS     voltage on every analog input, default 5
+ *    COMEDI_SHIM_NO_STREAM    set to refuse streaming commands
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <comedilib.h>
+
+#include "comedi_shim.h"
+
+#define SHIM_BUFFER_SIZE 65536
+/* largest buffer comedi_set_buffer_size() grants */
+#define SHIM_BUFFER_MAX (1 << 20)
+#define SHIM_MAXDATA 0xffff
+
+/* subdevices of the card, as numbered by the plugin */
+enum {
+   shim_ai = 0,
+   shim_ao,
+   shim_dio,
+   SHIM_SUBDEVICES,
+};
+
+/* write timestamps, read by the benchmark through dlsym() */
+comedi_shim_stats_t comedi_shim_stats;
+
+typedef struct comedi_shim {
+   long latency_us;
+   double ai_volts;
+   bool no_stream;
+   enum comedi_oor_behavior oor;
+} comedi_shim_t;
+
+/* emulated command of one subdevice, counts are bytes: for the input
+ * written by the card and read by the plugin, for the output written by
+ * the plugin and converted by the card
+ */
+typedef struct shim_stream {
+   /* started, waits for comedi_internal_trigger() */
+   bool armed;
+   bool running;
+   uint32_t scan_n;
+   uint32_t buffer_size;
+   uint64_t period_ns;
+   uint64_t start_ns;
+   /* bytes after which the command ends, 0 runs until cancelled */
+   uint64_t stop_count;
+   uint64_t scans_written;
+   uint64_t write_count;
+   uint64_t read_count;
+} shim_stream_t;
+
+typedef struct shim_device {
+   /* analog input buffer at offset 0, output written past it */
+   int fd;
+   char *map;
+   shim_stream_t streams[SHIM_SUBDEVICES];
+} shim_device_t;
+
+static comedi_shim_t shim;
+
+static comedi_range range_ai = { -10.0, 10.0, UNIT_volt };
+static comedi_range range_ao = { 0.0, 10.0, UNIT_volt };
+
+static uint64_t shim_now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void shim_call(void)
+{
+   struct timespec ts;
+
+   if (shim.latency_us > 0) {
+      ts.tv_sec = shim.latency_us / 1000000;
+      ts.tv_nsec = (shim.latency_us % 1000000) * 1000;
+      nanosleep(&ts, NULL);
+   }
+}
+
+static void shim_write_done(void)
+{
+   comedi_shim_stats.last_write_ns = shim_now_ns();
+   __sync_synchronize();
+   comedi_shim_stats.writes++;
+}
+
+static void shim_read_done(void)
+{
+   comedi_shim_stats.last_read_ns = shim_now_ns();
+   __sync_synchronize();
+   comedi_shim_stats.reads++;
+}
+
+/* streams exist for the analog subdevices only */
+static shim_stream_t *shim_stream(comedi_t *it, unsigned int subdevice)
+{
+   shim_device_t *device = (shim_device_t *)it;
+
+   if ((device == NULL) || ((subdevice != shim_ai) && (subdevice != shim_ao))) {
+      errno = EINVAL;
+      return NULL;
+   }
+
+   return &device->streams[subdevice];
+}
+
+/* picks up what the plugin wrote and converts every sample that came due,
+ * the command stops at its count or when the buffer runs dry
+ */
+static void shim_output(shim_device_t *device)
+{
+   shim_stream_t *stream = &device->streams[shim_ao];
+   uint64_t due;
+   off_t pos;
+
+   pos = lseek(device->fd, 0, SEEK_CUR);
+   if (pos >= SHIM_BUFFER_SIZE)
+      stream->write_count = pos - SHIM_BUFFER_SIZE;
+   if (stream->running == false)
+      return;
+
+   due = (shim_now_ns() - stream->start_ns) / stream->period_ns *
+         stream->scan_n * sizeof(sampl_t);
+   if ((stream->stop_count != 0) && (due >= stream->stop_count)) {
+      due = stream->stop_count;
+      stream->running = false;
+   }
+   if (due > stream->write_count) {
+      /* underrun, the real driver ends the command */
+      due = stream->write_count;
+      stream->running = false;
+   }
+   stream->read_count = due;
+}
+
+comedi_t *comedi_open(const char *filename)
+{
+   shim_device_t *device;
+   const char *str;
+   int i;
+
+   str = getenv("COMEDI_SHIM_LATENCY_US");
+   shim.latency_us = (str != NULL) ? strtol(str, NULL, 10) : 0;
+   str = getenv("COMEDI_SHIM_AI_VOLTS");
+   shim.ai_volts = (str != NULL) ? strtod(str, NULL) : 5.0;
+   shim.no_stream = (getenv("COMEDI_SHIM_NO_STREAM") != NULL);
+   shim.oor = COMEDI_OOR_NUMBER;
+
+   device = calloc(1, sizeof(*device));
+   if (device == NULL)
+      return NULL;
+   for (i = 0; i < SHIM_SUBDEVICES; i++)
+      device->streams[i].buffer_size = SHIM_BUFFER_SIZE;
+
+   /* the plugin maps the buffer before it starts the command */
+   device->fd = memfd_create("comedi_shim", 0);
+   if (device->fd == -1) {
+      perror("memfd_create");
+      return (comedi_t *)device;
+   }
+   if (ftruncate(device->fd, SHIM_BUFFER_SIZE) == -1) {
+      perror("ftruncate");
+      return (comedi_t *)device;
+   }
+   device->map = mmap(NULL, SHIM_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, device->fd, 0);
+   if (device->map == MAP_FAILED) {
+      perror("mmap");
+      device->map = NULL;
+   }
+
+   return (comedi_t *)device;
+}
+
+int comedi_close(comedi_t *it)
+{
+   shim_device_t *device = (shim_device_t *)it;
+
+   if (device->map != NULL)
+      munmap(device->map, SHIM_BUFFER_SIZE);
+   if (device->fd != -1)
+      close(device->fd);
+   free(device);
+
+   return 0;
+}
+
+void comedi_perror(const char *s)
+{
+   fprintf(stderr, "%s: %s\n", s, strerror(errno));
+}
+
+int comedi_fileno(comedi_t *it)
+{
+   return ((shim_device_t *)it)->fd;
+}
+
+enum comedi_oor_behavior comedi_set_global_oor_behavior(enum comedi_oor_behavior behavior)
+{
+   enum comedi_oor_behavior old = shim.oor;
+
+   shim.oor = behavior;
+   return old;
+}
+
+comedi_range *comedi_get_range(comedi_t *it, unsigned int subdevice,
+                               unsigned int chan, unsigned int range)
+{
+   return (subdevice == shim_ai) ? &range_ai : &range_ao;
+}
+
+lsampl_t comedi_get_maxdata(comedi_t *it, unsigned int subdevice, unsigned int chan)
+{
+   return SHIM_MAXDATA;
+}
+
+double comedi_to_phys(lsampl_t data, const comedi_range *rng, lsampl_t maxdata)
+{
+   if ((shim.oor == COMEDI_OOR_NAN) && ((data == 0) || (data == maxdata)))
+      return NAN;
+
+   return rng->min + (rng->max - rng->min) * data / maxdata;
+}
+
+lsampl_t comedi_from_phys(double data, const comedi_range *rng, lsampl_t maxdata)
+{
+   double code = (data - rng->min) / (rng->max - rng->min) * maxdata;
+
+   if (code < 0)
+      return 0;
+   if (code > maxdata)
+      return maxdata;
+   return (lsampl_t)(code + 0.5);
+}
+
+int comedi_data_read(comedi_t *it, unsigned int subd, unsigned int chan,
+                     unsigned int range, unsigned int aref, lsampl_t *data)
+{
+   shim_call();
+   *data = comedi_from_phys(shim.ai_volts, &range_ai, SHIM_MAXDATA);
+   shim_read_done();
+
+   return 1;
+}
+
+int comedi_data_write(comedi_t *it, unsigned int subd, unsigned int chan,
+                      unsigned int range, unsigned int aref, lsampl_t data)
+{
+   shim_call();
+   shim_write_done();
+
+   return 1;
+}
+
+int comedi_dio_config(comedi_t *it, unsigned int subd, unsigned int chan,
+                      unsigned int dir)
+{
+   shim_call();
+
+   return 1;
+}
+
+int comedi_dio_write(comedi_t *it, unsigned int subd, unsigned int chan,
+                     unsigned int bit)
+{
+   shim_call();
+   shim_write_done();
+
+   return 1;
+}
+
+int comedi_dio_bitfield2(comedi_t *it, unsigned int subd, unsigned int write_mask,
+                         unsigned int *bits, unsigned int base_channel)
+{
+   shim_call();
+   if (write_mask != 0)
+      shim_write_done();
+
+   return 1;
+}
+
+/* 16 bit samples like the real card, running while a command is */
+int comedi_get_subdevice_flags(comedi_t *it, unsigned int subdevice)
+{
+   shim_stream_t *stream;
+
+   if (subdevice == shim_dio)
+      return 0;
+   stream = shim_stream(it, subdevice);
+   if (stream == NULL)
+      return -1;
+   if (subdevice == shim_ao)
+      shim_output((shim_device_t *)it);
+
+   return ((stream->armed == true) || (stream->running == true)) ? SDF_RUNNING : 0;
+}
+
+int comedi_get_cmd_generic_timed(comedi_t *it, unsigned int subd, comedi_cmd *cmd,
+                                 unsigned int chanlist_len, unsigned int scan_period_ns)
+{
+   if (shim.no_stream == true) {
+      errno = EIO;
+      return -1;
+   }
+
+   memset(cmd, 0, sizeof(*cmd));
+   cmd->subdev = subd;
+   cmd->start_src = TRIG_NOW;
+   cmd->scan_begin_src = TRIG_TIMER;
+   cmd->scan_begin_arg = scan_period_ns;
+   cmd->convert_src = TRIG_TIMER;
+   cmd->convert_arg = scan_period_ns / (chanlist_len ? chanlist_len : 1);
+   cmd->scan_end_src = TRIG_COUNT;
+   cmd->scan_end_arg = chanlist_len;
+   cmd->stop_src = TRIG_NONE;
+
+   return 0;
+}
+
+int comedi_command_test(comedi_t *it, comedi_cmd *cmd)
+{
+   return 0;
+}
+
+int comedi_command(comedi_t *it, comedi_cmd *cmd)
+{
+   shim_device_t *device = (shim_device_t *)it;
+   shim_stream_t *stream;
+
+   stream = shim_stream(it, cmd->subdev);
+   if (stream == NULL)
+      return -1;
+   if (device->map == NULL) {
+      errno = ENOMEM;
+      return -1;
+   }
+
+   stream->scan_n = cmd->chanlist_len;
+   stream->period_ns = cmd->scan_begin_arg ? cmd->scan_begin_arg : 1000000;
+   stream->stop_count = (cmd->stop_src == TRIG_COUNT) ?
+                        (uint64_t)cmd->stop_arg * stream->scan_n * sizeof(sampl_t) : 0;
+   stream->start_ns = shim_now_ns();
+   stream->scans_written = 0;
+   stream->write_count = 0;
+   stream->read_count = 0;
+   stream->armed = (cmd->start_src == TRIG_INT);
+   stream->running = !stream->armed;
+   /* output samples are written past the input buffer */
+   if ((cmd->subdev == shim_ao) &&
+       (lseek(device->fd, SHIM_BUFFER_SIZE, SEEK_SET) == -1))
+      return -1;
+
+   return 0;
+}
+
+int comedi_internal_trigger(comedi_t *it, unsigned int subd, unsigned int trignum)
+{
+   shim_stream_t *stream;
+
+   shim_call();
+   stream = shim_stream(it, subd);
+   if (stream == NULL)
+      return -1;
+   if (stream->armed == false) {
+      errno = EINVAL;
+      return -1;
+   }
+   stream->armed = false;
+   stream->running = true;
+   stream->start_ns = shim_now_ns();
+
+   return 0;
+}
+
+int comedi_cancel(comedi_t *it, unsigned int subdevice)
+{
+   shim_stream_t *stream;
+
+   stream = shim_stream(it, subdevice);
+   if (stream == NULL)
+      return -1;
+   stream->armed = false;
+   stream->running = false;
+
+   return 0;
+}
+
+int comedi_get_buffer_size(comedi_t *it, unsigned int subdevice)
+{
+   shim_stream_t *stream;
+
+   stream = shim_stream(it, subdevice);
+   if (stream == NULL)
+      return -1;
+
+   return stream->buffer_size;
+}
+
+/* the input buffer is mapped at a fixed size, the output one may grow */
+int comedi_set_buffer_size(comedi_t *it, unsigned int subdevice, unsigned int len)
+{
+   shim_stream_t *stream;
+   long page = sysconf(_SC_PAGESIZE);
+
+   stream = shim_stream(it, subdevice);
+   if (stream == NULL)
+      return -1;
+   len = (len + page - 1) / page * page;
+   if ((subdevice != shim_ao) || (len > SHIM_BUFFER_MAX)) {
+      errno = EINVAL;
+      return -1;
+   }
+   if ((stream->armed == true) || (stream->running == true)) {
+      errno = EBUSY;
+      return -1;
+   }
+   stream->buffer_size = len;
+
+   return len;
+}
+
+/* fill in every scan that came due since the last look */
+static int shim_input(shim_device_t *device)
+{
+   shim_stream_t *stream = &device->streams[shim_ai];
+   uint64_t due, i;
+   uint32_t pos, ch;
+   sampl_t code;
+
+   if (stream->running == false) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   code = comedi_from_phys(shim.ai_volts, &range_ai, SHIM_MAXDATA);
+   due = (shim_now_ns() - stream->start_ns) / stream->period_ns;
+   for (i = stream->scans_written; i < due; i++) {
+      if (stream->write_count - stream->read_count + stream->scan_n * sizeof(sampl_t) >
+          SHIM_BUFFER_SIZE) {
+         /* the real driver stops the command on overflow */
+         stream->running = false;
+         errno = EPIPE;
+         return -1;
+      }
+      for (ch = 0; ch < stream->scan_n; ch++) {
+         pos = stream->write_count % SHIM_BUFFER_SIZE;
+         *(sampl_t *)(device->map + pos) = code;
+         stream->write_count += sizeof(sampl_t);
+      }
+   }
+   stream->scans_written = due;
+   shim_read_done();
+
+   return stream->write_count - stream->read_count;
+}
+
+int comedi_get_buffer_contents(comedi_t *it, unsigned int subdevice)
+{
+   shim_device_t *device = (shim_device_t *)it;
+   shim_stream_t *stream;
+
+   shim_call();
+   stream = shim_stream(it, subdevice);
+   if (stream == NULL)
+      return -1;
+   if (subdevice == shim_ai)
+      return shim_input(device);
+
+   shim_output(device);
+   return stream->write_count - stream->read_count;
+}
+
+/* the analog input is the read subdevice, the only one mapped */
+int comedi_get_buffer_offset(comedi_t *it, unsigned int subdevice)
+{
+   shim_device_t *device = (shim_device_t *)it;
+
+   if (subdevice != shim_ai) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   return device->streams[shim_ai].read_count % SHIM_BUFFER_SIZE;
+}
+
+int comedi_mark_buffer_read(comedi_t *it, unsigned int subdevice, unsigned int bytes)
+{
+   shim_device_t *device = (shim_device_t *)it;
+   shim_stream_t *stream = &device->streams[shim_ai];
+
+   shim_call();
+   if ((subdevice != shim_ai) || (bytes > stream->write_count - stream->read_count)) {
+      errno = EINVAL;
+      return -1;
+   }
+   stream->read_count += bytes;
+
+   return bytes;
+}
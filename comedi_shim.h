@@ -0,0 +1,35 @@
+/*
+ * Header file for the benchmark comedi shim
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __COMEDI_SHIM_H
+#define __COMEDI_SHIM_H
+
+#include <stdint.h>
+
+/* exported by comedi_shim.so as comedi_shim_stats, times are
+ * CLOCK_MONOTONIC nanoseconds, counters are bumped after the time
+ */
+typedef struct comedi_shim_stats {
+   volatile uint64_t writes;
+   volatile uint64_t last_write_ns;
+   volatile uint64_t reads;
+   volatile uint64_t last_read_ns;
+} comedi_shim_stats_t;
+
+#endif /* __COMEDI_SHIM_H */
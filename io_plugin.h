@@ -0,0 +1,112 @@
+/*
+ * Supporting header file - IO plugin interface
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __IO_PLUGIN_H
+#define __IO_PLUGIN_H
+
+/* A plugin exports a single ps_plugin_t named PS_PLUGIN_SYMBOL. Loading
+ * it does nothing, open() sets up a device and returns the context every
+ * other call takes. Operations beyond the basic IO come with a bit in
+ * caps, their entries are NULL without it.
+ *
+ * abi changes when an entry changes meaning, new entries are appended
+ * and make size grow, a plugin built against an older header has a
+ * smaller size and lacks the entries past it.
+ */
+
+#define PS_PLUGIN_SYMBOL "ps_plugin"
+#define PS_PLUGIN_ABI 1
+
+/* capabilities */
+enum {
+   /* streaming status scan, classified against windows inside the plugin */
+   ps_cap_scan = 1 << 0,
+   /* look at the newest scan without taking it */
+   ps_cap_scan_peek = 1 << 1,
+   /* raw scans handed to a tap */
+   ps_cap_scan_tap = 1 << 2,
+   /* several digital lines in one masked write */
+   ps_cap_dio_mask = 1 << 3,
+   /* pre and post trigger window on top of the status scan */
+   ps_cap_burst = 1 << 4,
+   /* analog output paced by the card clock */
+   ps_cap_profile = 1 << 5,
+   /* contexts share no state, several may be open in one copy of the
+    * plugin and used from different threads at the same time */
+   ps_cap_reentrant = 1 << 6,
+};
+
+/* context of one open device, defined by each plugin */
+typedef struct ps_io ps_io_t;
+
+typedef struct ps_plugin_ops {
+   /* device and options as configured, either may be NULL for the
+    * plugin default, NULL on failure, outputs are low once it returns */
+   ps_io_t *(*open)(const char *device, const char *options);
+   void (*close)(ps_io_t *io);
+   /* wiring of the supply to the card, the same for every context */
+   int (*convert_button_to_channel)(uint32_t button);
+   int (*convert_knob_to_channel)(uint32_t knob);
+   bool (*analog_channel_input)(ps_io_t *io, uint32_t channel, double *value);
+   bool (*analog_channel_output)(ps_io_t *io, uint32_t channel, double value,
+                                 double v_max, double v_min);
+   bool (*digital_channel_output_high)(ps_io_t *io, uint32_t channel);
+   bool (*digital_channel_output_low)(ps_io_t *io, uint32_t channel);
+   /* ps_cap_dio_mask */
+   bool (*digital_channels_output)(ps_io_t *io, uint32_t mask, uint32_t bits);
+   /* ps_cap_scan */
+   bool (*analog_scan_start)(ps_io_t *io, const uint32_t *channels, uint32_t n,
+                             double scan_rate);
+   int (*analog_scan_read)(ps_io_t *io, double *values, uint32_t n);
+   void (*analog_scan_stop)(ps_io_t *io);
+   bool (*analog_scan_window)(ps_io_t *io, const double *lower, const double *upper,
+                              uint32_t n);
+   int (*analog_scan_classify)(ps_io_t *io, uint32_t *state, uint32_t *seen);
+   /* ps_cap_scan_peek */
+   int (*analog_scan_peek)(ps_io_t *io, double *values, uint32_t n);
+   /* ps_cap_scan_tap */
+   bool (*analog_scan_tap)(ps_io_t *io, scan_tap_t tap, void *ctx, double *range_min,
+                           double *range_max, uint32_t *maxdata, uint32_t n);
+   /* ps_cap_burst */
+   bool (*analog_burst_arm)(ps_io_t *io, const uint32_t *channels, uint32_t n,
+                            double *scan_rate, uint32_t pre_scans, uint32_t post_scans,
+                            int edge_channel, double level);
+   void (*analog_burst_trigger)(ps_io_t *io);
+   int (*analog_burst_state)(ps_io_t *io);
+   int (*analog_burst_read)(ps_io_t *io, double *values, uint32_t size,
+                            uint32_t *trigger);
+   void (*analog_burst_disarm)(ps_io_t *io);
+   /* ps_cap_profile */
+   bool (*analog_profile_load)(ps_io_t *io, uint32_t channel, const double *values,
+                               uint32_t n, double *rate, double v_max, double v_min);
+   bool (*analog_profile_run)(ps_io_t *io);
+   int (*analog_profile_poll)(ps_io_t *io);
+   void (*analog_profile_stop)(ps_io_t *io);
+} ps_plugin_ops_t;
+
+typedef struct ps_plugin {
+   uint32_t abi;
+   /* sizeof(ps_plugin_t) the plugin was built with */
+   uint32_t size;
+   const char *name;
+   uint32_t caps;
+   ps_plugin_ops_t ops;
+} ps_plugin_t;
+
+#endif /* __IO_PLUGIN_H */
@@ -20,11 +20,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <comedilib.h>
 #include <ctype.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "types.h"
+#include "io_plugin.h"
+#include "power_supply_trace.h"
 
 /* enable for debugging */
 #undef DEBUG
@@ -96,22 +101,108 @@ enum {
 #define ANALOG_OUTPUT_RANGE_10_10V 1
 #define ANALOG_OUTPUT_RANGE_0_10V 3
 
-static const char filename[] = "/dev/comedi0";
+/* card opened when the configuration names none */
+#define DEVICE_DEFAULT "/dev/comedi0"
 
 #define BIT_0 0
 #define BIT_1 1
 
-typedef struct pcidas1602_16 {
+/* at most every analog input channel in one scan */
+#define SCAN_CHANNELS_MAX 16
+/* scans classified in one pass */
+#define SCAN_BLOCK_SCANS 64
+#define SCAN_BLOCK_MAX (SCAN_CHANNELS_MAX * SCAN_BLOCK_SCANS)
+/* burst channels ride on the status scan, window of at most
+ * BURST_SCANS_MAX scans around the trigger */
+#define BURST_CHANNELS_MAX 4
+#define BURST_SCANS_MAX 65536
+
+/* per channel conversion data and window thresholds in raw codes */
+typedef struct scan_channel {
+   comedi_range *range;
+   lsampl_t maxdata;
+   lsampl_t lower;
+   lsampl_t upper;
+} scan_channel_t;
+
+#define DIO_CHANNELS_MASK ((1 << (DIO_CHANNEL_23 + 1)) - 1)
+
+/* one open card, every call works on one of these only */
+struct ps_io {
    comedi_t *device;
-} pcidas1602_16_t;
-  
-bool io_plugin_initialized = false;
+   /* lines already configured as outputs and their last written level */
+   uint32_t dio_output;
+   uint32_t dio_state;
+   /* analog outputs written since load and their last code */
+   uint32_t ao_written;
+   lsampl_t ao_code[AO_CHANNEL_1 + 1];
+   /* streaming acquisition of analog inputs */
+   bool scan_running;
+   uint32_t scan_n;
+   unsigned int scan_chanlist[SCAN_CHANNELS_MAX];
+   scan_channel_t scan_table[SCAN_CHANNELS_MAX];
+   /* window table repeated over a whole block, lower bound and width */
+   uint32_t block_n;
+   lsampl_t block_lower[SCAN_BLOCK_MAX];
+   lsampl_t block_width[SCAN_BLOCK_MAX];
+   lsampl_t block[SCAN_BLOCK_MAX];
+   uint32_t block_seen[SCAN_BLOCK_MAX];
+   /* status channels of the newest scan classified */
+   bool scan_last_valid;
+   lsampl_t scan_last[SCAN_CHANNELS_MAX];
+   /* optional consumer of the raw scans, during a burst it gets the
+    * status channels of every tap_decimation-th scan only */
+   scan_tap_t scan_tap;
+   void *scan_tap_ctx;
+   uint32_t tap_decimation;
+   uint32_t tap_phase;
+   lsampl_t tap_block[SCAN_CHANNELS_MAX * SCAN_BLOCK_SCANS];
+   /* rate of the running command, as the card could do it */
+   double scan_rate;
+   /* status part of the scan, what is left when no burst runs */
+   uint32_t status_n;
+   double status_rate;
+   /* burst capture, ring of pre + post scans of the burst channels */
+   int burst_state;
+   uint32_t burst_n;
+   scan_channel_t burst_table[BURST_CHANNELS_MAX];
+   uint32_t burst_capacity;
+   uint32_t burst_post;
+   uint32_t burst_post_left;
+   uint32_t burst_written;
+   uint32_t burst_trigger;
+   int burst_edge;
+   lsampl_t burst_level;
+   lsampl_t burst_last;
+   bool burst_soft;
+   lsampl_t burst_ring[BURST_SCANS_MAX * BURST_CHANNELS_MAX];
+   char *scan_map;
+   uint32_t scan_map_size;
+   uint32_t scan_read_offset;
+   uint32_t sample_size;
+   uint32_t scan_size;
+   /* analog output profile, codes in the sample format of the
+    * subdevice, profile_written of them handed to the driver so far */
+   bool profile_running;
+   char *profile_codes;
+   uint32_t profile_n;
+   uint32_t profile_written;
+   uint32_t profile_sample_size;
+   unsigned int profile_chanlist[1];
+   comedi_cmd profile_cmd;
+};
 
-static pcidas1602_16_t das_io_card;
+static bool scan_command(ps_io_t *card, uint32_t n, double scan_rate);
+static void scan_layout_windows(ps_io_t *card);
+static bool scan_restart(ps_io_t *card, uint32_t n, double scan_rate);
+static void burst_capture(ps_io_t *card, uint32_t scans);
+static uint32_t scan_tap_block(ps_io_t *card, uint32_t done, uint32_t scans,
+                               uint32_t tapped, uint32_t tap_total);
+static bool profile_fill(ps_io_t *card);
 
-bool analog_channel_input(uint32_t channel, double *value)
+static bool analog_channel_input(ps_io_t *card, uint32_t channel, double *value)
 {
-   comedi_t *device = das_io_card.device;
+   comedi_t *device = card->device;
    lsampl_t data;
    comedi_range *range_info;
    lsampl_t maxdata;
@@ -125,8 +216,10 @@ bool analog_channel_input(uint32_t channel, double *value)
    comedi_set_global_oor_behavior(COMEDI_OOR_NAN);
 
    /* read input channel */
+   TRACE_BEGIN(trace_comedi_read, channel);
    retval = comedi_data_read(device, ANALOG_INPUT, channel,
                              ANALOG_INPUT_RANGE_10_10V, AREF_GROUND, &data);
+   TRACE_END(trace_comedi_read, retval);
    if (retval < 0) {
       fprintf(stderr, "error reading channel[%d]\n", channel);
       return false;
@@ -156,9 +249,701 @@ bool analog_channel_input(uint32_t channel, double *value)
    return true;
 }
 
-bool analog_channel_output(uint32_t channel, double value, double v_max, double v_min)
+/* start hardware paced acquisition of given analog input channels,
+ * one scan over all channels every 1/scan_rate seconds, samples land
+ * in the comedi buffer which is mapped into our address space
+ */
+static bool analog_scan_start(ps_io_t *card, const uint32_t *channels, uint32_t n,
+                              double scan_rate)
+{
+   comedi_t *device = card->device;
+   uint32_t i;
+   bool rc;
+
+   if (card->scan_running == true) {
+      fprintf(stderr, "scan already running\n");
+      return false;
+   }
+
+   if ((n == 0) || (n > SCAN_CHANNELS_MAX)) {
+      fprintf(stderr, "scan length[%d] out of range\n", n);
+      return false;
+   }
+
+   if (scan_rate <= 0) {
+      fprintf(stderr, "scan rate[%g] out of range\n", scan_rate);
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      if (channels[i] > AI_CHANNEL_15) {
+         fprintf(stderr, "channel[%d] out or range\n", channels[i]);
+         return false;
+      }
+      card->scan_chanlist[i] = CR_PACK(channels[i], ANALOG_INPUT_RANGE_10_10V,
+                                       AREF_GROUND);
+      card->scan_table[i].range = comedi_get_range(device, ANALOG_INPUT, channels[i],
+                                                   ANALOG_INPUT_RANGE_10_10V);
+      card->scan_table[i].maxdata = comedi_get_maxdata(device, ANALOG_INPUT, channels[i]);
+      /* empty window until analog_scan_window() */
+      card->scan_table[i].lower = 0;
+      card->scan_table[i].upper = 0;
+      if (card->scan_table[i].range == NULL) {
+         fprintf(stderr, "no range for channel[%d]\n", channels[i]);
+         return false;
+      }
+   }
+   card->scan_n = n;
+   card->block_n = n * SCAN_BLOCK_SCANS;
+   card->scan_last_valid = false;
+   memset(card->block_lower, 0, sizeof(card->block_lower));
+   memset(card->block_width, 0, sizeof(card->block_width));
+
+   rc = scan_command(card, n, scan_rate);
+   if (rc == false)
+      return false;
+   card->status_n = n;
+   card->status_rate = card->scan_rate;
+   card->burst_state = burst_idle;
+   card->tap_decimation = 1;
+   card->tap_phase = 0;
+
+   return true;
+}
+
+/* runs the command over the first n entries of the channel list */
+static bool scan_command(ps_io_t *card, uint32_t n, double scan_rate)
 {
-   comedi_t *device = das_io_card.device;
+   comedi_t *device = card->device;
+   comedi_cmd cmd;
+   int retval;
+
+   memset(&cmd, 0, sizeof(cmd));
+   retval = comedi_get_cmd_generic_timed(device, ANALOG_INPUT, &cmd, n,
+                                         (unsigned int)(1e9 / scan_rate));
+   if (retval < 0) {
+      comedi_perror("comedi_get_cmd_generic_timed");
+      return false;
+   }
+   cmd.chanlist = card->scan_chanlist;
+   cmd.chanlist_len = n;
+   cmd.scan_end_arg = n;
+   cmd.stop_src = TRIG_NONE;
+   cmd.stop_arg = 0;
+   /* every scan reaches the buffer as it ends, not when the fifo is half
+    * full, the fault check counts on a scan period of delay */
+   cmd.flags |= CMDF_WAKE_EOS;
+
+   /* first test may adjust timing arguments, second must pass */
+   comedi_command_test(device, &cmd);
+   retval = comedi_command_test(device, &cmd);
+   if (retval != 0) {
+      fprintf(stderr, "scan command test failed[%d]\n", retval);
+      return false;
+   }
+
+   if (comedi_get_subdevice_flags(device, ANALOG_INPUT) & SDF_LSAMPL)
+      card->sample_size = sizeof(lsampl_t);
+   else
+      card->sample_size = sizeof(sampl_t);
+   card->scan_size = n * card->sample_size;
+
+   retval = comedi_get_buffer_size(device, ANALOG_INPUT);
+   if (retval <= 0) {
+      comedi_perror("comedi_get_buffer_size");
+      return false;
+   }
+   card->scan_map_size = retval;
+   card->scan_map = mmap(NULL, card->scan_map_size, PROT_READ,
+                         MAP_SHARED, comedi_fileno(device), 0);
+   if (card->scan_map == MAP_FAILED) {
+      perror("mmap of comedi buffer failed");
+      card->scan_map = NULL;
+      return false;
+   }
+
+   retval = comedi_command(device, &cmd);
+   if (retval < 0) {
+      comedi_perror("comedi_command");
+      munmap(card->scan_map, card->scan_map_size);
+      card->scan_map = NULL;
+      return false;
+   }
+   /* buffer is reset when the command starts */
+   card->scan_read_offset = 0;
+   card->scan_rate = 1e9 / cmd.scan_begin_arg;
+   card->scan_running = true;
+
+#ifdef DEBUG
+   printf("scan of %d channels, %d ns period, buffer %d bytes\n",
+          n, cmd.scan_begin_arg, card->scan_map_size);
+#endif
+
+   return true;
+}
+
+/* return the number of complete scans acquired since the previous call,
+ * values holds the most recent one in volts, nothing is copied when no
+ * new scan arrived
+ */
+static int analog_scan_read(ps_io_t *card, double *values, uint32_t n)
+{
+   comedi_t *device = card->device;
+   uint32_t scans, start, pos, i;
+   lsampl_t data;
+   int contents;
+
+   if (card->scan_running == false) {
+      fprintf(stderr, "scan not running\n");
+      return -1;
+   }
+
+   if (n < card->status_n) {
+      fprintf(stderr, "scan needs %d values\n", card->status_n);
+      return -1;
+   }
+
+   contents = comedi_get_buffer_contents(device, ANALOG_INPUT);
+   if (contents < 0) {
+      comedi_perror("comedi_get_buffer_contents");
+      return -1;
+   }
+   scans = contents / card->scan_size;
+   if (scans == 0)
+      return 0;
+
+   /* the last complete scan, it may wrap around the end of the buffer,
+    * burst channels behind the status ones are left out */
+   start = card->scan_read_offset + (scans - 1) * card->scan_size;
+   for (i = 0; i < card->status_n; i++) {
+      pos = (start + i * card->sample_size) % card->scan_map_size;
+      if (card->sample_size == sizeof(sampl_t))
+         data = *(sampl_t *)(card->scan_map + pos);
+      else
+         data = *(lsampl_t *)(card->scan_map + pos);
+      values[i] = comedi_to_phys(data, card->scan_table[i].range,
+                                 card->scan_table[i].maxdata);
+   }
+
+   if (comedi_mark_buffer_read(device, ANALOG_INPUT,
+                               scans * card->scan_size) < 0) {
+      comedi_perror("comedi_mark_buffer_read");
+      return -1;
+   }
+   card->scan_read_offset = (card->scan_read_offset +
+                             scans * card->scan_size) %
+                            card->scan_map_size;
+
+   return scans;
+}
+
+/* newest status scan in volts without consuming it, classification still
+ * gets every scan, returns 0 before the first scan arrived
+ */
+static int analog_scan_peek(ps_io_t *card, double *values, uint32_t n)
+{
+   comedi_t *device = card->device;
+   uint32_t scans, start, pos, i;
+   lsampl_t data;
+   int contents;
+
+   if ((card->scan_running == false) || (n < card->status_n)) {
+      fprintf(stderr, "scan needs %d values\n", card->status_n);
+      return -1;
+   }
+
+   contents = comedi_get_buffer_contents(device, ANALOG_INPUT);
+   if (contents < 0) {
+      comedi_perror("comedi_get_buffer_contents");
+      return -1;
+   }
+   scans = contents / card->scan_size;
+
+   if (scans == 0) {
+      /* all classified already, the newest is kept from then */
+      if (card->scan_last_valid == false)
+         return 0;
+      for (i = 0; i < card->status_n; i++)
+         values[i] = comedi_to_phys(card->scan_last[i], card->scan_table[i].range,
+                                    card->scan_table[i].maxdata);
+      return 1;
+   }
+
+   start = card->scan_read_offset + (scans - 1) * card->scan_size;
+   for (i = 0; i < card->status_n; i++) {
+      pos = (start + i * card->sample_size) % card->scan_map_size;
+      if (card->sample_size == sizeof(sampl_t))
+         data = *(sampl_t *)(card->scan_map + pos);
+      else
+         data = *(lsampl_t *)(card->scan_map + pos);
+      values[i] = comedi_to_phys(data, card->scan_table[i].range,
+                                 card->scan_table[i].maxdata);
+   }
+
+   return 1;
+}
+
+/* convert per channel voltage window (lower, upper) into raw codes,
+ * a sample is inside when lower < sample < upper
+ */
+static bool analog_scan_window(ps_io_t *card, const double *lower, const double *upper,
+                               uint32_t n)
+{
+   scan_channel_t *ch;
+   uint32_t i;
+
+   if (card->scan_running == false) {
+      fprintf(stderr, "scan not running\n");
+      return false;
+   }
+
+   if (n != card->scan_n) {
+      fprintf(stderr, "scan needs %d thresholds\n", card->scan_n);
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      ch = &card->scan_table[i];
+      if ((lower[i] >= upper[i]) ||
+          (lower[i] < ch->range->min) || (upper[i] > ch->range->max)) {
+         fprintf(stderr, "window[%g,%g] out of range [%g,%g]\n",
+                 lower[i], upper[i], ch->range->min, ch->range->max);
+         return false;
+      }
+      ch->lower = comedi_from_phys(lower[i], ch->range, ch->maxdata);
+      ch->upper = comedi_from_phys(upper[i], ch->range, ch->maxdata);
+#ifdef DEBUG
+      printf("channel[%d] window raw (%d,%d)\n", i, ch->lower, ch->upper);
+#endif
+   }
+   scan_layout_windows(card);
+
+   return true;
+}
+
+/* lay the table out over a whole block so the compare loop runs
+ * straight through without a per sample channel lookup
+ */
+static void scan_layout_windows(ps_io_t *card)
+{
+   scan_channel_t *ch;
+   uint32_t i;
+
+   for (i = 0; i < card->block_n; i++) {
+      ch = &card->scan_table[i % card->scan_n];
+      card->block_lower[i] = ch->lower + 1;
+      card->block_width[i] = (ch->upper > ch->lower) ?
+                             ch->upper - ch->lower - 1 : 0;
+   }
+}
+
+/* copy samples out of the mapped buffer, widening them to lsampl_t */
+static void scan_copy(ps_io_t *card, lsampl_t *dst, uint32_t offset, uint32_t samples)
+{
+   uint32_t size = card->sample_size;
+   uint32_t first, i;
+   const sampl_t *s16;
+   const lsampl_t *s32;
+
+   /* samples up to the end of the buffer, then the wrapped rest */
+   first = (card->scan_map_size - offset) / size;
+   if (first > samples)
+      first = samples;
+
+   if (size == sizeof(sampl_t)) {
+      s16 = (const sampl_t *)(card->scan_map + offset);
+      for (i = 0; i < first; i++)
+         dst[i] = s16[i];
+      s16 = (const sampl_t *)card->scan_map;
+      for (i = first; i < samples; i++)
+         dst[i] = s16[i - first];
+   } else {
+      s32 = (const lsampl_t *)(card->scan_map + offset);
+      for (i = 0; i < first; i++)
+         dst[i] = s32[i];
+      s32 = (const lsampl_t *)card->scan_map;
+      for (i = first; i < samples; i++)
+         dst[i] = s32[i - first];
+   }
+}
+
+/* window compare over a block of whole scans, unsigned wrap around turns
+ * lower < x < upper into a single compare which the compiler vectorizes
+ */
+static void scan_classify_block(ps_io_t *card, uint32_t samples)
+{
+   const lsampl_t *restrict block = card->block;
+   const lsampl_t *restrict lower = card->block_lower;
+   const lsampl_t *restrict width = card->block_width;
+   uint32_t *restrict seen = card->block_seen;
+   uint32_t i;
+
+   for (i = 0; i < samples; i++)
+      seen[i] |= ((lsampl_t)(block[i] - lower[i]) < width[i]);
+}
+
+/* classify all scans acquired since the previous call, state gets one
+ * bit per channel for the most recent scan, seen one bit per channel
+ * that was inside its window in any of the scans, returns the number
+ * of scans consumed
+ */
+static int analog_scan_classify(ps_io_t *card, uint32_t *state, uint32_t *seen)
+{
+   comedi_t *device = card->device;
+   uint32_t scans, done, chunk, samples, last, i;
+   uint32_t tap_first, tap_total, tapped = 0;
+   uint32_t k = card->tap_decimation;
+   uint32_t offset;
+   int contents;
+
+   if (card->scan_running == false) {
+      fprintf(stderr, "scan not running\n");
+      return -1;
+   }
+
+   contents = comedi_get_buffer_contents(device, ANALOG_INPUT);
+   if (contents < 0) {
+      comedi_perror("comedi_get_buffer_contents");
+      return -1;
+   }
+   scans = contents / card->scan_size;
+   if (scans == 0)
+      return 0;
+
+   /* scans of this pass the tap gets */
+   tap_first = (k - card->tap_phase % k) % k;
+   tap_total = (scans > tap_first) ? (scans - 1 - tap_first) / k + 1 : 0;
+
+   memset(card->block_seen, 0, sizeof(card->block_seen));
+   offset = card->scan_read_offset;
+   for (done = 0; done < scans; done += chunk) {
+      chunk = scans - done;
+      if (chunk > SCAN_BLOCK_SCANS)
+         chunk = SCAN_BLOCK_SCANS;
+      samples = chunk * card->scan_n;
+      scan_copy(card, card->block, offset, samples);
+      scan_classify_block(card, samples);
+      if (card->scan_n != card->status_n)
+         burst_capture(card, chunk);
+      if (card->scan_tap != NULL)
+         tapped += scan_tap_block(card, done, chunk, tapped, tap_total);
+      offset = (offset + chunk * card->scan_size) % card->scan_map_size;
+   }
+
+   /* block still holds the last chunk, its last scan is the newest */
+   last = (chunk - 1) * card->scan_n;
+   *state = 0;
+   *seen = 0;
+   for (i = 0; i < card->scan_n; i++) {
+      if ((lsampl_t)(card->block[last + i] - card->block_lower[i]) <
+          card->block_width[i])
+         *state |= 1 << i;
+   }
+   for (i = 0; i < card->block_n; i++) {
+      if (card->block_seen[i])
+         *seen |= 1 << (i % card->scan_n);
+   }
+   memcpy(card->scan_last, &card->block[last],
+          card->status_n * sizeof(lsampl_t));
+   card->scan_last_valid = true;
+
+   if (comedi_mark_buffer_read(device, ANALOG_INPUT,
+                               scans * card->scan_size) < 0) {
+      comedi_perror("comedi_mark_buffer_read");
+      return -1;
+   }
+   card->scan_read_offset = offset;
+   card->tap_phase = (card->tap_phase + scans) % k;
+
+   /* window complete, back to the status scan alone */
+   if ((card->burst_state == burst_done) &&
+       (card->scan_n != card->status_n)) {
+      if (scan_restart(card, card->status_n, card->status_rate) == false)
+         return -1;
+   }
+
+   return scans;
+}
+
+/* hands the block to the tap, status channels of the tapped scans only
+ * while a burst runs, returns the number of scans tapped
+ */
+static uint32_t scan_tap_block(ps_io_t *card, uint32_t done, uint32_t scans,
+                               uint32_t tapped, uint32_t tap_total)
+{
+   uint32_t k = card->tap_decimation;
+   uint32_t status_n = card->status_n;
+   uint32_t m = 0, s, i;
+
+   if (card->scan_n == status_n) {
+      card->scan_tap(card->scan_tap_ctx, card->block,
+                     done, scans, tap_total);
+      return scans;
+   }
+
+   for (s = 0; s < scans; s++) {
+      if ((card->tap_phase + done + s) % k != 0)
+         continue;
+      for (i = 0; i < status_n; i++)
+         card->tap_block[m * status_n + i] =
+            card->block[s * card->scan_n + i];
+      m++;
+   }
+   if (m > 0)
+      card->scan_tap(card->scan_tap_ctx, card->tap_block,
+                     tapped, m, tap_total);
+
+   return m;
+}
+
+/* hand every classified scan to tap as well, range_min, range_max and
+ * maxdata get what it needs to turn the codes into volts
+ */
+static bool analog_scan_tap(ps_io_t *card, scan_tap_t tap, void *ctx, double *range_min,
+                            double *range_max, uint32_t *maxdata, uint32_t n)
+{
+   uint32_t i;
+
+   if ((card->scan_running == false) || (n < card->status_n)) {
+      fprintf(stderr, "scan needs %d ranges\n", card->status_n);
+      return false;
+   }
+
+   for (i = 0; i < card->status_n; i++) {
+      range_min[i] = card->scan_table[i].range->min;
+      range_max[i] = card->scan_table[i].range->max;
+      maxdata[i] = card->scan_table[i].maxdata;
+   }
+   card->scan_tap = tap;
+   card->scan_tap_ctx = ctx;
+
+   return true;
+}
+
+/* cancel the running command and start it again over the first n
+ * channels of the list, the windows are laid out for the new length
+ */
+static bool scan_restart(ps_io_t *card, uint32_t n, double scan_rate)
+{
+   comedi_cancel(card->device, ANALOG_INPUT);
+   if (card->scan_map != NULL)
+      munmap(card->scan_map, card->scan_map_size);
+   card->scan_map = NULL;
+
+   card->scan_n = n;
+   card->block_n = n * SCAN_BLOCK_SCANS;
+   scan_layout_windows(card);
+
+   if (scan_command(card, n, scan_rate) == false) {
+      fprintf(stderr, "scan of %d channels at %g Hz failed to restart\n", n, scan_rate);
+      card->scan_running = false;
+      card->burst_state = burst_idle;
+      return false;
+   }
+   /* the tap keeps seeing scans at the status rate */
+   card->tap_decimation = lround(card->scan_rate / card->status_rate);
+   if (card->tap_decimation == 0)
+      card->tap_decimation = 1;
+   card->tap_phase = 0;
+
+   return true;
+}
+
+/* Burst capture widens the running status scan by the burst channels and
+ * runs it at scan_rate until a window of pre_scans before and post_scans
+ * from the trigger is in the ring, then the status scan goes back to its
+ * own rate. scan_rate gets the rate the card settled on, the aggregate
+ * rate of the card, not the request, is the limit. The trigger is
+ * analog_burst_trigger() or, with edge_channel set, the edge_channel-th
+ * burst channel rising through level. Needs the status scan to be
+ * running, its classification goes on meanwhile.
+ */
+static bool analog_burst_arm(ps_io_t *card, const uint32_t *channels, uint32_t n,
+                             double *scan_rate, uint32_t pre_scans, uint32_t post_scans,
+                             int edge_channel, double level)
+{
+   comedi_t *device = card->device;
+   scan_channel_t *ch;
+   uint32_t status_n = card->status_n;
+   uint32_t i;
+
+   if (card->scan_running == false) {
+      fprintf(stderr, "burst needs the status scan running\n");
+      return false;
+   }
+   if (card->burst_state != burst_idle) {
+      fprintf(stderr, "burst already armed\n");
+      return false;
+   }
+   if ((n == 0) || (n > BURST_CHANNELS_MAX) || (status_n + n > SCAN_CHANNELS_MAX)) {
+      fprintf(stderr, "burst of %d channels out of range\n", n);
+      return false;
+   }
+   if ((post_scans == 0) || (pre_scans + post_scans > BURST_SCANS_MAX) ||
+       (*scan_rate <= 0) || (edge_channel >= (int)n)) {
+      fprintf(stderr, "burst of %d+%d scans at %g Hz not possible\n",
+              pre_scans, post_scans, *scan_rate);
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      if (channels[i] > AI_CHANNEL_15) {
+         fprintf(stderr, "channel[%d] out or range\n", channels[i]);
+         return false;
+      }
+      ch = &card->burst_table[i];
+      ch->range = comedi_get_range(device, ANALOG_INPUT, channels[i],
+                                   ANALOG_INPUT_RANGE_10_10V);
+      ch->maxdata = comedi_get_maxdata(device, ANALOG_INPUT, channels[i]);
+      if (ch->range == NULL) {
+         fprintf(stderr, "no range for channel[%d]\n", channels[i]);
+         return false;
+      }
+      /* never inside, classification ignores them */
+      ch->lower = 0;
+      ch->upper = 0;
+      card->scan_chanlist[status_n + i] = CR_PACK(channels[i],
+                                                  ANALOG_INPUT_RANGE_10_10V,
+                                                  AREF_GROUND);
+      card->scan_table[status_n + i] = *ch;
+   }
+
+   card->burst_n = n;
+   card->burst_capacity = pre_scans + post_scans;
+   card->burst_post = post_scans;
+   card->burst_written = 0;
+   card->burst_edge = edge_channel;
+   card->burst_soft = false;
+   if (edge_channel >= 0) {
+      ch = &card->burst_table[edge_channel];
+      card->burst_level = comedi_from_phys(level, ch->range, ch->maxdata);
+      /* no edge on the very first scan */
+      card->burst_last = ch->maxdata;
+   }
+   card->burst_state = burst_armed;
+
+   if (scan_restart(card, status_n + n, *scan_rate) == false) {
+      scan_restart(card, status_n, card->status_rate);
+      return false;
+   }
+   *scan_rate = card->scan_rate;
+
+   return true;
+}
+
+/* software trigger, e.g. the moment enable is written high */
+static void analog_burst_trigger(ps_io_t *card)
+{
+   if (card->burst_state == burst_armed)
+      card->burst_soft = true;
+}
+
+static int analog_burst_state(ps_io_t *card)
+{
+   return card->burst_state;
+}
+
+/* ring the burst channels of a block of scans in, watch for the trigger */
+static void burst_capture(ps_io_t *card, uint32_t scans)
+{
+   const lsampl_t *scan = card->block + card->status_n;
+   uint32_t n = card->burst_n;
+   lsampl_t *slot;
+   lsampl_t code;
+   uint32_t s, i;
+
+   for (s = 0; s < scans; s++, scan += card->scan_n) {
+      if (card->burst_state == burst_done)
+         return;
+
+      slot = &card->burst_ring[(card->burst_written %
+                                card->burst_capacity) * n];
+      for (i = 0; i < n; i++)
+         slot[i] = scan[i];
+
+      if (card->burst_state == burst_armed) {
+         if (card->burst_edge >= 0) {
+            code = scan[card->burst_edge];
+            if ((card->burst_last < card->burst_level) &&
+                (code >= card->burst_level))
+               card->burst_soft = true;
+            card->burst_last = code;
+         }
+         if (card->burst_soft == true) {
+            card->burst_state = burst_triggered;
+            card->burst_trigger = card->burst_written;
+            card->burst_post_left = card->burst_post;
+         }
+      }
+
+      card->burst_written++;
+      if (card->burst_state == burst_triggered) {
+         card->burst_post_left--;
+         if (card->burst_post_left == 0)
+            card->burst_state = burst_done;
+      }
+   }
+}
+
+/* copy a complete window out in volts, oldest scan first, n values per
+ * scan, trigger gets the index of the trigger scan, returns the number
+ * of scans, 0 before the window is complete, the burst is idle after it
+ */
+static int analog_burst_read(ps_io_t *card, double *values, uint32_t size,
+                             uint32_t *trigger)
+{
+   uint32_t n = card->burst_n;
+   uint32_t scans, first, s, i;
+   lsampl_t *slot;
+
+   if (card->burst_state != burst_done)
+      return 0;
+
+   scans = card->burst_written;
+   if (scans > card->burst_capacity)
+      scans = card->burst_capacity;
+   if (size < scans * n) {
+      fprintf(stderr, "burst needs %d values\n", scans * n);
+      return -1;
+   }
+
+   first = card->burst_written - scans;
+   for (s = 0; s < scans; s++) {
+      slot = &card->burst_ring[((first + s) % card->burst_capacity) * n];
+      for (i = 0; i < n; i++)
+         values[s * n + i] = comedi_to_phys(slot[i], card->burst_table[i].range,
+                                            card->burst_table[i].maxdata);
+   }
+   *trigger = card->burst_trigger - first;
+   card->burst_state = burst_idle;
+
+   return scans;
+}
+
+static void analog_burst_disarm(ps_io_t *card)
+{
+   if ((card->scan_running == true) &&
+       (card->scan_n != card->status_n))
+      scan_restart(card, card->status_n, card->status_rate);
+   card->burst_state = burst_idle;
+}
+
+static void analog_scan_stop(ps_io_t *card)
+{
+   if (card->scan_running == true)
+      comedi_cancel(card->device, ANALOG_INPUT);
+   if (card->scan_map != NULL)
+      munmap(card->scan_map, card->scan_map_size);
+   card->scan_map = NULL;
+   card->scan_running = false;
+   card->scan_tap = NULL;
+   card->burst_state = burst_idle;
+}
+
+static bool analog_channel_output(ps_io_t *card, uint32_t channel, double value,
+                                  double v_max, double v_min)
+{
+   comedi_t *device = card->device;
    comedi_range *range_info;
    lsampl_t data;
    lsampl_t maxdata;
@@ -181,56 +966,326 @@ bool analog_channel_output(uint32_t channel, double value, double v_max, double
           range_info->min, range_info->max);
 #endif
    data = comedi_from_phys(value, range_info, maxdata);
+   /* the converter is already there */
+   if ((card->ao_written & (1 << channel)) && (card->ao_code[channel] == data))
+      return true;
+   TRACE_BEGIN(trace_comedi_write, channel);
    retval = comedi_data_write(device, ANALOG_OUTPUT, channel, ANALOG_OUTPUT_RANGE_0_10V, AREF_GROUND, data);
+   TRACE_END(trace_comedi_write, retval);
    if ( retval == -1) {
       fprintf(stderr, "error setting %gV on output channel[%d]\n", value, channel);
+      card->ao_written &= ~(1 << channel);
       return false;
    }
+   card->ao_written |= 1 << channel;
+   card->ao_code[channel] = data;
 
    return true;
 }
 
-bool digital_channel_output_high(uint32_t channel)
+/* Profile mode of an analog output. The values are turned into raw codes
+ * once and the command that paces them out with the card clock is tested
+ * here, analog_profile_run() only has to start it. Gets the rate the
+ * card settled on back in rate.
+ */
+static bool analog_profile_load(ps_io_t *card, uint32_t channel, const double *values,
+                                uint32_t n, double *rate, double v_max, double v_min)
 {
-   comedi_t *device = das_io_card.device;
-   int retval = 0;
+   comedi_t *device = card->device;
+   comedi_cmd *cmd = &card->profile_cmd;
+   comedi_range *range_info;
+   lsampl_t maxdata, data;
+   uint32_t size, i;
+   char *codes;
+   int retval;
 
-   if (channel > DIO_CHANNEL_23) {
-      fprintf(stderr, "channel[%d] out or range\n", channel);
+   if (card->profile_running == true) {
+      fprintf(stderr, "profile running\n");
       return false;
    }
 
-   retval = comedi_dio_config(device, DIGITAL_IO, channel, COMEDI_OUTPUT);
-   if ( retval == -1) {
-      fprintf(stderr, "error setting output direction on channel[0]\n");
+   if ((channel > AO_CHANNEL_1) || (n == 0) || (*rate <= 0)) {
+      fprintf(stderr, "profile of %d samples at %g Hz on channel[%d] not possible\n",
+              n, *rate, channel);
       return false;
    }
-   retval = comedi_dio_write(device, DIGITAL_IO, channel, BIT_1);
-   if ( retval == -1) {
-      fprintf(stderr, "error setting high output channel[%d]\n", channel);
+
+   if (comedi_get_subdevice_flags(device, ANALOG_OUTPUT) & SDF_LSAMPL)
+      size = sizeof(lsampl_t);
+   else
+      size = sizeof(sampl_t);
+   codes = realloc(card->profile_codes, (size_t)n * size);
+   if (codes == NULL) {
+      fprintf(stderr, "no memory for a profile of %d samples\n", n);
+      return false;
+   }
+   card->profile_codes = codes;
+   card->profile_n = 0;
+
+   range_info = comedi_get_range(device, ANALOG_OUTPUT, channel, ANALOG_OUTPUT_RANGE_0_10V);
+   maxdata = comedi_get_maxdata(device, ANALOG_OUTPUT, channel);
+   for (i = 0; i < n; i++) {
+      if ((values[i] > v_max) || (values[i] < v_min)) {
+         fprintf(stderr, "profile voltage[%g] out or range\n", values[i]);
+         return false;
+      }
+      data = comedi_from_phys(values[i], range_info, maxdata);
+      if (size == sizeof(sampl_t))
+         ((sampl_t *)codes)[i] = data;
+      else
+         ((lsampl_t *)codes)[i] = data;
+   }
+
+   memset(cmd, 0, sizeof(*cmd));
+   retval = comedi_get_cmd_generic_timed(device, ANALOG_OUTPUT, cmd, 1,
+                                         (unsigned int)(1e9 / *rate));
+   if (retval < 0) {
+      comedi_perror("comedi_get_cmd_generic_timed");
+      return false;
+   }
+   card->profile_chanlist[0] = CR_PACK(channel, ANALOG_OUTPUT_RANGE_0_10V,
+                                       AREF_GROUND);
+   cmd->chanlist = card->profile_chanlist;
+   cmd->chanlist_len = 1;
+   cmd->scan_end_arg = 1;
+   /* started by analog_profile_run() once the buffer is preloaded */
+   cmd->start_src = TRIG_INT;
+   cmd->start_arg = 0;
+   cmd->stop_src = TRIG_COUNT;
+   cmd->stop_arg = n;
+   cmd->flags |= CMDF_WRITE;
+
+   /* first test may adjust timing arguments, second must pass */
+   comedi_command_test(device, cmd);
+   retval = comedi_command_test(device, cmd);
+   if (retval != 0) {
+      fprintf(stderr, "profile command test failed[%d]\n", retval);
+      return false;
+   }
+   *rate = 1e9 / cmd->scan_begin_arg;
+
+   /* the whole profile in the buffer needs no refill, the driver may
+    * refuse a buffer that large, then it is topped up while it runs */
+   retval = comedi_get_buffer_size(device, ANALOG_OUTPUT);
+   if ((retval > 0) && ((uint32_t)retval < n * size) &&
+       (comedi_set_buffer_size(device, ANALOG_OUTPUT, n * size) < 0)) {
+#ifdef DEBUG
+      printf("profile buffer stays at %d bytes\n", retval);
+#endif
+   }
+
+   card->profile_n = n;
+   card->profile_sample_size = size;
+
+   return true;
+}
+
+/* hand as many codes to the driver as its buffer takes without blocking */
+static bool profile_fill(ps_io_t *card)
+{
+   comedi_t *device = card->device;
+   uint32_t size = card->profile_sample_size;
+   uint32_t room, left;
+   int buffer, contents;
+   ssize_t retval;
+
+   left = (card->profile_n - card->profile_written) * size;
+   if (left == 0)
+      return true;
+
+   buffer = comedi_get_buffer_size(device, ANALOG_OUTPUT);
+   contents = comedi_get_buffer_contents(device, ANALOG_OUTPUT);
+   if ((buffer < 0) || (contents < 0)) {
+      comedi_perror("profile buffer");
+      return false;
+   }
+   room = ((buffer - contents) / size) * size;
+   if (room > left)
+      room = left;
+   if (room == 0)
+      return true;
+
+   /* analog output is the write subdevice of the card */
+   retval = write(comedi_fileno(device),
+                  card->profile_codes + card->profile_written * size, room);
+   if (retval < 0) {
+      perror("profile write");
+      return false;
+   }
+   card->profile_written += retval / size;
+
+   return true;
+}
+
+/* the output keeps the last sample converted */
+static void analog_profile_stop(ps_io_t *card)
+{
+   if (card->profile_running == true)
+      comedi_cancel(card->device, ANALOG_OUTPUT);
+   card->profile_running = false;
+}
+
+/* preload the buffer and start the loaded profile from the first sample */
+static bool analog_profile_run(ps_io_t *card)
+{
+   comedi_t *device = card->device;
+   comedi_cmd cmd;
+   int retval;
+
+   if (card->profile_n == 0) {
+      fprintf(stderr, "no profile loaded\n");
+      return false;
+   }
+
+   if (card->profile_running == true) {
+      fprintf(stderr, "profile running\n");
+      return false;
+   }
+
+   /* the driver may write to the command */
+   cmd = card->profile_cmd;
+   retval = comedi_command(device, &cmd);
+   if (retval < 0) {
+      comedi_perror("comedi_command");
+      return false;
+   }
+   card->profile_written = 0;
+   card->profile_running = true;
+   /* the profile moves the output, the next write has to go out */
+   card->ao_written &= ~(1 << CR_CHAN(card->profile_chanlist[0]));
+
+   if (profile_fill(card) == false) {
+      analog_profile_stop(card);
       return false;
    }
 
+   retval = comedi_internal_trigger(device, ANALOG_OUTPUT, 0);
+   if (retval < 0) {
+      comedi_perror("comedi_internal_trigger");
+      analog_profile_stop(card);
+      return false;
+   }
+
+   return true;
+}
+
+/* tops the buffer up, returns the samples not yet output, 0 once the
+ * profile is through and the output holds its last value
+ */
+static int analog_profile_poll(ps_io_t *card)
+{
+   comedi_t *device = card->device;
+   uint32_t left;
+   int contents, flags;
+
+   if (card->profile_running == false)
+      return 0;
+
+   if (profile_fill(card) == false) {
+      analog_profile_stop(card);
+      return -1;
+   }
+
+   contents = comedi_get_buffer_contents(device, ANALOG_OUTPUT);
+   flags = comedi_get_subdevice_flags(device, ANALOG_OUTPUT);
+   if ((contents < 0) || (flags < 0)) {
+      comedi_perror("profile state");
+      analog_profile_stop(card);
+      return -1;
+   }
+   left = card->profile_n - card->profile_written +
+          contents / card->profile_sample_size;
+
+   if ((flags & SDF_RUNNING) == 0) {
+      /* ended before the last sample, the buffer ran dry */
+      analog_profile_stop(card);
+      if (left > 0) {
+         fprintf(stderr, "profile underrun, %d samples left\n", left);
+         return -1;
+      }
+      return 0;
+   }
+
+   return left;
+}
+
+/* set direction of lines in mask to output, lines configured once stay
+ * that way so this costs nothing after the first write to a line
+ */
+static bool digital_channels_config(ps_io_t *card, uint32_t mask)
+{
+   comedi_t *device = card->device;
+   uint32_t channel;
+   int retval;
+
+   mask &= ~card->dio_output;
+   for (channel = DIO_CHANNEL_0; mask != 0; channel++, mask >>= 1) {
+      if ((mask & 1) == 0)
+         continue;
+      retval = comedi_dio_config(device, DIGITAL_IO, channel, COMEDI_OUTPUT);
+      if ( retval == -1) {
+         fprintf(stderr, "error setting output direction on channel[%d]\n", channel);
+         return false;
+      }
+      card->dio_output |= 1 << channel;
+   }
+
    return true;
 }
 
-bool digital_channel_output_low(uint32_t channel)
+/* write levels in bits to all lines in mask with a single call,
+ * lines outside of mask keep their level
+ */
+static bool digital_channels_output(ps_io_t *card, uint32_t mask, uint32_t bits)
 {
-   comedi_t *device = das_io_card.device;
+   comedi_t *device = card->device;
+   unsigned int data;
    int retval;
 
+   if (mask & ~DIO_CHANNELS_MASK) {
+      fprintf(stderr, "mask[0x%x] out or range\n", mask);
+      return false;
+   }
+
+   if (digital_channels_config(card, mask) == false)
+      return false;
+
+   data = (card->dio_state & ~mask) | (bits & mask);
+   TRACE_BEGIN(trace_comedi_dio, mask);
+   retval = comedi_dio_bitfield2(device, DIGITAL_IO, mask, &data, 0);
+   TRACE_END(trace_comedi_dio, retval);
+   if ( retval == -1) {
+      fprintf(stderr, "error writing mask[0x%x] bits[0x%x]\n", mask, bits);
+      return false;
+   }
+   card->dio_state = (card->dio_state & ~mask) | (bits & mask);
+
+   return true;
+}
+
+static bool digital_channel_output_high(ps_io_t *card, uint32_t channel)
+{
    if (channel > DIO_CHANNEL_23) {
       fprintf(stderr, "channel[%d] out or range\n", channel);
       return false;
    }
 
-   retval = comedi_dio_config(device, DIGITAL_IO, channel, COMEDI_OUTPUT);
-   if ( retval == -1) {
-      fprintf(stderr, "error setting output direction on channel[0]\n");
+   if (digital_channels_output(card, 1 << channel, 1 << channel) == false) {
+      fprintf(stderr, "error setting high output channel[%d]\n", channel);
       return false;
    }
-   retval = comedi_dio_write(device, DIGITAL_IO, channel, BIT_0);
-   if ( retval == -1) {
+
+   return true;
+}
+
+static bool digital_channel_output_low(ps_io_t *card, uint32_t channel)
+{
+   if (channel > DIO_CHANNEL_23) {
+      fprintf(stderr, "channel[%d] out or range\n", channel);
+      return false;
+   }
+
+   if (digital_channels_output(card, 1 << channel, 0) == false) {
       fprintf(stderr, "error setting low on output channel[%d]\n", channel);
       return false;
    }
@@ -238,46 +1293,49 @@ bool digital_channel_output_low(uint32_t channel)
    return true;
 }
 
-void __attribute__ ((constructor)) init_pcidas1602_16(void)
+static ps_io_t *pcidas_open(const char *filename, const char *options)
 {
-   comedi_t *device;
+   ps_io_t *card;
    bool rc;
 
-   device = comedi_open(filename);
-   if (device == NULL) {
-      comedi_perror(filename);
-      goto err_init;
-   }
-   das_io_card.device = device;
+   if (filename == NULL)
+      filename = DEVICE_DEFAULT;
 
-   rc = digital_channel_output_low(DIO_CHANNEL_0);
-   if (rc == false) {
-      fprintf(stderr, "writing to digital channel[%d] failed\n", DIO_CHANNEL_0);
-      goto err_init;
+   /* the scan and burst buffers make it large */
+   card = calloc(1, sizeof(*card));
+   if (card == NULL) {
+      perror("calloc error");
+      return NULL;
    }
-   rc = digital_channel_output_low(DIO_CHANNEL_2);
-   if (rc == false) {
-      fprintf(stderr, "writing to digital channel[%d] failed\n", DIO_CHANNEL_2);
-      goto err_init;
+
+   card->device = comedi_open(filename);
+   if (card->device == NULL) {
+      comedi_perror(filename);
+      free(card);
+      return NULL;
    }
-   rc = digital_channel_output_low(DIO_CHANNEL_4);
+
+   /* inhibit, interlock and enable low in one go */
+   rc = digital_channels_output(card, (1 << DIO_CHANNEL_0) | (1 << DIO_CHANNEL_2) |
+                                (1 << DIO_CHANNEL_4), 0);
    if (rc == false) {
-      fprintf(stderr, "writing to digital channel[%d] failed\n", DIO_CHANNEL_4);
-      goto err_init;
+      fprintf(stderr, "writing to digital channels[%d,%d,%d] failed\n",
+              DIO_CHANNEL_0, DIO_CHANNEL_2, DIO_CHANNEL_4);
+      comedi_close(card->device);
+      free(card);
+      return NULL;
    }
 
-   io_plugin_initialized = true;
-
-err_init:
-   return;
+   return card;
 }
 
-void __attribute__ ((destructor)) fini_pcidas1602_16(void)
+static void pcidas_close(ps_io_t *card)
 {
-   if (das_io_card.device != NULL) {
-      comedi_close(das_io_card.device);
-   }
-   io_plugin_initialized = false;
+   analog_scan_stop(card);
+   analog_profile_stop(card);
+   free(card->profile_codes);
+   comedi_close(card->device);
+   free(card);
 }
 
 /* prototype board interface in between ale102 power supply
@@ -287,7 +1345,7 @@ void __attribute__ ((destructor)) fini_pcidas1602_16(void)
 /* convert knob number into pcidas1602 analog output channel
  * number
  */
-int convert_knob_to_channel(uint32_t knob)
+static int convert_knob_to_channel(uint32_t knob)
 {
    switch(knob) {
    case voltage_program_knob:
@@ -303,7 +1361,7 @@ int convert_knob_to_channel(uint32_t knob)
 /* convert button number into pcidas1602 digital output channel
  * number
  */
-int convert_button_to_channel(uint32_t button)
+static int convert_button_to_channel(uint32_t button)
 {
    switch(button) {
    case enable_key:
@@ -320,3 +1378,37 @@ int convert_button_to_channel(uint32_t button)
    return 0;
 }
 
+const ps_plugin_t ps_plugin = {
+   .abi = PS_PLUGIN_ABI,
+   .size = sizeof(ps_plugin_t),
+   .name = "pcidas1602_16",
+   .caps = ps_cap_scan | ps_cap_scan_peek | ps_cap_scan_tap | ps_cap_dio_mask |
+           ps_cap_burst | ps_cap_profile | ps_cap_reentrant,
+   .ops = {
+      .open = pcidas_open,
+      .close = pcidas_close,
+      .convert_button_to_channel = convert_button_to_channel,
+      .convert_knob_to_channel = convert_knob_to_channel,
+      .analog_channel_input = analog_channel_input,
+      .analog_channel_output = analog_channel_output,
+      .digital_channel_output_high = digital_channel_output_high,
+      .digital_channel_output_low = digital_channel_output_low,
+      .digital_channels_output = digital_channels_output,
+      .analog_scan_start = analog_scan_start,
+      .analog_scan_read = analog_scan_read,
+      .analog_scan_stop = analog_scan_stop,
+      .analog_scan_window = analog_scan_window,
+      .analog_scan_classify = analog_scan_classify,
+      .analog_scan_peek = analog_scan_peek,
+      .analog_scan_tap = analog_scan_tap,
+      .analog_burst_arm = analog_burst_arm,
+      .analog_burst_trigger = analog_burst_trigger,
+      .analog_burst_state = analog_burst_state,
+      .analog_burst_read = analog_burst_read,
+      .analog_burst_disarm = analog_burst_disarm,
+      .analog_profile_load = analog_profile_load,
+      .analog_profile_run = analog_profile_run,
+      .analog_profile_poll = analog_profile_poll,
+      .analog_profile_stop = analog_profile_stop,
+   },
+};
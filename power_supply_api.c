@@ -0,0 +1,483 @@
+/*
+ * Local control API
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Automation talks to the supply through a Unix domain socket, see
+ * power_supply_api.h for the framing. One thread serves all clients with
+ * poll(). Every request becomes one batch for the control thread, which
+ * applies it and hands back a completion with the write timestamp and
+ * the state right after it. The API thread never touches the plugin.
+ */
+
+/* accept4() */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "io_plugin.h"
+#include "power_supply_rec.h"
+#include "power_supply_profile.h"
+#include "power_supply_reg.h"
+#include "power_supply_metrics.h"
+#include "power_supply_ctl.h"
+#include "power_supply_api.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+static void close_client(ps_api_t *api, ps_api_client_t *client);
+static void queue_reply(ps_api_client_t *client, ps_api_reply_t *reply);
+static void reject_request(ps_api_client_t *client, uint32_t sequence, int32_t result);
+static int parse_request(ps_api_t *api, uint32_t slot);
+static bool parse_requests(ps_api_t *api);
+static void read_client(ps_api_t *api, uint32_t slot);
+static void write_client(ps_api_t *api, ps_api_client_t *client);
+static void accept_client(ps_api_t *api);
+static void run_completions(ps_api_t *api);
+static void *api_thread(void *arg);
+
+static void close_client(ps_api_t *api, ps_api_client_t *client)
+{
+   close(client->fd);
+   client->fd = -1;
+   /* completions still in flight find a newer generation and are dropped */
+   client->generation++;
+   client->in_flight = 0;
+   client->in_len = 0;
+   client->out_len = 0;
+}
+
+static void queue_reply(ps_api_client_t *client, ps_api_reply_t *reply)
+{
+   if (client->out_len + sizeof(*reply) > sizeof(client->out)) {
+      fprintf(stderr, "api reply for sequence[%u] dropped\n", reply->sequence);
+      return;
+   }
+   memcpy(client->out + client->out_len, reply, sizeof(*reply));
+   client->out_len += sizeof(*reply);
+}
+
+static void reject_request(ps_api_client_t *client, uint32_t sequence, int32_t result)
+{
+   ps_api_reply_t reply;
+
+   memset(&reply, 0, sizeof(reply));
+   reply.magic = PS_API_MAGIC;
+   reply.sequence = sequence;
+   reply.result = result;
+   queue_reply(client, &reply);
+}
+
+/* size of the consumed frame, 0 when incomplete or held back, -1 when
+ * the stream can not be trusted any more */
+static int parse_request(ps_api_t *api, uint32_t slot)
+{
+   ps_api_client_t *client = &api->clients[slot];
+   ps_api_request_t request;
+   ps_api_op_t op;
+   ps_batch_t batch;
+   size_t size;
+   uint32_t i = 0;
+   bool rc;
+
+   if (client->in_len < sizeof(request))
+      return 0;
+   memcpy(&request, client->in, sizeof(request));
+
+   if ((request.magic != PS_API_MAGIC) || (request.version != PS_API_VERSION)) {
+      reject_request(client, request.sequence, ps_api_bad_frame);
+      return -1;
+   }
+   if (request.count > PS_BATCH_MAX) {
+      reject_request(client, request.sequence, ps_api_bad_count);
+      return -1;
+   }
+
+   size = sizeof(request) + request.count * sizeof(ps_api_op_t);
+   if (client->in_len < size)
+      return 0;
+
+   /* no reply room or no free batch slot, wait for completions */
+   if ((api->in_flight == PS_BATCHES_N) ||
+       (client->out_len + (client->in_flight + 1) * sizeof(ps_api_reply_t) >
+        sizeof(client->out)))
+      return 0;
+
+   memset(&batch, 0, sizeof(batch));
+   batch.client = (client->generation << 8) | slot;
+   batch.sequence = request.sequence;
+   batch.n = request.count;
+   for (i = 0; i < request.count; i++) {
+      memcpy(&op, client->in + sizeof(request) + i * sizeof(op), sizeof(op));
+      batch.commands[i].index = op.index;
+      switch (op.op) {
+      case ps_api_set_voltage:
+         if ((op.index >= api->knobs_n) || !(op.value >= 0) ||
+             (op.value > api->voltage_full_output)) {
+            reject_request(client, request.sequence, ps_api_bad_op);
+            return size;
+         }
+         batch.commands[i].type = ps_cmd_knob;
+         batch.commands[i].value = api->v_program_max * op.value / api->voltage_full_output;
+         break;
+      case ps_api_set_control:
+         if (op.index > 31) {
+            reject_request(client, request.sequence, ps_api_bad_op);
+            return size;
+         }
+         batch.commands[i].type = ps_cmd_control;
+         batch.commands[i].value = (op.value != 0) ? 1 : 0;
+         break;
+      case ps_api_get_state:
+         batch.commands[i].type = ps_cmd_status;
+         break;
+      case ps_api_run_profile:
+         batch.commands[i].type = ps_cmd_profile;
+         batch.commands[i].value = (op.value != 0) ? 1 : 0;
+         break;
+      default:
+         reject_request(client, request.sequence, ps_api_bad_op);
+         return size;
+      }
+   }
+
+   rc = ctl_batch(api->ctl, &batch);
+   if (rc == false) {
+      reject_request(client, request.sequence, ps_api_busy);
+      return size;
+   }
+   client->in_flight++;
+   api->in_flight++;
+
+   return size;
+}
+
+/* true when any frame was consumed */
+static bool parse_requests(ps_api_t *api)
+{
+   ps_api_client_t *client;
+   bool consumed = false;
+   uint32_t slot = 0;
+   int size;
+
+   for (slot = 0; slot < PS_API_CLIENTS_MAX; slot++) {
+      client = &api->clients[slot];
+      while (client->fd != -1) {
+         size = parse_request(api, slot);
+         if (size == -1) {
+            /* try to get the reason out before hanging up */
+            write_client(api, client);
+            if (client->fd != -1)
+               close_client(api, client);
+            consumed = true;
+            break;
+         }
+         if (size == 0)
+            break;
+         client->in_len -= size;
+         memmove(client->in, client->in + size, client->in_len);
+         consumed = true;
+      }
+   }
+
+   return consumed;
+}
+
+static void read_client(ps_api_t *api, uint32_t slot)
+{
+   ps_api_client_t *client = &api->clients[slot];
+   ssize_t len;
+
+   len = read(client->fd, client->in + client->in_len,
+              sizeof(client->in) - client->in_len);
+   if (len == 0) {
+      close_client(api, client);
+      return;
+   }
+   if (len == -1) {
+      if ((errno != EAGAIN) && (errno != EINTR))
+         close_client(api, client);
+      return;
+   }
+   client->in_len += len;
+}
+
+static void write_client(ps_api_t *api, ps_api_client_t *client)
+{
+   ssize_t len;
+
+   if (client->out_len == 0)
+      return;
+
+   len = send(client->fd, client->out, client->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+   if (len == -1) {
+      if ((errno != EAGAIN) && (errno != EINTR))
+         close_client(api, client);
+      return;
+   }
+   client->out_len -= len;
+   memmove(client->out, client->out + len, client->out_len);
+}
+
+static void accept_client(ps_api_t *api)
+{
+   ps_api_client_t *client;
+   uint32_t slot = 0;
+   int fd;
+
+   fd = accept4(api->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+   if (fd == -1) {
+      if ((errno != EAGAIN) && (errno != EINTR))
+         perror("accept4");
+      return;
+   }
+
+   for (slot = 0; slot < PS_API_CLIENTS_MAX; slot++) {
+      client = &api->clients[slot];
+      if (client->fd == -1) {
+         client->fd = fd;
+         client->in_len = 0;
+         client->out_len = 0;
+         return;
+      }
+   }
+
+   fprintf(stderr, "api client refused, %d clients connected\n", PS_API_CLIENTS_MAX);
+   close(fd);
+}
+
+static void run_completions(ps_api_t *api)
+{
+   ps_api_client_t *client;
+   ps_completion_t done;
+   ps_api_reply_t reply;
+   uint64_t count;
+   uint32_t i = 0;
+
+   if (read(api->ctl->done_fd, &count, sizeof(count)) == -1) {
+      if (errno != EAGAIN)
+         perror("read completion eventfd");
+   }
+
+   while (ctl_completion(api->ctl, &done) == true) {
+      api->in_flight--;
+      client = &api->clients[done.client & 0xff];
+      if ((client->generation & 0xffffff) != (done.client >> 8)) {
+         /* reply to a client that hung up */
+         continue;
+      }
+      client->in_flight--;
+
+      memset(&reply, 0, sizeof(reply));
+      reply.magic = PS_API_MAGIC;
+      reply.sequence = done.sequence;
+      reply.result = done.errors;
+      reply.leds = done.status.leds;
+      reply.write_ns = done.write_ns;
+      reply.controls = done.status.controls;
+      reply.knobs_n = api->knobs_n;
+      for (i = 0; (i < api->knobs_n) && (i < PS_KNOBS_MAX); i++)
+         reply.knobs[i] = done.status.knobs[i] * api->voltage_full_output / api->v_program_max;
+      queue_reply(client, &reply);
+   }
+}
+
+static void *api_thread(void *arg)
+{
+   ps_api_t *api = arg;
+   struct pollfd fds[PS_API_CLIENTS_MAX + 3];
+   ps_api_client_t *client;
+   uint32_t slot = 0;
+   int n;
+
+   for (;;) {
+      fds[0].fd = api->stop_fd;
+      fds[0].events = POLLIN;
+      fds[1].fd = api->ctl->done_fd;
+      fds[1].events = POLLIN;
+      fds[2].fd = api->listen_fd;
+      fds[2].events = POLLIN;
+      for (slot = 0; slot < PS_API_CLIENTS_MAX; slot++) {
+         client = &api->clients[slot];
+         fds[slot + 3].fd = client->fd;
+         fds[slot + 3].events = 0;
+         fds[slot + 3].revents = 0;
+         if (client->fd == -1)
+            continue;
+         if (client->in_len < sizeof(client->in))
+            fds[slot + 3].events |= POLLIN;
+         if (client->out_len > 0)
+            fds[slot + 3].events |= POLLOUT;
+      }
+
+      n = poll(fds, PS_API_CLIENTS_MAX + 3, -1);
+      if (n == -1) {
+         if (errno == EINTR)
+            continue;
+         perror("poll");
+         break;
+      }
+
+      if (fds[0].revents & POLLIN)
+         break;
+      if (fds[1].revents & POLLIN)
+         run_completions(api);
+      if (fds[2].revents & POLLIN)
+         accept_client(api);
+
+      for (slot = 0; slot < PS_API_CLIENTS_MAX; slot++) {
+         client = &api->clients[slot];
+         if ((client->fd == -1) || (client->fd != fds[slot + 3].fd))
+            continue;
+         /* a full buffer waits for parsing, a hang up shows on the next read */
+         if ((fds[slot + 3].revents & (POLLIN | POLLHUP | POLLERR)) &&
+             (client->in_len < sizeof(client->in)))
+            read_client(api, slot);
+      }
+
+      /* replies sent free room for requests held back, so parse again
+       * until nothing moves, nothing else would wake us up for them */
+      do {
+         for (slot = 0; slot < PS_API_CLIENTS_MAX; slot++) {
+            client = &api->clients[slot];
+            if (client->fd != -1)
+               write_client(api, client);
+         }
+      } while (parse_requests(api) == true);
+   }
+
+   return NULL;
+}
+
+/* the socket is optional, without [api] socket the API stays off */
+bool api_init(ps_api_t *api, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+   uint32_t slot = 0;
+
+   memset(api, 0, sizeof(*api));
+   api->listen_fd = -1;
+   api->stop_fd = -1;
+   for (slot = 0; slot < PS_API_CLIENTS_MAX; slot++)
+      api->clients[slot].fd = -1;
+
+   str = al_get_config_value(cfg, "api", "socket");
+   if (str == NULL)
+      return true;
+   if (strlen(str) >= sizeof(api->socket_path)) {
+      fprintf(stderr, "requested value (key[socket] in section[api]) too long!\n");
+      return false;
+   }
+   strcpy(api->socket_path, str);
+
+   return true;
+}
+
+bool api_start(ps_api_t *api, ps_control_t *ctl, uint32_t knobs_n,
+               double voltage_full_output, double v_program_max)
+{
+   struct sockaddr_un addr;
+   int retval;
+
+   if (api->socket_path[0] == '\0')
+      return true;
+
+   if ((voltage_full_output <= 0) || (v_program_max <= 0)) {
+      fprintf(stderr, "api needs positive voltage_full_output and v_program_max!\n");
+      return false;
+   }
+
+   api->ctl = ctl;
+   api->knobs_n = (knobs_n < PS_KNOBS_MAX) ? knobs_n : PS_KNOBS_MAX;
+   api->voltage_full_output = voltage_full_output;
+   api->v_program_max = v_program_max;
+
+   api->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (api->listen_fd == -1) {
+      perror("socket");
+      return false;
+   }
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, api->socket_path);
+   /* left behind by an earlier run */
+   unlink(api->socket_path);
+   if (bind(api->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+      fprintf(stderr, "failed to bind api socket[%s]: %s\n", api->socket_path,
+              strerror(errno));
+      return false;
+   }
+   if (listen(api->listen_fd, PS_API_CLIENTS_MAX) == -1) {
+      perror("listen");
+      return false;
+   }
+
+   api->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (api->stop_fd == -1) {
+      perror("eventfd");
+      return false;
+   }
+
+   retval = pthread_create(&api->thread, NULL, api_thread, api);
+   if (retval != 0) {
+      fprintf(stderr, "failed to create api thread: %s\n", strerror(retval));
+      return false;
+   }
+   api->thread_running = true;
+
+   return true;
+}
+
+/* before ctl_stop(), the control thread completes what was handed over */
+void api_stop(ps_api_t *api)
+{
+   uint64_t one = 1;
+   uint32_t slot = 0;
+
+   if (api->thread_running == true) {
+      if (write(api->stop_fd, &one, sizeof(one)) == -1)
+         perror("write api stop eventfd");
+      pthread_join(api->thread, NULL);
+      api->thread_running = false;
+   }
+
+   for (slot = 0; slot < PS_API_CLIENTS_MAX; slot++) {
+      if (api->clients[slot].fd != -1)
+         close(api->clients[slot].fd);
+      api->clients[slot].fd = -1;
+   }
+   if (api->stop_fd != -1)
+      close(api->stop_fd);
+   api->stop_fd = -1;
+   if (api->listen_fd != -1) {
+      close(api->listen_fd);
+      unlink(api->socket_path);
+   }
+   api->listen_fd = -1;
+}
@@ -0,0 +1,129 @@
+/*
+ * Header file for the local control API
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_API_H
+#define __POWER_SUPPLY_API_H
+
+#include <stdint.h>
+
+/* Wire format, native byte order, the socket is local.
+ *
+ * A request is a ps_api_request_t followed by count ps_api_op_t, all
+ * operations of a request are applied as one batch. Requests may be
+ * pipelined, every request gets exactly one ps_api_reply_t carrying its
+ * sequence. Replies to accepted requests come in request order, a
+ * rejected request is answered at once and may overtake them.
+ */
+
+#define PS_API_MAGIC 0x31454c41 /* "ALE1" */
+#define PS_API_VERSION 1
+
+/* operations */
+enum {
+   /* voltage_setting of knob index in volts at the supply output */
+   ps_api_set_voltage = 1,
+   /* control index on when value is non zero, off otherwise */
+   ps_api_set_control,
+   /* no write, the reply state is all that is wanted */
+   ps_api_get_state,
+   /* output profile from its start when value is non zero, stop otherwise */
+   ps_api_run_profile,
+};
+
+/* reply results besides zero and the number of failed operations */
+enum {
+   ps_api_bad_frame = -1,
+   ps_api_bad_count = -2,
+   ps_api_bad_op = -3,
+   ps_api_busy = -4,
+};
+
+typedef struct ps_api_request {
+   uint32_t magic;
+   uint16_t version;
+   uint16_t count;
+   uint32_t sequence;
+   uint32_t reserved;
+} ps_api_request_t;
+
+typedef struct ps_api_op {
+   uint16_t op;
+   uint16_t index;
+   uint32_t reserved;
+   double value;
+} ps_api_op_t;
+
+typedef struct ps_api_reply {
+   uint32_t magic;
+   uint32_t sequence;
+   int32_t result;
+   /* bit per led, set when lit */
+   uint32_t leds;
+   /* CLOCK_MONOTONIC [ns] once the plugin returned from the last write */
+   uint64_t write_ns;
+   /* bit per control, set when on */
+   uint32_t controls;
+   uint32_t knobs_n;
+   /* voltage_setting in volts */
+   double knobs[PS_KNOBS_MAX];
+} ps_api_reply_t;
+
+/* types */
+
+#define PS_API_CLIENTS_MAX 8
+/* a few pipelined requests of the largest size */
+#define PS_API_IN_SIZE 4096
+/* room for a reply to every batch that can be in flight */
+#define PS_API_OUT_SIZE (PS_BATCHES_N * sizeof(ps_api_reply_t))
+
+typedef struct ps_api_client {
+   int fd;
+   /* tells a reconnect on the same slot apart from the old client */
+   uint32_t generation;
+   uint32_t in_flight;
+   size_t in_len;
+   size_t out_len;
+   char in[PS_API_IN_SIZE];
+   char out[PS_API_OUT_SIZE];
+} ps_api_client_t;
+
+typedef struct ps_api {
+   ps_control_t *ctl;
+   /* empty when the API is not configured */
+   char socket_path[108];
+   uint32_t knobs_n;
+   double voltage_full_output;
+   double v_program_max;
+   int listen_fd;
+   int stop_fd;
+   pthread_t thread;
+   bool thread_running;
+   /* batches handed to the control thread and not completed yet */
+   uint32_t in_flight;
+   ps_api_client_t clients[PS_API_CLIENTS_MAX];
+} ps_api_t;
+
+/* functions */
+
+bool api_init(ps_api_t *api, ALLEGRO_CONFIG *cfg);
+bool api_start(ps_api_t *api, ps_control_t *ctl, uint32_t knobs_n,
+               double voltage_full_output, double v_program_max);
+void api_stop(ps_api_t *api);
+
+#endif /* __POWER_SUPPLY_API_H */
@@ -0,0 +1,156 @@
+/*
+ * Burst capture consumer
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Runs on the thread that takes the captures from the control thread,
+ * ps_prog's UI or ps_daemon's main loop, so file IO never holds up the
+ * card. Every window is measured and, with [burst] export set, written
+ * to <export>/burst-<shot>.csv with the time relative to the trigger.
+ *
+ * The charge time is measured on the first burst channel, from the
+ * trigger until it comes within 1% of its peak after the trigger. Its
+ * mean and standard deviation over the shots tell the repeatability.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "io_plugin.h"
+#include "power_supply_rec.h"
+#include "power_supply_profile.h"
+#include "power_supply_reg.h"
+#include "power_supply_metrics.h"
+#include "power_supply_ctl.h"
+#include "power_supply_burst.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define CHARGE_RATIO 0.99
+
+static void measure_charge(ps_burst_t *burst, ps_capture_t *capture);
+static bool export_capture(ps_burst_t *burst, ps_capture_t *capture);
+
+bool burst_init(ps_burst_t *burst, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+
+   memset(burst, 0, sizeof(*burst));
+
+   str = al_get_config_value(cfg, "burst", "export");
+   if (str == NULL)
+      return true;
+   if (strlen(str) >= sizeof(burst->export_dir)) {
+      fprintf(stderr, "requested value (key[export] in section[burst]) too long!\n");
+      return false;
+   }
+   strcpy(burst->export_dir, str);
+
+   return true;
+}
+
+static void measure_charge(ps_burst_t *burst, ps_capture_t *capture)
+{
+   uint32_t n = capture->n;
+   double *values = capture->values;
+   double start, peak, level;
+   uint32_t i;
+
+   start = values[capture->trigger * n];
+   peak = start;
+   for (i = capture->trigger; i < capture->scans; i++) {
+      if (values[i * n] > peak)
+         peak = values[i * n];
+   }
+
+   level = start + CHARGE_RATIO * (peak - start);
+   for (i = capture->trigger; i < capture->scans; i++) {
+      if (values[i * n] >= level)
+         break;
+   }
+
+   burst->charge_time = (i - capture->trigger) / capture->scan_rate;
+   burst->peak = peak;
+}
+
+static bool export_capture(ps_burst_t *burst, ps_capture_t *capture)
+{
+   char path[sizeof(burst->export_dir) + 32];
+   uint32_t s, i;
+   FILE *file;
+
+   snprintf(path, sizeof(path), "%s/burst-%u.csv", burst->export_dir, capture->shot);
+   file = fopen(path, "w");
+   if (file == NULL) {
+      perror(path);
+      return false;
+   }
+
+   fprintf(file, "# shot %u, %g scans/s, trigger at scan %u\n",
+           capture->shot, capture->scan_rate, capture->trigger);
+   fprintf(file, "time");
+   for (i = 0; i < capture->n; i++)
+      fprintf(file, ",ai%u", capture->channels[i]);
+   fprintf(file, "\n");
+
+   for (s = 0; s < capture->scans; s++) {
+      fprintf(file, "%.7f", ((double)s - capture->trigger) / capture->scan_rate);
+      for (i = 0; i < capture->n; i++)
+         fprintf(file, ",%.5f", capture->values[s * capture->n + i]);
+      fprintf(file, "\n");
+   }
+
+   if (fclose(file) != 0) {
+      perror(path);
+      return false;
+   }
+
+   return true;
+}
+
+/* measures, logs and exports a capture, summary gets a line for the UI */
+bool burst_process(ps_burst_t *burst, ps_capture_t *capture)
+{
+   double delta, sd = 0;
+   bool rc = true;
+
+   measure_charge(burst, capture);
+
+   /* Welford, stable over any number of shots */
+   burst->shots++;
+   delta = burst->charge_time - burst->mean;
+   burst->mean += delta / burst->shots;
+   burst->m2 += delta * (burst->charge_time - burst->mean);
+   if (burst->shots > 1)
+      sd = sqrt(burst->m2 / (burst->shots - 1));
+
+   snprintf(burst->summary, sizeof(burst->summary),
+            "Shot %u: charge %.3f ms to %.3f V, mean %.3f ms, sd %.3f ms",
+            capture->shot, burst->charge_time * 1e3, burst->peak,
+            burst->mean * 1e3, sd * 1e3);
+
+   if (burst->export_dir[0] != '\0')
+      rc = export_capture(burst, capture);
+
+   return rc;
+}
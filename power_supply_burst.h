@@ -0,0 +1,42 @@
+/*
+ * Header file for the burst capture consumer
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_BURST_H
+#define __POWER_SUPPLY_BURST_H
+
+/* types */
+
+typedef struct ps_burst {
+   /* directory the captures are written to, empty for none */
+   char export_dir[256];
+   /* charge time of the last shot and its running statistics */
+   uint32_t shots;
+   double charge_time;
+   double peak;
+   double mean;
+   double m2;
+   char summary[256];
+} ps_burst_t;
+
+/* functions */
+
+bool burst_init(ps_burst_t *burst, ALLEGRO_CONFIG *cfg);
+bool burst_process(ps_burst_t *burst, ps_capture_t *capture);
+
+#endif /* __POWER_SUPPLY_BURST_H */
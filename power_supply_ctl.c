@@ -0,0 +1,1651 @@
+/*
+ * Acquisition/control thread
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The control thread owns the IO plugin. It polls the status leds at its
+ * own rate and carries out commands queued by the UI, so neither a slow
+ * frame nor a slow card holds up the other side. The UI pushes commands
+ * into a single producer single consumer ring and reads back a snapshot
+ * of the supply state guarded by a sequence counter, nothing blocks.
+ */
+
+/* sem_clockwait(), dlmopen(), pthread_attr_setaffinity_np() */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "io_plugin.h"
+#include "power_supply_rec.h"
+#include "power_supply_profile.h"
+#include "power_supply_reg.h"
+#include "power_supply_metrics.h"
+#include "power_supply_ctl.h"
+#include "power_supply_trace.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define VOLTAGE_UPPER_THRESHOLD 0.7f
+#define VOLTAGE_LOWER_THRESHOLD 0.2f
+
+#define INPUT_CHANNEL_SHIFT 8
+#define STATUS_CHANNELS_MAX 16
+
+#define POLL_RATE_DEFAULT 250
+
+/* 100 kS/s aggregate over 6 status and 2 burst channels, 0.1 s + 0.9 s */
+#define BURST_RATE_DEFAULT 12500
+#define BURST_PRE_DEFAULT 1250
+#define BURST_POST_DEFAULT 11250
+
+/* checked every 500 us, inhibit within 1 ms of the fault sample */
+#define FAULT_RATE_DEFAULT 4000
+#define FAULT_BUDGET_US_DEFAULT 1000
+
+#define OPEN_RETRY_MS_DEFAULT 100
+
+/* copies of plugins without ps_cap_reentrant in use, see load_io_plugin() */
+static pthread_mutex_t plugins_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *plugins_used[PS_SUPPLIES_MAX];
+
+static uint32_t negotiate_caps(ps_plugin_ops_t *ops, uint32_t caps);
+static bool load_io_plugin(ps_control_t *ctl);
+static bool open_io_plugin(ps_control_t *ctl);
+static void unload_io_plugin(ps_control_t *ctl);
+static bool io_input(ps_control_t *ctl, uint32_t channel, double *value);
+static bool io_output(ps_control_t *ctl, uint32_t channel, double value);
+static bool io_digital(ps_control_t *ctl, uint32_t channel, bool high);
+static bool io_digital_mask(ps_control_t *ctl, uint32_t mask, uint32_t bits);
+static bool read_ctl_config(ALLEGRO_CONFIG *cfg, char *section,
+                            char *key, double *value);
+static bool read_burst_config(ps_control_t *ctl, ALLEGRO_CONFIG *cfg);
+static bool read_fault_config(ps_control_t *ctl, ALLEGRO_CONFIG *cfg);
+static bool init_status_scan(ps_control_t *ctl);
+static void poll_leds_scan(ps_control_t *ctl);
+static void poll_leds(ps_control_t *ctl);
+static void burst_arm(ps_control_t *ctl);
+static void poll_burst(ps_control_t *ctl);
+static bool profile_load(ps_control_t *ctl);
+static bool profile_run(ps_control_t *ctl);
+static void profile_stop(ps_control_t *ctl);
+static void poll_profile(ps_control_t *ctl);
+static void enable_written(ps_control_t *ctl, uint32_t mask, uint32_t bits);
+static uint64_t now_ns(void);
+static void regulate(ps_control_t *ctl, struct timespec *deadline);
+static void reg_window(ps_control_t *ctl);
+static void check_faults(ps_control_t *ctl, struct timespec *deadline);
+static void apply_command(ps_control_t *ctl, ps_command_t *cmd);
+static void apply_batch(ps_control_t *ctl, ps_batch_t *batch, ps_completion_t *done);
+static bool run_batches(ps_control_t *ctl);
+static void publish_status(ps_control_t *ctl);
+static void *ctl_thread(void *arg);
+
+/* capabilities the plugin claims and has every entry for, the entries
+ * of the others are cleared so only what was agreed on gets called */
+static uint32_t negotiate_caps(ps_plugin_ops_t *ops, uint32_t caps)
+{
+   if ((ops->digital_channels_output == NULL) || !(caps & ps_cap_dio_mask)) {
+      caps &= ~ps_cap_dio_mask;
+      ops->digital_channels_output = NULL;
+   }
+
+   if ((ops->analog_scan_start == NULL) || (ops->analog_scan_read == NULL) ||
+       (ops->analog_scan_stop == NULL) || (ops->analog_scan_window == NULL) ||
+       (ops->analog_scan_classify == NULL))
+      caps &= ~ps_cap_scan;
+   /* peeks, taps and bursts all ride on the status scan */
+   if (!(caps & ps_cap_scan)) {
+      caps &= ~(ps_cap_scan_peek | ps_cap_scan_tap | ps_cap_burst);
+      ops->analog_scan_start = NULL;
+      ops->analog_scan_read = NULL;
+      ops->analog_scan_stop = NULL;
+      ops->analog_scan_window = NULL;
+      ops->analog_scan_classify = NULL;
+   }
+
+   if ((ops->analog_scan_peek == NULL) || !(caps & ps_cap_scan_peek)) {
+      caps &= ~ps_cap_scan_peek;
+      ops->analog_scan_peek = NULL;
+   }
+
+   if ((ops->analog_scan_tap == NULL) || !(caps & ps_cap_scan_tap)) {
+      caps &= ~ps_cap_scan_tap;
+      ops->analog_scan_tap = NULL;
+   }
+
+   if ((ops->analog_burst_arm == NULL) || (ops->analog_burst_trigger == NULL) ||
+       (ops->analog_burst_state == NULL) || (ops->analog_burst_read == NULL) ||
+       (ops->analog_burst_disarm == NULL) || !(caps & ps_cap_burst)) {
+      caps &= ~ps_cap_burst;
+      ops->analog_burst_arm = NULL;
+      ops->analog_burst_trigger = NULL;
+      ops->analog_burst_state = NULL;
+      ops->analog_burst_read = NULL;
+      ops->analog_burst_disarm = NULL;
+   }
+
+   if ((ops->analog_profile_load == NULL) || (ops->analog_profile_run == NULL) ||
+       (ops->analog_profile_poll == NULL) || (ops->analog_profile_stop == NULL) ||
+       !(caps & ps_cap_profile)) {
+      caps &= ~ps_cap_profile;
+      ops->analog_profile_load = NULL;
+      ops->analog_profile_run = NULL;
+      ops->analog_profile_poll = NULL;
+      ops->analog_profile_stop = NULL;
+   }
+
+   return caps;
+}
+
+/* A plugin with ps_cap_reentrant is loaded once and opened for every
+ * supply. Any other keeps state at file level, every further supply
+ * using it gets a copy in its own link map.
+ */
+static bool load_io_plugin(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   const ps_plugin_t *plugin;
+   size_t size;
+   uint32_t i;
+   char *error;
+
+   pthread_mutex_lock(&plugins_lock);
+   handler->handle = dlopen(ctl->plugin_file, RTLD_NOW);
+   if (!handler->handle) {
+      pthread_mutex_unlock(&plugins_lock);
+      fprintf(stderr, "problem loading io handler plugin: %s\n", dlerror());
+      return false;
+   }
+
+   plugin = dlsym(handler->handle, PS_PLUGIN_SYMBOL);
+   if ((error = dlerror()) != NULL) {
+      pthread_mutex_unlock(&plugins_lock);
+      fprintf(stderr, "dlsym problem: %s\n", error);
+      dlclose(handler->handle);
+      handler->handle = NULL;
+      return false;
+   }
+
+   if (!(plugin->caps & ps_cap_reentrant)) {
+      for (i = 0; i < PS_SUPPLIES_MAX; i++) {
+         if (plugins_used[i] == handler->handle)
+            break;
+      }
+      if (i < PS_SUPPLIES_MAX) {
+         dlclose(handler->handle);
+         handler->handle = dlmopen(LM_ID_NEWLM, ctl->plugin_file, RTLD_NOW);
+         if (handler->handle != NULL)
+            plugin = dlsym(handler->handle, PS_PLUGIN_SYMBOL);
+         if ((handler->handle == NULL) || (plugin == NULL)) {
+            pthread_mutex_unlock(&plugins_lock);
+            fprintf(stderr, "problem loading another copy of io handler plugin: %s\n",
+                    dlerror());
+            if (handler->handle != NULL)
+               dlclose(handler->handle);
+            handler->handle = NULL;
+            return false;
+         }
+      }
+      for (i = 0; i < PS_SUPPLIES_MAX; i++) {
+         if (plugins_used[i] == NULL) {
+            plugins_used[i] = handler->handle;
+            break;
+         }
+      }
+   }
+   pthread_mutex_unlock(&plugins_lock);
+   handler->plugin = plugin;
+
+   if (plugin->abi != PS_PLUGIN_ABI) {
+      fprintf(stderr, "io handler plugin[%s] has abi %u, need %u!\n", plugin->name,
+              plugin->abi, PS_PLUGIN_ABI);
+      unload_io_plugin(ctl);
+      return false;
+   }
+
+   /* entries past what an older plugin knows of stay NULL */
+   size = sizeof(ps_plugin_t);
+   if (plugin->size < size)
+      size = plugin->size;
+   if (size < offsetof(ps_plugin_t, ops) + offsetof(ps_plugin_ops_t, digital_channels_output)) {
+      fprintf(stderr, "io handler plugin[%s] too small!\n", plugin->name);
+      unload_io_plugin(ctl);
+      return false;
+   }
+   memset(&handler->ops, 0, sizeof(handler->ops));
+   memcpy(&handler->ops, &plugin->ops, size - offsetof(ps_plugin_t, ops));
+
+   if ((handler->ops.open == NULL) || (handler->ops.close == NULL) ||
+       (handler->ops.convert_button_to_channel == NULL) ||
+       (handler->ops.convert_knob_to_channel == NULL) ||
+       (handler->ops.analog_channel_input == NULL) ||
+       (handler->ops.analog_channel_output == NULL) ||
+       (handler->ops.digital_channel_output_high == NULL) ||
+       (handler->ops.digital_channel_output_low == NULL)) {
+      fprintf(stderr, "io handler plugin[%s] lacks basic io!\n", plugin->name);
+      unload_io_plugin(ctl);
+      return false;
+   }
+   handler->caps = negotiate_caps(&handler->ops, plugin->caps);
+
+   if (open_io_plugin(ctl) == false) {
+      unload_io_plugin(ctl);
+      return false;
+   }
+
+   return true;
+}
+
+/* a card still held by the previous owner may come free after a while */
+static bool open_io_plugin(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   const char *device = (ctl->device[0] != '\0') ? ctl->device : NULL;
+   const char *options = (ctl->options[0] != '\0') ? ctl->options : NULL;
+   struct timespec pause;
+   uint64_t start;
+   uint32_t attempt;
+
+   pause.tv_sec = ctl->open_retry_ms / 1000;
+   pause.tv_nsec = fmod(ctl->open_retry_ms, 1000) * 1000000;
+
+   start = now_ns();
+   for (attempt = 0; ; attempt++) {
+      handler->io = handler->ops.open(device, options);
+      if ((handler->io != NULL) || (attempt == ctl->open_retries))
+         break;
+      fprintf(stderr, "failed to open io plugin[%s], retry %u of %u\n",
+              handler->plugin->name, attempt + 1, ctl->open_retries);
+      nanosleep(&pause, NULL);
+   }
+   handler->open_ms = (now_ns() - start) / 1e6;
+
+   if (handler->io == NULL) {
+      fprintf(stderr, "failed to initialize io plugin!\n");
+      return false;
+   }
+
+   return true;
+}
+
+static void unload_io_plugin(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   uint32_t i;
+
+   if (handler->io != NULL)
+      handler->ops.close(handler->io);
+   handler->io = NULL;
+
+   if (handler->handle == NULL)
+      return;
+
+   pthread_mutex_lock(&plugins_lock);
+   for (i = 0; i < PS_SUPPLIES_MAX; i++) {
+      if (plugins_used[i] == handler->handle)
+         plugins_used[i] = NULL;
+   }
+   pthread_mutex_unlock(&plugins_lock);
+   dlclose(handler->handle);
+   handler->handle = NULL;
+}
+
+/* plugin calls of the control thread, timed into the metrics and traced */
+static bool io_input(ps_control_t *ctl, uint32_t channel, double *value)
+{
+   ps_handler_t *handler = &ctl->handler;
+   uint64_t start;
+   bool rc;
+
+   TRACE_BEGIN(trace_analog_input, channel);
+   start = metrics_now(&ctl->metrics);
+   rc = handler->ops.analog_channel_input(handler->io, channel, value);
+   TRACE_END(trace_analog_input, rc);
+   metrics_since(&ctl->metrics, metrics_analog_input, start);
+   if (rc == false)
+      metrics_count(&ctl->metrics, metrics_io_errors, 1);
+
+   return rc;
+}
+
+static bool io_output(ps_control_t *ctl, uint32_t channel, double value)
+{
+   ps_handler_t *handler = &ctl->handler;
+   uint64_t start;
+   bool rc;
+
+   TRACE_BEGIN(trace_analog_output, channel);
+   start = metrics_now(&ctl->metrics);
+   rc = handler->ops.analog_channel_output(handler->io, channel, value,
+                                           ctl->v_program_max, ctl->v_program_min);
+   TRACE_END(trace_analog_output, rc);
+   metrics_since(&ctl->metrics, metrics_analog_output, start);
+   if (rc == false)
+      metrics_count(&ctl->metrics, metrics_io_errors, 1);
+
+   return rc;
+}
+
+static bool io_digital(ps_control_t *ctl, uint32_t channel, bool high)
+{
+   ps_handler_t *handler = &ctl->handler;
+   uint64_t start;
+   bool rc;
+
+   TRACE_BEGIN(trace_digital_output, channel);
+   start = metrics_now(&ctl->metrics);
+   if (high == true)
+      rc = handler->ops.digital_channel_output_high(handler->io, channel);
+   else
+      rc = handler->ops.digital_channel_output_low(handler->io, channel);
+   TRACE_END(trace_digital_output, rc);
+   metrics_since(&ctl->metrics, metrics_digital_output, start);
+   if (rc == false)
+      metrics_count(&ctl->metrics, metrics_io_errors, 1);
+
+   return rc;
+}
+
+static bool io_digital_mask(ps_control_t *ctl, uint32_t mask, uint32_t bits)
+{
+   ps_handler_t *handler = &ctl->handler;
+   uint64_t start;
+   bool rc;
+
+   TRACE_BEGIN(trace_digital_output, mask);
+   start = metrics_now(&ctl->metrics);
+   rc = handler->ops.digital_channels_output(handler->io, mask, bits);
+   TRACE_END(trace_digital_output, rc);
+   metrics_since(&ctl->metrics, metrics_digital_output, start);
+   if (rc == false)
+      metrics_count(&ctl->metrics, metrics_io_errors, 1);
+
+   return rc;
+}
+
+/* optional numeric key, value untouched if absent */
+static bool read_ctl_config(ALLEGRO_CONFIG *cfg, char *section,
+                            char *key, double *value)
+{
+   const char *str;
+   double d_value;
+
+   str = al_get_config_value(cfg, section, key);
+   if (str == NULL)
+      return true;
+
+   errno = 0;
+   d_value = strtod(str, NULL);
+   if (errno == ERANGE) {
+      fprintf(stderr, "failed to convert %s value from section[%s]!\n", key, section);
+      return false;
+   }
+   *value = d_value;
+
+   return true;
+}
+
+/* burst section, channels is a comma separated list of analog inputs */
+static bool read_burst_config(ps_control_t *ctl, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+   char *end;
+   double pre = BURST_PRE_DEFAULT, post = BURST_POST_DEFAULT;
+   unsigned long channel;
+   bool rc;
+
+   str = al_get_config_value(cfg, "burst", "channels");
+   if (str == NULL)
+      return true;
+
+   for (;;) {
+      errno = 0;
+      channel = strtoul(str, &end, 10);
+      if ((end == str) || (errno == ERANGE) || (channel > 15) ||
+          (ctl->burst_n == PS_BURST_CHANNELS_MAX)) {
+         fprintf(stderr, "burst channels[%s] not valid!\n", str);
+         return false;
+      }
+      ctl->burst_channels[ctl->burst_n++] = channel;
+      str = end;
+      while (isspace((unsigned char)*str))
+         str++;
+      if (*str == '\0')
+         break;
+      if (*str != ',') {
+         fprintf(stderr, "burst channels[%s] not valid!\n", str);
+         return false;
+      }
+      str++;
+   }
+
+   ctl->burst_rate = BURST_RATE_DEFAULT;
+   rc = read_ctl_config(cfg, "burst", "scan_rate", &ctl->burst_rate);
+   if (rc == false)
+      return false;
+   rc = read_ctl_config(cfg, "burst", "pre_scans", &pre);
+   if (rc == false)
+      return false;
+   rc = read_ctl_config(cfg, "burst", "post_scans", &post);
+   if (rc == false)
+      return false;
+   if ((ctl->burst_rate <= 0) || (pre < 0) || (post < 1) ||
+       (pre + post > PS_BURST_SCANS_MAX)) {
+      fprintf(stderr, "burst of %g+%g scans at %g Hz out of range!\n",
+              pre, post, ctl->burst_rate);
+      return false;
+   }
+   ctl->burst_pre = pre;
+   ctl->burst_post = post;
+
+   str = al_get_config_value(cfg, "burst", "trigger");
+   if ((str == NULL) || (strcmp(str, "enable") == 0)) {
+      ctl->burst_edge = false;
+   } else if (strcmp(str, "edge") == 0) {
+      ctl->burst_edge = true;
+   } else {
+      fprintf(stderr, "burst trigger[%s] is neither enable nor edge!\n", str);
+      return false;
+   }
+
+   return read_ctl_config(cfg, "burst", "level", &ctl->burst_level);
+}
+
+/* fault section, leds is a comma separated list of led numbers */
+static bool read_fault_config(ps_control_t *ctl, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+   char *end;
+   unsigned long led;
+   bool rc;
+
+   str = al_get_config_value(cfg, "fault", "leds");
+   if (str == NULL)
+      return true;
+
+   for (;;) {
+      errno = 0;
+      led = strtoul(str, &end, 10);
+      if ((end == str) || (errno == ERANGE) || (led > 31)) {
+         fprintf(stderr, "fault leds[%s] not valid!\n", str);
+         return false;
+      }
+      ctl->fault_mask |= 1U << led;
+      str = end;
+      while (isspace((unsigned char)*str))
+         str++;
+      if (*str == '\0')
+         break;
+      if (*str != ',') {
+         fprintf(stderr, "fault leds[%s] not valid!\n", str);
+         return false;
+      }
+      str++;
+   }
+
+   ctl->fault_rate = FAULT_RATE_DEFAULT;
+   rc = read_ctl_config(cfg, "fault", "rate", &ctl->fault_rate);
+   if (rc == false)
+      return false;
+   ctl->fault_budget_us = FAULT_BUDGET_US_DEFAULT;
+   rc = read_ctl_config(cfg, "fault", "budget_us", &ctl->fault_budget_us);
+   if (rc == false)
+      return false;
+   if ((ctl->fault_rate <= 0) || (ctl->fault_budget_us <= 0)) {
+      fprintf(stderr, "fault rate[%g] or budget_us[%g] out of range!\n",
+              ctl->fault_rate, ctl->fault_budget_us);
+      return false;
+   }
+
+   return true;
+}
+
+bool ctl_init(ps_control_t *ctl, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+   double cpu, retries;
+   bool rc;
+
+   memset(ctl, 0, sizeof(*ctl));
+
+   rc = rec_init(&ctl->rec, cfg);
+   if (rc == false)
+      return false;
+
+   rc = metrics_init(&ctl->metrics, cfg);
+   if (rc == false)
+      return false;
+
+   str = al_get_config_value(cfg, "plugin", "file");
+   if (str == NULL) {
+      fprintf(stderr, "failed to read file value from section[plugin]!\n");
+      return false;
+   }
+   if (strlen(str) >= sizeof(ctl->plugin_file)) {
+      fprintf(stderr, "requested value (key[file] in section[plugin]) too long!\n");
+      return false;
+   }
+   strcpy(ctl->plugin_file, str);
+
+   /* device is optional, the plugin has its own default */
+   str = al_get_config_value(cfg, "plugin", "device");
+   if (str != NULL) {
+      if (strlen(str) >= sizeof(ctl->device)) {
+         fprintf(stderr, "requested value (key[device] in section[plugin]) too long!\n");
+         return false;
+      }
+      strcpy(ctl->device, str);
+   }
+
+   /* options go to the plugin as they are */
+   str = al_get_config_value(cfg, "plugin", "options");
+   if (str != NULL) {
+      if (strlen(str) >= sizeof(ctl->options)) {
+         fprintf(stderr, "requested value (key[options] in section[plugin]) too long!\n");
+         return false;
+      }
+      strcpy(ctl->options, str);
+   }
+
+   /* by default a device that fails to open is not tried again */
+   retries = 0;
+   ctl->open_retry_ms = OPEN_RETRY_MS_DEFAULT;
+   if ((read_ctl_config(cfg, "plugin", "open_retries", &retries) == false) ||
+       (read_ctl_config(cfg, "plugin", "open_retry_ms", &ctl->open_retry_ms) == false))
+      return false;
+   if ((retries < 0) || (ctl->open_retry_ms < 0)) {
+      fprintf(stderr, "open_retries[%g] or open_retry_ms[%g] out of range!\n",
+              retries, ctl->open_retry_ms);
+      return false;
+   }
+   ctl->open_retries = retries;
+
+   /* control thread runs wherever the scheduler puts it unless pinned */
+   cpu = -1;
+   rc = read_ctl_config(cfg, "plugin", "cpu", &cpu);
+   if (rc == false)
+      return false;
+   ctl->cpu = cpu;
+
+   /* scan rate is optional, without it leds are read one by one */
+   rc = read_ctl_config(cfg, "plugin", "scan_rate", &ctl->scan_rate);
+   if (rc == false)
+      return false;
+
+   rc = read_burst_config(ctl, cfg);
+   if (rc == false)
+      return false;
+
+   rc = read_fault_config(ctl, cfg);
+   if (rc == false)
+      return false;
+
+   rc = profile_init(&ctl->profile, cfg);
+   if (rc == false)
+      return false;
+
+   rc = reg_init(&ctl->reg, cfg);
+   if (rc == false)
+      return false;
+
+   ctl->poll_rate = POLL_RATE_DEFAULT;
+   rc = read_ctl_config(cfg, "plugin", "poll_rate", &ctl->poll_rate);
+   if (rc == false)
+      return false;
+   if (ctl->poll_rate <= 0) {
+      fprintf(stderr, "poll_rate[%g] out of range!\n", ctl->poll_rate);
+      return false;
+   }
+
+   return load_io_plugin(ctl);
+}
+
+static bool init_status_scan(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   uint32_t channels[STATUS_CHANNELS_MAX];
+   double lower[STATUS_CHANNELS_MAX];
+   double upper[STATUS_CHANNELS_MAX];
+   double range_min[STATUS_CHANNELS_MAX];
+   double range_max[STATUS_CHANNELS_MAX];
+   uint32_t maxdata[STATUS_CHANNELS_MAX];
+   uint32_t n;
+   int i = 0;
+   bool rc;
+
+   if (!(handler->caps & ps_cap_scan) || (ctl->scan_rate <= 0))
+      return true;
+
+   if (ctl->leds_n + 1 > STATUS_CHANNELS_MAX) {
+      fprintf(stderr, "too many leds[%d] for status scan\n", ctl->leds_n);
+      return true;
+   }
+
+   for (i = 0; i < ctl->leds_n; i++) {
+      channels[i] = i + INPUT_CHANNEL_SHIFT;
+      lower[i] = VOLTAGE_LOWER_THRESHOLD;
+      upper[i] = VOLTAGE_UPPER_THRESHOLD;
+   }
+   n = ctl->leds_n;
+
+   /* the voltage monitor rides along behind the leds, its window is of
+    * no interest, the regulator peeks at its value */
+   if ((ctl->reg.on == true) && (handler->caps & ps_cap_scan_peek)) {
+      ctl->reg_index = n;
+      channels[n] = ctl->reg.channel;
+      lower[n] = VOLTAGE_LOWER_THRESHOLD;
+      upper[n] = VOLTAGE_UPPER_THRESHOLD;
+      n++;
+   }
+
+   rc = handler->ops.analog_scan_start(handler->io, &channels[0], n, ctl->scan_rate);
+   if (rc == false) {
+      fprintf(stderr, "status scan not started, falling back to single reads\n");
+      return true;
+   }
+
+   rc = handler->ops.analog_scan_window(handler->io, &lower[0], &upper[0], n);
+   if (rc == false) {
+      fprintf(stderr, "status thresholds rejected, falling back to single reads\n");
+      handler->ops.analog_scan_stop(handler->io);
+      return true;
+   }
+   ctl->scan_running = true;
+
+   if ((ctl->rec.header != NULL) && (handler->caps & ps_cap_scan_tap)) {
+      rc = handler->ops.analog_scan_tap(handler->io, rec_scan, &ctl->rec, &range_min[0],
+                                        &range_max[0], &maxdata[0], n);
+      if (rc == true)
+         rec_scan_setup(&ctl->rec, &channels[0], n, ctl->scan_rate,
+                        &range_min[0], &range_max[0], &maxdata[0]);
+      else
+         fprintf(stderr, "status scan not recorded\n");
+   }
+
+   return true;
+}
+
+static void poll_leds_scan(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   uint32_t state, seen = 0;
+   int scans;
+
+   /* thresholds are compared in raw codes inside the plugin */
+   scans = handler->ops.analog_scan_classify(handler->io, &state, &seen);
+   if (scans >= 0) {
+      seen |= ctl->fault_seen;
+      scans += ctl->fault_scans;
+      ctl->fault_seen = 0;
+      ctl->fault_scans = 0;
+   }
+   if (scans < 0) {
+      metrics_count(&ctl->metrics, metrics_io_errors, 1);
+      fprintf(stderr, "status scan failed, falling back to single reads\n");
+      handler->ops.analog_scan_stop(handler->io);
+      ctl->scan_running = false;
+      ctl->work.errors++;
+      return;
+   }
+   /* nothing new since the last poll */
+   if (scans == 0)
+      return;
+
+   /* led is lit if it was on in any scan since the last poll, this way
+    * short pulses in between two polls are not lost
+    */
+   ctl->work.leds = seen & ((1 << ctl->leds_n) - 1);
+   ctl->work.polls++;
+}
+
+static void poll_leds(ps_control_t *ctl)
+{
+   uint32_t leds = 0;
+   double voltage = 0.0f;
+   int i = 0;
+   bool rc;
+
+   if (ctl->scan_running == true) {
+      poll_leds_scan(ctl);
+      return;
+   }
+
+   for (i = 0; i < ctl->leds_n; i++) {
+      rc = io_input(ctl, i + INPUT_CHANNEL_SHIFT, &voltage);
+      if (rc == false) {
+         fprintf(stderr, "analog channel input failed\n");
+         ctl->work.errors++;
+         return;
+      }
+      rec_input(&ctl->rec, i + INPUT_CHANNEL_SHIFT, voltage);
+      if ((voltage < VOLTAGE_UPPER_THRESHOLD) &&
+          (voltage > VOLTAGE_LOWER_THRESHOLD))
+         leds |= 1 << i;
+   }
+   ctl->work.leds = leds;
+   ctl->work.polls++;
+}
+
+/* the plugin switches the scan over, classification goes on meanwhile */
+static void burst_arm(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   double scan_rate = ctl->burst_rate;
+   bool rc;
+
+   rc = handler->ops.analog_burst_arm(handler->io, &ctl->burst_channels[0], ctl->burst_n,
+                                      &scan_rate, ctl->burst_pre, ctl->burst_post,
+                                      (ctl->burst_edge == true) ? 0 : -1, ctl->burst_level);
+   if (rc == false) {
+      fprintf(stderr, "burst capture not armed, switched off\n");
+      ctl->burst_n = 0;
+      ctl->work.errors++;
+      return;
+   }
+   ctl->capture.scan_rate = scan_rate;
+   ctl->burst_armed = true;
+   ctl->work.burst_state = burst_armed;
+}
+
+/* hands a complete window to the consumer and arms the next one, a
+ * window the consumer has no room for waits inside the plugin
+ */
+static void poll_burst(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   ps_capture_t *capture = &ctl->capture;
+   uint32_t trigger;
+   int scans;
+
+   if ((ctl->burst_n == 0) || (ctl->scan_running == false))
+      return;
+
+   if (atomic_load_explicit(&ctl->capture_full, memory_order_acquire) == true)
+      return;
+
+   if (ctl->burst_armed == false) {
+      burst_arm(ctl);
+      return;
+   }
+
+   ctl->work.burst_state = handler->ops.analog_burst_state(handler->io);
+   if (ctl->work.burst_state != burst_done)
+      return;
+
+   scans = handler->ops.analog_burst_read(handler->io, capture->values,
+                                          PS_BURST_SCANS_MAX * ctl->burst_n, &trigger);
+   ctl->burst_armed = false;
+   ctl->work.burst_state = burst_idle;
+   if (scans <= 0) {
+      fprintf(stderr, "burst read failed\n");
+      ctl->work.errors++;
+      return;
+   }
+
+   capture->shot = ++ctl->work.shots;
+   capture->scans = scans;
+   capture->trigger = trigger;
+   atomic_store_explicit(&ctl->capture_full, true, memory_order_release);
+}
+
+/* compiled at the rate the card can do, the plugin keeps the codes */
+static bool profile_load(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   ps_profile_t *profile = &ctl->profile;
+   double rate = profile->rate;
+   bool rc;
+
+   ctl->profile_channel = handler->ops.convert_knob_to_channel(voltage_program_knob);
+   if (ctl->profile_channel == -1)
+      return false;
+
+   rc = profile_compile(profile, rate);
+   if (rc == false)
+      return false;
+   rc = handler->ops.analog_profile_load(handler->io, ctl->profile_channel, profile->values,
+                                         profile->n, &rate, ctl->v_program_max,
+                                         ctl->v_program_min);
+   if (rc == false)
+      return false;
+   if (fabs(rate - profile->rate) <= 1e-6 * profile->rate)
+      return true;
+
+   /* card clock settled elsewhere, keep the timing of the points */
+   profile->rate = rate;
+   rc = profile_compile(profile, rate);
+   if (rc == false)
+      return false;
+   return handler->ops.analog_profile_load(handler->io, ctl->profile_channel, profile->values,
+                                           profile->n, &rate, ctl->v_program_max,
+                                           ctl->v_program_min);
+}
+
+/* from the first sample, a running profile starts over */
+static bool profile_run(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   bool rc;
+
+   if (ctl->profile.n == 0) {
+      fprintf(stderr, "no output profile loaded\n");
+      return false;
+   }
+
+   if (ctl->profile_running == true)
+      profile_stop(ctl);
+
+   rc = handler->ops.analog_profile_run(handler->io);
+   if (rc == false) {
+      fprintf(stderr, "output profile failed to start\n");
+      return false;
+   }
+   rec_setpoint(&ctl->rec, ctl->profile_channel, ctl->profile.values[0]);
+   ctl->profile_running = true;
+   ctl->work.profile_left = ctl->profile.n;
+
+   return true;
+}
+
+/* the output holds the sample it was at, the knob follows it */
+static void profile_stop(ps_control_t *ctl)
+{
+   ps_handler_t *handler = &ctl->handler;
+   double value;
+   int left;
+
+   if (ctl->profile_running == false)
+      return;
+
+   left = handler->ops.analog_profile_poll(handler->io);
+   handler->ops.analog_profile_stop(handler->io);
+   ctl->profile_running = false;
+   ctl->work.profile_left = 0;
+   if (left < 0) {
+      ctl->work.errors++;
+      return;
+   }
+   /* not a sample out yet, the output did not move */
+   if ((uint32_t)left >= ctl->profile.n)
+      return;
+
+   value = ctl->profile.values[ctl->profile.n - 1 - left];
+   rec_setpoint(&ctl->rec, ctl->profile_channel, value);
+   ctl->work.knobs[voltage_program_knob] = value;
+   ctl->work.profile_ends++;
+}
+
+/* keeps the plugin buffer topped up, the samples go out on the card clock */
+static void poll_profile(ps_control_t *ctl)
+{
+   int left;
+
+   if (ctl->profile_running == false)
+      return;
+
+   left = ctl->handler.ops.analog_profile_poll(ctl->handler.io);
+   if (left < 0) {
+      fprintf(stderr, "output profile failed\n");
+      ctl->handler.ops.analog_profile_stop(ctl->handler.io);
+      ctl->profile_running = false;
+      ctl->work.profile_left = 0;
+      ctl->work.errors++;
+      return;
+   }
+   ctl->work.profile_left = left;
+   if (left == 0)
+      profile_stop(ctl);
+}
+
+/* enable written high is the start of a charge, the burst trigger and
+ * the start of a soft start profile
+ */
+static void enable_written(ps_control_t *ctl, uint32_t mask, uint32_t bits)
+{
+   if ((mask & bits & (1 << enable_key)) == 0)
+      return;
+
+   if ((ctl->burst_armed == true) && (ctl->burst_edge == false))
+      ctl->handler.ops.analog_burst_trigger(ctl->handler.io);
+   if ((ctl->profile.n > 0) && (ctl->profile.on_enable == true) &&
+       (profile_run(ctl) == false))
+      ctl->work.errors++;
+}
+
+/* one pass of the closed loop, deadline is when it was due */
+static void regulate(ps_control_t *ctl, struct timespec *deadline)
+{
+   ps_handler_t *handler = &ctl->handler;
+   double values[STATUS_CHANNELS_MAX];
+   double setpoint, monitor, measured, output;
+   uint64_t start, due;
+   int retval;
+   bool rc;
+
+   start = now_ns();
+   due = (uint64_t)deadline->tv_sec * 1000000000ULL + deadline->tv_nsec;
+   if (start > due) {
+      ctl->reg_late_sum += start - due;
+      if (start - due > ctl->reg_late_max)
+         ctl->reg_late_max = start - due;
+   }
+   ctl->reg_loops++;
+
+   setpoint = ctl->work.knobs[voltage_program_knob];
+   /* a profile owns the output, with enable off there is nothing to hold */
+   if ((ctl->profile_running == true) ||
+       ((ctl->work.controls & (1 << enable_key)) == 0)) {
+      if (ctl->reg_active == true) {
+         reg_reset(&ctl->reg);
+         ctl->reg_active = false;
+         if ((ctl->profile_running == false) &&
+             (io_output(ctl, ctl->reg_output, setpoint) == false))
+            ctl->work.errors++;
+      }
+      goto out;
+   }
+
+   if (ctl->scan_running == true) {
+      retval = handler->ops.analog_scan_peek(handler->io, &values[0], STATUS_CHANNELS_MAX);
+      if (retval <= 0) {
+         /* the status poll falls back to single reads on errors */
+         if (retval < 0)
+            ctl->work.errors++;
+         goto out;
+      }
+      monitor = values[ctl->reg_index];
+   } else {
+      rc = io_input(ctl, ctl->reg.channel, &monitor);
+      if (rc == false) {
+         ctl->work.errors++;
+         goto out;
+      }
+   }
+   measured = monitor * ctl->reg_scale;
+
+   output = reg_update(&ctl->reg, setpoint, measured, ctl->v_program_max,
+                       ctl->v_program_min);
+   rc = io_output(ctl, ctl->reg_output, output);
+   if (rc == false) {
+      ctl->work.errors++;
+      goto out;
+   }
+   ctl->reg_active = true;
+   ctl->reg_active_loops++;
+   ctl->reg_error2 += (setpoint - measured) * (setpoint - measured);
+   if (fabs(setpoint - measured) > ctl->reg_error_max)
+      ctl->reg_error_max = fabs(setpoint - measured);
+
+out:
+   if (now_ns() - start > ctl->reg_run_max)
+      ctl->reg_run_max = now_ns() - start;
+   if (ctl->reg_loops >= ctl->reg.window * ctl->reg.rate)
+      reg_window(ctl);
+}
+
+/* publish the statistics of a complete window and start the next one */
+static void reg_window(ps_control_t *ctl)
+{
+   ps_reg_stats_t *stats = &ctl->work.reg;
+
+   stats->windows++;
+   stats->loops = ctl->reg_loops;
+   stats->active = ctl->reg_active_loops;
+   stats->error_rms = (ctl->reg_active_loops > 0) ?
+                      sqrt(ctl->reg_error2 / ctl->reg_active_loops) : 0;
+   stats->error_max = ctl->reg_error_max;
+   stats->late_mean_us = ctl->reg_late_sum / ctl->reg_loops / 1e3;
+   stats->late_max_us = ctl->reg_late_max / 1e3;
+   stats->run_max_us = ctl->reg_run_max / 1e3;
+   stats->overruns = ctl->reg_overruns;
+
+   ctl->reg_loops = 0;
+   ctl->reg_active_loops = 0;
+   ctl->reg_overruns = 0;
+   ctl->reg_error2 = 0;
+   ctl->reg_error_max = 0;
+   ctl->reg_late_sum = 0;
+   ctl->reg_late_max = 0;
+   ctl->reg_run_max = 0;
+}
+
+/* Inhibit goes high on its own as soon as a check sees a fault led lit.
+ * With the status scan the check takes the classification, the next
+ * status poll gets it from fault_seen, without it only the fault leds
+ * are read. A fault sample is not older than the check before this one,
+ * plus a scan the card had not handed over yet.
+ */
+static void check_faults(ps_control_t *ctl, struct timespec *deadline)
+{
+   ps_handler_t *handler = &ctl->handler;
+   ps_fault_stats_t *stats = &ctl->work.fault;
+   uint32_t state, seen = 0, faults;
+   uint64_t start, due, end;
+   double voltage, latency;
+   int scans, i = 0;
+   bool rc;
+
+   start = now_ns();
+   due = (uint64_t)deadline->tv_sec * 1000000000ULL + deadline->tv_nsec;
+   if ((start > due) && ((start - due) / 1e3 > stats->late_max_us))
+      stats->late_max_us = (start - due) / 1e3;
+
+   if (ctl->scan_running == true) {
+      scans = handler->ops.analog_scan_classify(handler->io, &state, &seen);
+      /* the status poll falls back to single reads */
+      if (scans <= 0)
+         goto out;
+      ctl->fault_seen |= seen;
+      ctl->fault_scans += scans;
+   } else {
+      for (i = 0; i < ctl->leds_n; i++) {
+         if ((ctl->fault_mask & (1 << i)) == 0)
+            continue;
+         rc = io_input(ctl, i + INPUT_CHANNEL_SHIFT, &voltage);
+         if (rc == false) {
+            ctl->work.errors++;
+            goto out;
+         }
+         if ((voltage < VOLTAGE_UPPER_THRESHOLD) &&
+             (voltage > VOLTAGE_LOWER_THRESHOLD))
+            seen |= 1 << i;
+      }
+   }
+
+   faults = seen & ctl->fault_mask;
+   /* latched by the line itself, the operator clears it */
+   if ((faults == 0) || (ctl->work.controls & (1 << inhibit_key)))
+      goto out;
+
+   rc = io_digital(ctl, ctl->fault_channel, true);
+   end = now_ns();
+   if (rc == false) {
+      fprintf(stderr, "automatic inhibit on channel[%d] failed\n", ctl->fault_channel);
+      ctl->work.errors++;
+      goto out;
+   }
+   if (ctl->fault_channel < 32)
+      rec_dio(&ctl->rec, 1U << ctl->fault_channel, 1U << ctl->fault_channel);
+   ctl->work.controls |= 1 << inhibit_key;
+   /* the UI and the API clients follow it like any other write */
+   ctl->work.batch_writes++;
+
+   latency = (end - ctl->fault_last_ns) / 1e3;
+   if (ctl->scan_running == true)
+      latency += 1e6 / ctl->scan_rate;
+   stats->trips++;
+   stats->leds = faults;
+   stats->latency_us = latency;
+   if (latency > stats->latency_max_us)
+      stats->latency_max_us = latency;
+
+out:
+   ctl->fault_last_ns = start;
+}
+
+static void apply_command(ps_control_t *ctl, ps_command_t *cmd)
+{
+   ps_handler_t *handler = &ctl->handler;
+   int channel = -1;
+   bool rc = false;
+
+   switch(cmd->type) {
+   case ps_cmd_knob:
+      channel = handler->ops.convert_knob_to_channel(cmd->index);
+      if ((channel == -1) || (cmd->index >= PS_KNOBS_MAX)) {
+         fprintf(stderr, "conversion for knob[%d] failed\n", cmd->index);
+         break;
+      }
+      /* the operator takes over from a running profile */
+      if ((ctl->profile_running == true) && (channel == ctl->profile_channel))
+         profile_stop(ctl);
+      rc = io_output(ctl, channel, cmd->value);
+      if (rc == false) {
+         fprintf(stderr, "output to analog channel[%d] failed\n", channel);
+         break;
+      }
+      rec_setpoint(&ctl->rec, channel, cmd->value);
+      ctl->work.knobs[cmd->index] = cmd->value;
+      break;
+   case ps_cmd_status:
+      rc = true;
+      break;
+   case ps_cmd_profile:
+      if (cmd->value != 0) {
+         rc = profile_run(ctl);
+      } else {
+         profile_stop(ctl);
+         rc = true;
+      }
+      break;
+   case ps_cmd_control:
+      channel = handler->ops.convert_button_to_channel(cmd->index);
+      if (channel == -1) {
+         fprintf(stderr, "conversion for button[%d] failed\n", cmd->index);
+         break;
+      }
+      if (cmd->value != 0) {
+         rc = io_digital(ctl, channel, true);
+         if (rc == false) {
+            fprintf(stderr, "digital_channel_output_high for channel[%d] failed\n",
+                    channel);
+            break;
+         }
+         if (channel < 32)
+            rec_dio(&ctl->rec, 1U << channel, 1U << channel);
+         enable_written(ctl, 1 << cmd->index, 1 << cmd->index);
+         ctl->work.controls |= 1 << cmd->index;
+      } else {
+         rc = io_digital(ctl, channel, false);
+         if (rc == false) {
+            fprintf(stderr, "digital_channel_output_low for channel[%d] failed\n",
+                    channel);
+            break;
+         }
+         if (channel < 32)
+            rec_dio(&ctl->rec, 1U << channel, 0);
+         ctl->work.controls &= ~(1 << cmd->index);
+      }
+      break;
+   default:
+      fprintf(stderr, "unknown command[%d]\n", cmd->type);
+      break;
+   }
+
+   if (rc == false)
+      ctl->work.errors++;
+}
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Knob writes go out in order. Control writes are merged into a single
+ * masked write of the digital lines when the plugin has one, so the
+ * lines of a batch change together, the last value of a line wins.
+ */
+static void apply_batch(ps_control_t *ctl, ps_batch_t *batch, ps_completion_t *done)
+{
+   ps_handler_t *handler = &ctl->handler;
+   ps_command_t *cmd;
+   uint32_t mask = 0, bits = 0;
+   uint32_t controls_mask = 0, controls_bits = 0;
+   uint32_t errors, i = 0;
+   bool written = false;
+   int channel;
+   bool rc;
+
+   done->client = batch->client;
+   done->sequence = batch->sequence;
+   done->errors = 0;
+   done->write_ns = 0;
+
+   for (i = 0; (i < batch->n) && (i < PS_BATCH_MAX); i++) {
+      cmd = &batch->commands[i];
+      if (cmd->type == ps_cmd_status)
+         continue;
+
+      if ((cmd->type == ps_cmd_control) && (handler->caps & ps_cap_dio_mask)) {
+         channel = handler->ops.convert_button_to_channel(cmd->index);
+         if ((channel < 0) || (channel > 31) || (cmd->index > 31)) {
+            fprintf(stderr, "conversion for button[%d] failed\n", cmd->index);
+            done->errors++;
+            continue;
+         }
+         mask |= 1 << channel;
+         controls_mask |= 1 << cmd->index;
+         if (cmd->value != 0) {
+            bits |= 1 << channel;
+            controls_bits |= 1 << cmd->index;
+         } else {
+            bits &= ~(1 << channel);
+            controls_bits &= ~(1 << cmd->index);
+         }
+         continue;
+      }
+
+      errors = ctl->work.errors;
+      apply_command(ctl, cmd);
+      if (ctl->work.errors != errors)
+         done->errors++;
+      else
+         written = true;
+   }
+
+   if (mask != 0) {
+      rc = io_digital_mask(ctl, mask, bits);
+      if (rc == true) {
+         rec_dio(&ctl->rec, mask, bits);
+         enable_written(ctl, controls_mask, controls_bits);
+         ctl->work.controls = (ctl->work.controls & ~controls_mask) | controls_bits;
+         written = true;
+      } else {
+         fprintf(stderr, "digital_channels_output mask[0x%x] failed\n", mask);
+         ctl->work.errors++;
+         done->errors++;
+      }
+   }
+
+   if (written == true) {
+      done->write_ns = now_ns();
+      ctl->work.batch_writes++;
+   }
+   memcpy(&done->status, &ctl->work, sizeof(ps_status_t));
+}
+
+/* consumer of batches, producer of completions, true if any ran */
+static bool run_batches(ps_control_t *ctl)
+{
+   unsigned int head, tail, done_head;
+   uint64_t one = 1;
+   bool ran = false;
+
+   tail = atomic_load_explicit(&ctl->batch_tail, memory_order_relaxed);
+   head = atomic_load_explicit(&ctl->batch_head, memory_order_acquire);
+   done_head = atomic_load_explicit(&ctl->done_head, memory_order_relaxed);
+   while (tail != head) {
+      /* the API side never has more batches in flight than completion
+       * slots, so the completion ring cannot be full here */
+      apply_batch(ctl, &ctl->batches[tail % PS_BATCHES_N],
+                  &ctl->completions[done_head % PS_BATCHES_N]);
+      metrics_count(&ctl->metrics, metrics_batches, 1);
+      done_head++;
+      atomic_store_explicit(&ctl->done_head, done_head, memory_order_release);
+      tail++;
+      atomic_store_explicit(&ctl->batch_tail, tail, memory_order_release);
+      ran = true;
+   }
+
+   if ((ran == true) && (write(ctl->done_fd, &one, sizeof(one)) == -1))
+      perror("write completion eventfd");
+
+   return ran;
+}
+
+/* writer side of the snapshot, odd sequence means update in progress */
+static void publish_status(ps_control_t *ctl)
+{
+   unsigned int seq;
+
+   seq = atomic_load_explicit(&ctl->status_seq, memory_order_relaxed);
+   atomic_store_explicit(&ctl->status_seq, seq + 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   memcpy(&ctl->status, &ctl->work, sizeof(ps_status_t));
+   atomic_store_explicit(&ctl->status_seq, seq + 2, memory_order_release);
+}
+
+void ctl_status(ps_control_t *ctl, ps_status_t *status)
+{
+   unsigned int seq1, seq2;
+
+   do {
+      seq1 = atomic_load_explicit(&ctl->status_seq, memory_order_acquire);
+      memcpy(status, &ctl->status, sizeof(ps_status_t));
+      atomic_thread_fence(memory_order_acquire);
+      seq2 = atomic_load_explicit(&ctl->status_seq, memory_order_relaxed);
+   } while ((seq1 & 1) || (seq1 != seq2));
+}
+
+/* producer side, only ever called from the UI thread */
+bool ctl_command(ps_control_t *ctl, uint32_t type, uint32_t index, double value)
+{
+   unsigned int head, tail;
+   ps_command_t *cmd;
+
+   head = atomic_load_explicit(&ctl->cmd_head, memory_order_relaxed);
+   tail = atomic_load_explicit(&ctl->cmd_tail, memory_order_acquire);
+   if (head - tail == PS_COMMANDS_N) {
+      fprintf(stderr, "control command queue full\n");
+      return false;
+   }
+
+   cmd = &ctl->commands[head % PS_COMMANDS_N];
+   cmd->type = type;
+   cmd->index = index;
+   cmd->value = value;
+   atomic_store_explicit(&ctl->cmd_head, head + 1, memory_order_release);
+   sem_post(&ctl->wake);
+
+   return true;
+}
+
+/* producer side of the API ring, only ever called from the API thread */
+bool ctl_batch(ps_control_t *ctl, ps_batch_t *batch)
+{
+   unsigned int head, tail;
+
+   head = atomic_load_explicit(&ctl->batch_head, memory_order_relaxed);
+   tail = atomic_load_explicit(&ctl->batch_tail, memory_order_acquire);
+   if (head - tail == PS_BATCHES_N) {
+      fprintf(stderr, "control batch queue full\n");
+      return false;
+   }
+
+   memcpy(&ctl->batches[head % PS_BATCHES_N], batch, sizeof(ps_batch_t));
+   atomic_store_explicit(&ctl->batch_head, head + 1, memory_order_release);
+   sem_post(&ctl->wake);
+
+   return true;
+}
+
+/* consumer side of the captures, NULL until a window is complete, it
+ * stays valid until ctl_capture_done()
+ */
+ps_capture_t *ctl_capture(ps_control_t *ctl)
+{
+   if (atomic_load_explicit(&ctl->capture_full, memory_order_acquire) == false)
+      return NULL;
+
+   return &ctl->capture;
+}
+
+void ctl_capture_done(ps_control_t *ctl)
+{
+   atomic_store_explicit(&ctl->capture_full, false, memory_order_release);
+   sem_post(&ctl->wake);
+}
+
+/* consumer side of the completions, false when there is none */
+bool ctl_completion(ps_control_t *ctl, ps_completion_t *completion)
+{
+   unsigned int head, tail;
+
+   tail = atomic_load_explicit(&ctl->done_tail, memory_order_relaxed);
+   head = atomic_load_explicit(&ctl->done_head, memory_order_acquire);
+   if (tail == head)
+      return false;
+
+   memcpy(completion, &ctl->completions[tail % PS_BATCHES_N], sizeof(ps_completion_t));
+   atomic_store_explicit(&ctl->done_tail, tail + 1, memory_order_release);
+
+   return true;
+}
+
+static void timespec_add_ns(struct timespec *ts, long ns)
+{
+   ts->tv_nsec += ns;
+   while (ts->tv_nsec >= 1000000000L) {
+      ts->tv_nsec -= 1000000000L;
+      ts->tv_sec++;
+   }
+}
+
+static bool timespec_before(struct timespec *a, struct timespec *b)
+{
+   return (a->tv_sec < b->tv_sec) ||
+          ((a->tv_sec == b->tv_sec) && (a->tv_nsec < b->tv_nsec));
+}
+
+static void *ctl_thread(void *arg)
+{
+   ps_control_t *ctl = arg;
+   struct timespec next_poll, next_reg, next_fault, now, *next;
+   long period_ns = 1e9 / ctl->poll_rate;
+   long reg_period_ns = 0, fault_period_ns = 0;
+   unsigned int head, tail;
+   bool changed;
+
+   clock_gettime(CLOCK_MONOTONIC, &next_poll);
+   next_reg = next_poll;
+   next_fault = next_poll;
+   ctl->fault_last_ns = now_ns();
+   if (ctl->reg.on == true)
+      reg_period_ns = 1e9 / ctl->reg.rate;
+   if (ctl->fault_mask != 0)
+      fault_period_ns = 1e9 / ctl->fault_rate;
+
+   while (atomic_load_explicit(&ctl->stop, memory_order_relaxed) == false) {
+      /* faults have a latency budget, they go before anything else */
+      if (ctl->fault_mask != 0) {
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         if (!timespec_before(&now, &next_fault)) {
+            check_faults(ctl, &next_fault);
+            timespec_add_ns(&next_fault, fault_period_ns);
+            if (timespec_before(&next_fault, &now)) {
+               ctl->work.fault.overruns++;
+               next_fault = now;
+               timespec_add_ns(&next_fault, fault_period_ns);
+            }
+         }
+      }
+
+      /* the loop has the tightest deadline after that */
+      if (ctl->reg.on == true) {
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         if (!timespec_before(&now, &next_reg)) {
+            regulate(ctl, &next_reg);
+            timespec_add_ns(&next_reg, reg_period_ns);
+            if (timespec_before(&next_reg, &now)) {
+               ctl->reg_overruns++;
+               next_reg = now;
+               timespec_add_ns(&next_reg, reg_period_ns);
+            }
+         }
+      }
+
+      /* commands first, they are what the operator waits for */
+      changed = false;
+      tail = atomic_load_explicit(&ctl->cmd_tail, memory_order_relaxed);
+      head = atomic_load_explicit(&ctl->cmd_head, memory_order_acquire);
+      while (tail != head) {
+         TRACE_BEGIN(trace_command, ctl->commands[tail % PS_COMMANDS_N].type);
+         apply_command(ctl, &ctl->commands[tail % PS_COMMANDS_N]);
+         TRACE_END(trace_command, 0);
+         ctl->work.commands++;
+         tail++;
+         atomic_store_explicit(&ctl->cmd_tail, tail, memory_order_release);
+         metrics_count(&ctl->metrics, metrics_commands, 1);
+         changed = true;
+      }
+      if (run_batches(ctl) == true)
+         changed = true;
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (!timespec_before(&now, &next_poll)) {
+         metrics_hist(&ctl->metrics, metrics_poll_late,
+                      (now.tv_sec - next_poll.tv_sec) * 1000000000LL +
+                      now.tv_nsec - next_poll.tv_nsec);
+         TRACE_BEGIN(trace_poll, 0);
+         poll_leds(ctl);
+         poll_burst(ctl);
+         poll_profile(ctl);
+         TRACE_END(trace_poll, 0);
+         metrics_count(&ctl->metrics, metrics_polls, 1);
+         changed = true;
+         timespec_add_ns(&next_poll, period_ns);
+         /* fell behind more than a period, do not try to catch up */
+         if (timespec_before(&next_poll, &now)) {
+            metrics_count(&ctl->metrics, metrics_polls_missed, 1);
+            next_poll = now;
+            timespec_add_ns(&next_poll, period_ns);
+         }
+      }
+
+      if (changed == true)
+         publish_status(ctl);
+
+      /* sleep until the next poll or until a command arrives */
+      next = &next_poll;
+      if ((ctl->reg.on == true) && timespec_before(&next_reg, next))
+         next = &next_reg;
+      if ((ctl->fault_mask != 0) && timespec_before(&next_fault, next))
+         next = &next_fault;
+      while ((sem_clockwait(&ctl->wake, CLOCK_MONOTONIC, next) == -1) &&
+             (errno == EINTR))
+         ;
+   }
+
+   return NULL;
+}
+
+bool ctl_start(ps_control_t *ctl, uint32_t leds_n,
+               double v_program_max, double v_program_min)
+{
+   pthread_attr_t attr;
+   cpu_set_t cpus;
+   int retval;
+   bool rc;
+
+   ctl->leds_n = leds_n;
+   ctl->v_program_max = v_program_max;
+   ctl->v_program_min = v_program_min;
+
+   rc = rec_open(&ctl->rec);
+   if (rc == false)
+      return false;
+
+   rc = metrics_open(&ctl->metrics);
+   if (rc == false)
+      return false;
+
+   rc = init_status_scan(ctl);
+   if (rc == false)
+      return false;
+
+   /* burst rides on the status scan, room for the largest window */
+   if ((ctl->burst_n > 0) &&
+       ((ctl->scan_running == false) || !(ctl->handler.caps & ps_cap_burst))) {
+      fprintf(stderr, "burst capture needs a plugin with status scan and bursts\n");
+      ctl->burst_n = 0;
+   }
+   if (ctl->burst_n > 0) {
+      ctl->capture.n = ctl->burst_n;
+      memcpy(ctl->capture.channels, ctl->burst_channels, sizeof(ctl->burst_channels));
+      ctl->capture.values = malloc(PS_BURST_SCANS_MAX * ctl->burst_n * sizeof(double));
+      if (ctl->capture.values == NULL) {
+         fprintf(stderr, "failed to allocate burst capture\n");
+         return false;
+      }
+      atomic_store(&ctl->capture_full, false);
+   }
+
+   if ((ctl->profile.points_n > 0) && !(ctl->handler.caps & ps_cap_profile)) {
+      fprintf(stderr, "output profile needs a plugin with profiles\n");
+      ctl->profile.points_n = 0;
+   }
+   if ((ctl->profile.points_n > 0) && (profile_load(ctl) == false)) {
+      fprintf(stderr, "output profile not loaded, switched off\n");
+      profile_free(&ctl->profile);
+   }
+
+   if (ctl->fault_mask != 0) {
+      ctl->fault_channel = ctl->handler.ops.convert_button_to_channel(inhibit_key);
+      if (ctl->fault_channel == -1) {
+         fprintf(stderr, "no inhibit output, automatic inhibit switched off\n");
+         ctl->fault_mask = 0;
+      }
+      ctl->fault_mask &= (1U << leds_n) - 1;
+   }
+   /* a check period plus, with the scan, a scan the card still holds */
+   if ((ctl->fault_mask != 0) &&
+       (1e6 / ctl->fault_rate + ((ctl->scan_running == true) ? 1e6 / ctl->scan_rate : 0) >
+        ctl->fault_budget_us))
+      fprintf(stderr, "automatic inhibit may take longer than %g us, "
+              "raise [fault] rate or [plugin] scan_rate\n", ctl->fault_budget_us);
+
+   /* the card can not do single reads next to the scan */
+   if ((ctl->reg.on == true) && (ctl->scan_running == true) &&
+       !(ctl->handler.caps & ps_cap_scan_peek)) {
+      fprintf(stderr, "regulation needs a plugin with scan peeks, switched off\n");
+      ctl->reg.on = false;
+   }
+   if (ctl->reg.on == true) {
+      ctl->reg_output = ctl->handler.ops.convert_knob_to_channel(voltage_program_knob);
+      if (ctl->reg_output == -1) {
+         fprintf(stderr, "no output for regulation, switched off\n");
+         ctl->reg.on = false;
+      }
+      /* monitor reads in program volts, comparable with the setpoint */
+      ctl->reg_scale = v_program_max / ctl->reg.monitor_full;
+   }
+
+   if (sem_init(&ctl->wake, 0, 0) == -1) {
+      perror("sem_init");
+      return false;
+   }
+   ctl->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (ctl->done_fd == -1) {
+      perror("eventfd");
+      return false;
+   }
+   atomic_store(&ctl->stop, false);
+
+   pthread_attr_init(&attr);
+   if (ctl->cpu >= 0) {
+      CPU_ZERO(&cpus);
+      CPU_SET(ctl->cpu, &cpus);
+      pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+   }
+   retval = pthread_create(&ctl->thread, &attr, ctl_thread, ctl);
+   pthread_attr_destroy(&attr);
+   if ((retval != 0) && (ctl->cpu >= 0)) {
+      fprintf(stderr, "control thread not pinned to cpu[%d]: %s\n", ctl->cpu,
+              strerror(retval));
+      retval = pthread_create(&ctl->thread, NULL, ctl_thread, ctl);
+   }
+   if (retval != 0) {
+      fprintf(stderr, "failed to create control thread: %s\n", strerror(retval));
+      return false;
+   }
+   ctl->thread_running = true;
+
+   return true;
+}
+
+void ctl_stop(ps_control_t *ctl)
+{
+   if (ctl->thread_running == true) {
+      atomic_store(&ctl->stop, true);
+      sem_post(&ctl->wake);
+      pthread_join(ctl->thread, NULL);
+      sem_destroy(&ctl->wake);
+      close(ctl->done_fd);
+      ctl->done_fd = -1;
+      ctl->thread_running = false;
+   }
+
+   if (ctl->profile_running == true)
+      ctl->handler.ops.analog_profile_stop(ctl->handler.io);
+   ctl->profile_running = false;
+   profile_free(&ctl->profile);
+   if (ctl->scan_running == true)
+      ctl->handler.ops.analog_scan_stop(ctl->handler.io);
+   ctl->scan_running = false;
+   rec_close(&ctl->rec);
+   metrics_close(&ctl->metrics);
+   free(ctl->capture.values);
+   ctl->capture.values = NULL;
+
+   unload_io_plugin(ctl);
+}
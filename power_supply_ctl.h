@@ -0,0 +1,261 @@
+/*
+ * Header file for the acquisition/control thread
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_CTL_H
+#define __POWER_SUPPLY_CTL_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+/* types */
+
+typedef struct power_supply_handler {
+   void *handle;
+   const ps_plugin_t *plugin;
+   /* open device, every entry but the conversions takes it */
+   ps_io_t *io;
+   /* what the plugin offers and has entries for, the entries of any
+    * other capability are NULL */
+   uint32_t caps;
+   ps_plugin_ops_t ops;
+   /* time open() took, retries included */
+   double open_ms;
+} ps_handler_t;
+
+/* commands from the UI to the control thread */
+enum {
+   ps_cmd_knob = 0,
+   ps_cmd_control,
+   /* writes nothing, a batch of it only reads back the state */
+   ps_cmd_status,
+   /* 1 runs the output profile from its start, 0 stops it */
+   ps_cmd_profile,
+};
+
+typedef struct ps_command {
+   uint32_t type;
+   uint32_t index;
+   /* program voltage for knobs, 1 on and 0 off for controls */
+   double value;
+} ps_command_t;
+
+/* supplies one process drives, each with its own plugin context */
+#define PS_SUPPLIES_MAX 8
+
+#define PS_KNOBS_MAX 4
+#define PS_COMMANDS_N 256
+#define PS_BATCH_MAX 16
+#define PS_BATCHES_N 64
+#define PS_BURST_CHANNELS_MAX 4
+#define PS_BURST_SCANS_MAX 65536
+
+/* closed loop statistics over the last [regulation] window */
+typedef struct ps_reg_stats {
+   /* windows completed, the rest is valid once non zero */
+   uint32_t windows;
+   uint32_t loops;
+   /* loops that regulated, the others ran with enable off or a profile */
+   uint32_t active;
+   /* tracking error in program volts */
+   double error_rms;
+   double error_max;
+   /* start of a loop after its deadline and time spent in it [us] */
+   double late_mean_us;
+   double late_max_us;
+   double run_max_us;
+   /* deadlines missed by a whole period or more */
+   uint32_t overruns;
+} ps_reg_stats_t;
+
+/* automatic inhibit, latency is a bound from the fault sample to the
+ * return of the inhibit write */
+typedef struct ps_fault_stats {
+   uint32_t trips;
+   /* leds that caused the last trip */
+   uint32_t leds;
+   double latency_us;
+   double latency_max_us;
+   /* start of a check after its deadline [us], checks missed by a period */
+   double late_max_us;
+   uint32_t overruns;
+} ps_fault_stats_t;
+
+/* state published by the control thread */
+typedef struct ps_status {
+   /* completed status polls, leds are valid once non zero */
+   uint64_t polls;
+   /* bit per led, set when lit */
+   uint32_t leds;
+   /* bit per control, set when on */
+   uint32_t controls;
+   /* last program voltage written for each knob */
+   double knobs[PS_KNOBS_MAX];
+   /* failed commands and polls */
+   uint32_t errors;
+   /* batches that wrote to the plugin, the UI resyncs when it moves */
+   uint32_t batch_writes;
+   /* UI commands taken from the queue, a knob or control with a later
+    * one of the UI still queued is left out of the resync */
+   uint64_t commands;
+   /* burst_idle .. burst_done, and the captures handed out so far */
+   uint32_t burst_state;
+   uint32_t shots;
+   /* profile samples still to be output, 0 when none runs */
+   uint32_t profile_left;
+   /* profiles that stopped after moving the output, the UI takes the
+    * knob from knobs[] once per profile, not per sample */
+   uint32_t profile_ends;
+   ps_reg_stats_t reg;
+   ps_fault_stats_t fault;
+} ps_status_t;
+
+/* commands from the control API, applied as one unit */
+typedef struct ps_batch {
+   uint32_t client;
+   uint32_t sequence;
+   uint32_t n;
+   ps_command_t commands[PS_BATCH_MAX];
+} ps_batch_t;
+
+typedef struct ps_completion {
+   uint32_t client;
+   uint32_t sequence;
+   /* commands of the batch that failed */
+   uint32_t errors;
+   /* CLOCK_MONOTONIC [ns] once the last write returned, 0 if none */
+   uint64_t write_ns;
+   ps_status_t status;
+} ps_completion_t;
+
+/* window of a burst capture, values holds scans * n volts scan after scan */
+typedef struct ps_capture {
+   uint32_t shot;
+   uint32_t n;
+   uint32_t channels[PS_BURST_CHANNELS_MAX];
+   double scan_rate;
+   uint32_t scans;
+   /* index of the trigger scan */
+   uint32_t trigger;
+   double *values;
+} ps_capture_t;
+
+typedef struct ps_control {
+   ps_handler_t handler;
+   char plugin_file[256];
+   char device[256];
+   char options[256];
+   /* further attempts and the pause before each when open() fails */
+   uint32_t open_retries;
+   double open_retry_ms;
+   /* cpu the control thread is pinned to, -1 for none */
+   int cpu;
+   /* settings, fixed once the thread runs */
+   uint32_t leds_n;
+   double v_program_max;
+   double v_program_min;
+   double scan_rate;
+   double poll_rate;
+   bool scan_running;
+   /* burst capture, off without channels, trigger on enable unless edge */
+   uint32_t burst_n;
+   uint32_t burst_channels[PS_BURST_CHANNELS_MAX];
+   double burst_rate;
+   uint32_t burst_pre;
+   uint32_t burst_post;
+   bool burst_edge;
+   double burst_level;
+   bool burst_armed;
+   /* output profile, off without points, runs on the knob 0 channel */
+   ps_profile_t profile;
+   int profile_channel;
+   bool profile_running;
+   /* closed loop on the voltage monitor, monitor is reg_index of the
+    * status scan, trims the knob 0 channel */
+   ps_regulator_t reg;
+   uint32_t reg_index;
+   int reg_output;
+   double reg_scale;
+   bool reg_active;
+   /* statistics of the window in progress */
+   uint32_t reg_loops;
+   uint32_t reg_active_loops;
+   uint32_t reg_overruns;
+   double reg_error2;
+   double reg_error_max;
+   double reg_late_sum;
+   double reg_late_max;
+   double reg_run_max;
+   /* automatic inhibit, off without leds, checked at fault_rate */
+   uint32_t fault_mask;
+   double fault_rate;
+   double fault_budget_us;
+   int fault_channel;
+   /* scan classification taken by the checks, handed to the next poll */
+   uint32_t fault_seen;
+   int fault_scans;
+   uint64_t fault_last_ns;
+   /* control thread */
+   pthread_t thread;
+   bool thread_running;
+   atomic_bool stop;
+   sem_t wake;
+   /* UI -> control, single producer single consumer ring */
+   ps_command_t commands[PS_COMMANDS_N];
+   atomic_uint cmd_head;
+   atomic_uint cmd_tail;
+   /* API -> control and back, one single producer single consumer
+    * ring each way, eventfd tells the API side about completions */
+   ps_batch_t batches[PS_BATCHES_N];
+   atomic_uint batch_head;
+   atomic_uint batch_tail;
+   ps_completion_t completions[PS_BATCHES_N];
+   atomic_uint done_head;
+   atomic_uint done_tail;
+   int done_fd;
+   /* control -> UI, snapshot guarded by a sequence counter */
+   atomic_uint status_seq;
+   ps_status_t status;
+   /* private copy of the control thread */
+   ps_status_t work;
+   /* flight recorder, written by the control thread only */
+   ps_recorder_t rec;
+   /* shared memory metrics, counters and histograms of the control
+    * thread, the UI adds its own */
+   ps_metrics_t metrics;
+   /* control -> consumer, one capture at a time, the next burst is armed
+    * once the consumer is done with it */
+   ps_capture_t capture;
+   atomic_bool capture_full;
+} ps_control_t;
+
+/* functions */
+
+bool ctl_init(ps_control_t *ctl, ALLEGRO_CONFIG *cfg);
+bool ctl_start(ps_control_t *ctl, uint32_t leds_n,
+               double v_program_max, double v_program_min);
+void ctl_stop(ps_control_t *ctl);
+bool ctl_command(ps_control_t *ctl, uint32_t type, uint32_t index, double value);
+void ctl_status(ps_control_t *ctl, ps_status_t *status);
+bool ctl_batch(ps_control_t *ctl, ps_batch_t *batch);
+bool ctl_completion(ps_control_t *ctl, ps_completion_t *completion);
+ps_capture_t *ctl_capture(ps_control_t *ctl);
+void ctl_capture_done(ps_control_t *ctl);
+
+#endif /* __POWER_SUPPLY_CTL_H */
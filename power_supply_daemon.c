@@ -0,0 +1,392 @@
+/*
+ * Headless controller
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* ps_daemon runs the same control thread as ps_prog on machines without
+ * a display. Allegro is used for its configuration reader only, which
+ * works without al_init(), so no display, font, primitives or event
+ * system gets set up. With nothing to draw the status is polled at the
+ * rate of the [daemon] section instead of the plugin one. Setpoint and
+ * controls are driven through the control API, see power_supply_api.h.
+ * Led changes are reported on stdout, SIGINT or SIGTERM stop it.
+ * Several supplies take one configuration file each, every one of them
+ * gets its own plugin context and control thread.
+ *
+ *    ./ps_daemon [configuration file ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "io_plugin.h"
+#include "power_supply_rec.h"
+#include "power_supply_profile.h"
+#include "power_supply_reg.h"
+#include "power_supply_metrics.h"
+#include "power_supply_ctl.h"
+#include "power_supply_api.h"
+#include "power_supply_burst.h"
+#include "power_supply_daemon.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define CFG_FILE "data/power_supply.cfg"
+
+#define DAEMON_POLL_RATE 1000
+/* how often the published status is looked at for the log */
+#define REPORT_PERIOD_MS 100
+
+static bool read_daemon_config(ALLEGRO_CONFIG *cfg, char *section,
+                               char *key, double *value, bool optional);
+static bool init_daemon_config(ps_daemon_t *daemon);
+static void report_status(ps_daemon_t *daemon, ps_status_t *status);
+static void report_burst(ps_daemon_t *daemon);
+static void report_regulation(ps_daemon_t *daemon, ps_reg_stats_t *stats);
+static void report_fault(ps_daemon_t *daemon, ps_fault_stats_t *stats);
+static void run_daemon(ps_daemon_t *daemons, uint32_t n, sigset_t *signals);
+
+/* same order as the leds of the UI */
+static const char *led_names[] = {
+   "overload",
+   "thermal_overload",
+   "interlock",
+   "overvoltage",
+   "end_of_charge",
+   "inhibit",
+};
+#define LED_NAMES_N sizeof(led_names)/sizeof(led_names[0])
+
+static ps_daemon_t ps_daemons[PS_SUPPLIES_MAX];
+
+static bool read_daemon_config(ALLEGRO_CONFIG *cfg, char *section,
+                               char *key, double *value, bool optional)
+{
+   const char *str;
+   double d_value;
+
+   str = al_get_config_value(cfg, section, key);
+   if (str == NULL) {
+      if (optional == true)
+         return true;
+      fprintf(stderr, "failed to read key[%s] in section[%s]!\n", key, section);
+      return false;
+   }
+
+   errno = 0;
+   d_value = strtod(str, NULL);
+   if (errno == ERANGE) {
+      fprintf(stderr, "failed to convert %s value from section[%s]!\n", key, section);
+      return false;
+   }
+   *value = d_value;
+
+   return true;
+}
+
+static bool init_daemon_config(ps_daemon_t *daemon)
+{
+   ALLEGRO_CONFIG *cfg = daemon->cfg;
+   double value;
+   bool rc;
+
+   rc = read_daemon_config(cfg, "power_supply", "leds", &value, false);
+   if (rc == false)
+      return false;
+   if ((value < 0) || (value > 31)) {
+      fprintf(stderr, "leds[%g] out of range!\n", value);
+      return false;
+   }
+   daemon->leds_n = value;
+
+   rc = read_daemon_config(cfg, "power_supply", "v_program_max",
+                           &daemon->v_program_max, false);
+   if (rc == false)
+      return false;
+
+   rc = read_daemon_config(cfg, "power_supply", "v_program_min",
+                           &daemon->v_program_min, false);
+   if (rc == false)
+      return false;
+
+   rc = read_daemon_config(cfg, "power_supply", "voltage_full_output",
+                           &daemon->voltage_full_output, false);
+   if (rc == false)
+      return false;
+
+   rc = read_daemon_config(cfg, "power_supply", "knobs", &value, false);
+   if (rc == false)
+      return false;
+   daemon->knobs_n = (value > 0) ? value : 0;
+
+   /* nothing waits for frames here, poll as fast as configured */
+   value = DAEMON_POLL_RATE;
+   rc = read_daemon_config(cfg, "daemon", "poll_rate", &value, true);
+   if (rc == false)
+      return false;
+   if (value <= 0) {
+      fprintf(stderr, "poll_rate[%g] out of range!\n", value);
+      return false;
+   }
+   daemon->ctl.poll_rate = value;
+
+   return true;
+}
+
+static void report_status(ps_daemon_t *daemon, ps_status_t *status)
+{
+   struct timespec ts;
+   uint32_t changed;
+   int i = 0;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+
+   changed = status->leds ^ daemon->reported.leds;
+   if (daemon->reported.polls == 0)
+      changed = (1 << daemon->leds_n) - 1;
+
+   for (i = 0; i < daemon->leds_n; i++) {
+      if ((changed & (1 << i)) == 0)
+         continue;
+      if (i < LED_NAMES_N)
+         printf("[%ld.%03ld] %s%s %s\n", (long)ts.tv_sec, ts.tv_nsec / 1000000,
+                daemon->label, led_names[i], (status->leds & (1 << i)) ? "on" : "off");
+      else
+         printf("[%ld.%03ld] %sled[%d] %s\n", (long)ts.tv_sec, ts.tv_nsec / 1000000,
+                daemon->label, i, (status->leds & (1 << i)) ? "on" : "off");
+   }
+
+   if (status->errors != daemon->reported.errors)
+      printf("[%ld.%03ld] %serrors %u\n", (long)ts.tv_sec, ts.tv_nsec / 1000000,
+             daemon->label, status->errors);
+
+   fflush(stdout);
+   memcpy(&daemon->reported, status, sizeof(ps_status_t));
+}
+
+/* burst windows are measured and exported here, off the control thread */
+static void report_burst(ps_daemon_t *daemon)
+{
+   ps_capture_t *capture;
+
+   capture = ctl_capture(&daemon->ctl);
+   if (capture == NULL)
+      return;
+
+   if (burst_process(&daemon->burst, capture) == false)
+      fprintf(stderr, "failed to export burst capture!\n");
+   ctl_capture_done(&daemon->ctl);
+
+   printf("%s%s\n", daemon->label, daemon->burst.summary);
+   fflush(stdout);
+}
+
+/* the loop works in program volts, the log shows output volts */
+static void report_regulation(ps_daemon_t *daemon, ps_reg_stats_t *stats)
+{
+   double scale = daemon->voltage_full_output / daemon->v_program_max;
+   struct timespec ts;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   printf("[%ld.%03ld] %sregulation %u/%u loops, error rms %.2f V max %.2f V, "
+          "late mean %.1f us max %.1f us, run max %.1f us, overruns %u\n",
+          (long)ts.tv_sec, ts.tv_nsec / 1000000, daemon->label, stats->active, stats->loops,
+          stats->error_rms * scale, stats->error_max * scale, stats->late_mean_us,
+          stats->late_max_us, stats->run_max_us, stats->overruns);
+   fflush(stdout);
+}
+
+static void report_fault(ps_daemon_t *daemon, ps_fault_stats_t *stats)
+{
+   struct timespec ts;
+   int i = 0;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   printf("[%ld.%03ld] %sautomatic inhibit on", (long)ts.tv_sec, ts.tv_nsec / 1000000,
+          daemon->label);
+   for (i = 0; i < daemon->leds_n; i++) {
+      if ((stats->leds & (1 << i)) == 0)
+         continue;
+      if (i < LED_NAMES_N)
+         printf(" %s", led_names[i]);
+      else
+         printf(" led[%d]", i);
+   }
+   printf(", within %.1f us of the sample (max %.1f us), check late max %.1f us, "
+          "overruns %u\n", stats->latency_us, stats->latency_max_us,
+          stats->late_max_us, stats->overruns);
+   fflush(stdout);
+}
+
+/* the control threads do the work, this one only reports and waits */
+static void run_daemon(ps_daemon_t *daemons, uint32_t n, sigset_t *signals)
+{
+   struct timespec timeout;
+   ps_daemon_t *daemon;
+   ps_status_t status;
+   uint32_t i;
+   int sig;
+
+   timeout.tv_sec = REPORT_PERIOD_MS / 1000;
+   timeout.tv_nsec = (REPORT_PERIOD_MS % 1000) * 1000000L;
+
+   for (;;) {
+      sig = sigtimedwait(signals, NULL, &timeout);
+      if (sig > 0) {
+#ifdef DEBUG
+         printf("signal[%d]\n", sig);
+#endif
+         return;
+      }
+      if ((sig == -1) && (errno != EAGAIN) && (errno != EINTR)) {
+         perror("sigtimedwait");
+         return;
+      }
+
+      for (i = 0; i < n; i++) {
+         daemon = &daemons[i];
+         report_burst(daemon);
+
+         ctl_status(&daemon->ctl, &status);
+         /* nothing to report before the first poll */
+         if (status.polls == 0)
+            continue;
+         if (status.fault.trips != daemon->reported.fault.trips) {
+            report_fault(daemon, &status.fault);
+            daemon->reported.fault = status.fault;
+         }
+         if (status.reg.windows != daemon->reported.reg.windows) {
+            report_regulation(daemon, &status.reg);
+            daemon->reported.reg = status.reg;
+         }
+         if ((daemon->reported.polls == 0) ||
+             (status.leds != daemon->reported.leds) ||
+             (status.errors != daemon->reported.errors))
+            report_status(daemon, &status);
+      }
+   }
+}
+
+int main(int argc, char **argv)
+{
+   ps_daemon_t *daemon;
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   struct timespec start, end;
+   ps_status_t status;
+   sigset_t signals;
+   uint32_t n = 1, i;
+   bool rc = false;
+
+   /* one configuration file per supply */
+   if (argc > 1)
+      n = argc - 1;
+   if (n > PS_SUPPLIES_MAX) {
+      fprintf(stderr, "at most %d supplies!\n", PS_SUPPLIES_MAX);
+      return EXIT_FAILURE;
+   }
+
+   for (i = 0; i < n; i++) {
+      daemon = &ps_daemons[i];
+      /* log lines tell the supplies apart once there are several */
+      if (n > 1)
+         snprintf(daemon->label, sizeof(daemon->label), "ps%u ", i);
+
+      daemon->cfg = al_load_config_file((argc > 1) ? argv[i + 1] : CFG_FILE);
+      if (daemon->cfg == NULL) {
+         fprintf(stderr, "failed to load configuration file[%s]!\n",
+                 (argc > 1) ? argv[i + 1] : CFG_FILE);
+         return EXIT_FAILURE;
+      }
+
+      /* loads the plugin, device is opened and outputs set low */
+      rc = ctl_init(&daemon->ctl, daemon->cfg);
+      if (rc == false)
+         return EXIT_FAILURE;
+      /* a core per supply unless the configuration pins it */
+      if ((n > 1) && (daemon->ctl.cpu < 0) && (cpus > 0))
+         daemon->ctl.cpu = i % cpus;
+
+      rc = init_daemon_config(daemon);
+      if (rc == false)
+         return EXIT_FAILURE;
+
+      rc = api_init(&daemon->api, daemon->cfg);
+      if (rc == false)
+         return EXIT_FAILURE;
+
+      rc = burst_init(&daemon->burst, daemon->cfg);
+      if (rc == false)
+         return EXIT_FAILURE;
+   }
+
+   /* blocked before the control thread exists so only sigtimedwait sees
+    * them, started in the background they may come in ignored, ignored
+    * signals are dropped even while blocked */
+   signal(SIGINT, SIG_DFL);
+   signal(SIGTERM, SIG_DFL);
+   sigemptyset(&signals);
+   sigaddset(&signals, SIGINT);
+   sigaddset(&signals, SIGTERM);
+   sigprocmask(SIG_BLOCK, &signals, NULL);
+
+   for (i = 0; i < n; i++) {
+      daemon = &ps_daemons[i];
+      rc = ctl_start(&daemon->ctl, daemon->leds_n,
+                     daemon->v_program_max, daemon->v_program_min);
+      if (rc == false)
+         return EXIT_FAILURE;
+
+      rc = api_start(&daemon->api, &daemon->ctl, daemon->knobs_n,
+                     daemon->voltage_full_output, daemon->v_program_max);
+      if (rc == false)
+         return EXIT_FAILURE;
+
+      printf("%s%s opened in %.1f ms, status %s at %g Hz\n", daemon->label,
+             daemon->ctl.handler.plugin->name, daemon->ctl.handler.open_ms,
+             (daemon->ctl.scan_running == true) ? "scan" : "single reads",
+             daemon->ctl.poll_rate);
+   }
+   fflush(stdout);
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   run_daemon(ps_daemons, n, &signals);
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   for (i = 0; i < n; i++) {
+      daemon = &ps_daemons[i];
+      ctl_status(&daemon->ctl, &status);
+      printf("%s%llu status polls, %.0f per second\n", daemon->label,
+             (unsigned long long)status.polls,
+             status.polls / ((end.tv_sec - start.tv_sec) +
+                             (end.tv_nsec - start.tv_nsec) / 1e9));
+      api_stop(&daemon->api);
+      ctl_stop(&daemon->ctl);
+      al_destroy_config(daemon->cfg);
+   }
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+/*
+ * Header file for the headless controller
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_DAEMON_H
+#define __POWER_SUPPLY_DAEMON_H
+
+/* types */
+
+typedef struct ps_daemon {
+   ALLEGRO_CONFIG *cfg;
+   /* put in front of log lines when there are several supplies */
+   char label[16];
+   uint32_t leds_n;
+   double v_program_max;
+   double v_program_min;
+   double voltage_full_output;
+   uint32_t knobs_n;
+   /* last state reported on stdout */
+   ps_status_t reported;
+   ps_burst_t burst;
+   ps_control_t ctl;
+   ps_api_t api;
+} ps_daemon_t;
+
+#endif /* __POWER_SUPPLY_DAEMON_H */
@@ -21,8 +21,11 @@
 #include <math.h>
 #include <stddef.h>
 #include <string.h>
-#include <dlfcn.h>
 #include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/inotify.h>
 
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_ttf.h>
@@ -30,1195 +33,773 @@
 #include <allegro5/allegro_color.h>
  
 #include "types.h"
+#include "io_plugin.h"
+#include "power_supply_rec.h"
+#include "power_supply_profile.h"
+#include "power_supply_reg.h"
+#include "power_supply_metrics.h"
+#include "power_supply_ctl.h"
+#include "power_supply_api.h"
+#include "power_supply_burst.h"
+#include "power_supply_journal.h"
+#include "power_supply_trace.h"
 #include "power_supply_gfx.h"
+#include "power_supply_ui.h"
 
 /* enable for debugging */
 #undef DEBUG
 
-#define DISPLAY_X 640
-#define DISPLAY_Y 480
-
-#define LINE_THIKNESS 2.0f
-
-#define FONT_SIZE_12 12
-#define FONT_SIZE_24 24
-
-#define START_ANGLE 2*ALLEGRO_PI/3
-#define COUNTER_CW_LIMIT 2*ALLEGRO_PI/3
-#define CW_LIMIT 7*ALLEGRO_PI/3
-
-#define VOLTAGE_UPPER_THRESHOLD 0.7f
-#define VOLTAGE_LOWER_THRESHOLD 0.2f
-
-#define INPUT_CHANNEL_SHIFT 8
-
-#define CFG_FILE "data/power_supply.cfg"
-
-static double convert_to_ps_voltage(power_supply_t *ps, double voltage);
-static bool load_io_plugin(power_supply_t *ps);
-static bool read_ale_config(ALLEGRO_CONFIG *cfg, char *section,
-                            char *key, char *value, uint32_t len);
-static void draw_circle(led_t *led);
-static void draw_filled_circle(led_t *leds, ALLEGRO_COLOR color);
-static void draw_knob(knob_t *knob);
-static void draw_rectangle(control_t *controls);
-static void draw_filled_rectangle(control_t *controls, ALLEGRO_COLOR color);
-static bool init_allegro(void);
-static bool init_fonts(void *obj, uint32_t obj_size,
-                       uint32_t n_elem, unsigned short font_size);
-static void init_colors(void *obj, uint32_t obj_size,
-                        uint32_t n_elem);
-static bool init_plugin_file(ALLEGRO_CONFIG *cfg);
-static bool init_ps_config(power_supply_t *ps);
-static bool init_title_gfx(ALLEGRO_CONFIG *cfg);
-static bool init_leds_gfx(power_supply_t *ps);
-static bool init_knobs_gfx(power_supply_t *ps);
-static bool init_controls_gfx(power_supply_t *ps);
-static bool init_title(ALLEGRO_CONFIG *cfg);
-static bool init_leds(power_supply_t *ps);
-static bool init_knobs(power_supply_t *ps);
-static bool init_controls(power_supply_t *ps);
-static void draw_display(power_supply_t *ps);
-static bool check_button(power_supply_t *ps, ALLEGRO_EVENT *event, int *button);
-static bool check_knob(power_supply_t *ps, ALLEGRO_EVENT *event, int *knob);
-static void check_leds(power_supply_t *ps);
-static void process_event_mouse_axes(power_supply_t *ps, ALLEGRO_EVENT *event);
-static void process_event_mouse_button_up(power_supply_t *ps, ALLEGRO_EVENT *event);
+/* a status poll is due within a few ms of the control thread start */
+#define FIRST_STATUS_TIMEOUT 1.0
+
+static void check_burst(power_supply_t *ps);
 static void process_event_timer(power_supply_t *ps, ALLEGRO_EVENT *event);
-static void process_events(power_supply_t *ps, ALLEGRO_DISPLAY *display);
-static bool init_elements(power_supply_t *ps);
+static power_supply_t *event_supply(power_supply_t **supplies, uint32_t n,
+                                    ALLEGRO_EVENT *event);
+static void process_events(power_supply_t **supplies, uint32_t n,
+                           ALLEGRO_DISPLAY *display);
+static bool init_journal(power_supply_t *ps);
+static bool start_journal(power_supply_t *ps);
 static bool save_voltage_setting(power_supply_t *ps);
-static bool load_config_file(power_supply_t *ps);
-static power_supply_t *allocate_main_object();
-
-/* title text */
-
-static title_t title[] = {
-   {
-      .font = NULL,
-   },
+static double startup_ms(startup_t *startup);
+static void *init_device(void *arg);
+static void *init_fonts_all(void *arg);
+static bool wait_first_status(power_supply_t **supplies, uint32_t n);
+static void report_startup(startup_t *startup);
+static bool watch_config(power_supply_t *ps);
+static bool config_section_changed(ALLEGRO_CONFIG *old, ALLEGRO_CONFIG *new,
+                                   const char *section);
+static uint32_t apply_config(power_supply_t *ps, power_supply_t *shadow);
+static void reload_config(power_supply_t *ps);
+static void check_reload(power_supply_t *ps);
+
+/* sections the control side reads at startup only */
+static const char *restart_sections[] = {
+   "plugin", "api", "recorder", "burst", "profile", "regulation", "fault",
+   "journal", "metrics",
 };
-#define TITLE_N sizeof(title)/sizeof(title_t)
-
-static ps_handler_t handler;
-static char plugin_file[256];
-
-static double convert_to_ps_voltage(power_supply_t *ps, double voltage)
-{
-   return ((ps->v_program_max * voltage) / ps->voltage_full_output);
-}
-
-static bool load_io_plugin(power_supply_t *ps)
-{
-   char *error;
-   bool rc;
-
-   rc = init_plugin_file(ps->cfg);
-   if (rc == false)
-      return false;
-
-   handler.handle = dlopen(plugin_file, RTLD_NOW);
-   if (!handler.handle) {
-      fprintf(stderr, "problem loading io handler plugin: %s\n", dlerror());
-      return false;
-   }
-
-   handler.analog_channel_input = dlsym(handler.handle, "analog_channel_input");
-   if ((error = dlerror()) != NULL)  {
-      fprintf(stderr, "dlsym problem: %s\n", error);
-      return false;
-   }
-   handler.digital_channel_output_high = dlsym(handler.handle, "digital_channel_output_high");
-   if ((error = dlerror()) != NULL)  {
-      fprintf(stderr, "dlsym problem: %s\n", error);
-      return false;
-   }
-   handler.digital_channel_output_low = dlsym(handler.handle, "digital_channel_output_low");
-   if ((error = dlerror()) != NULL)  {
-      fprintf(stderr, "dlsym problem: %s\n", error);
-      return false;
-   }
-   handler.analog_channel_output = dlsym(handler.handle, "analog_channel_output");
-   if ((error = dlerror()) != NULL)  {
-      fprintf(stderr, "dlsym problem: %s\n", error);
-      return false;
-   }
-   handler.convert_button_to_channel = dlsym(handler.handle, "convert_button_to_channel");
-   if ((error = dlerror()) != NULL)  {
-      fprintf(stderr, "dlsym problem: %s\n", error);
-      return false;
-   }
-   handler.convert_knob_to_channel = dlsym(handler.handle, "convert_knob_to_channel");
-   if ((error = dlerror()) != NULL)  {
-      fprintf(stderr, "dlsym problem: %s\n", error);
-      return false;
-   }
-   handler.io_plugin_initialized = dlsym(handler.handle, "io_plugin_initialized");
-   if ((error = dlerror()) != NULL)  {
-      fprintf(stderr, "dlsym problem: %s\n", error);
-      return false;
-   }
-
-   return true;
-}
-
-static bool read_ale_config(ALLEGRO_CONFIG *cfg, char *section,
-                            char *key, char *value, uint32_t len)
-{
-   const char *str;
-   size_t str_len;
-
-   str = al_get_config_value(cfg, section, key);
-   if (str == NULL) {
-      fprintf(stderr, "failed to read key[%s] in section[%s]!\n", key, section);
-      return false;
-   }
-   str_len = strlen(str);
-   if (str_len > len) {
-      fprintf(stderr, "requested value (key[%s] in section[%s]) too long!\n",
-              key, section);
-      return false;
-   }
-   memset(value, 0, len);
-   memcpy(value, str, str_len);
-
-   return true;
-}
-
-static void draw_circle(led_t *led)
-{
-   ALLEGRO_COLOR color = led->gfx_color;
-   float text_width;
-   float text_x, text_y;
-
-   al_draw_circle(led->gfx.x, led->gfx.y, led->gfx.r, color, LINE_THIKNESS);
-
-   /* draw text centered bellow the circle */
-   text_width = al_get_text_width(led->font, led->title);
-   text_x = (led->gfx.x - led->gfx.r) + (led->gfx.r - text_width/2);
-   text_y = (led->gfx.y + led->gfx.r) + 5/100*led->gfx.r;
-   al_draw_textf(led->font, color, text_x, text_y, 0, "%s", led->title);
-}
-
-static void draw_filled_circle(led_t *led, ALLEGRO_COLOR color)
-{
-   al_draw_filled_circle(led->gfx.x, led->gfx.y, led->gfx.r, color);
-}
-
-static void draw_knob(knob_t *knob)
-{
-   ALLEGRO_COLOR color = knob->gfx_color;
-   circle_t gfx = knob->gfx;
-   float text_width;
-   float text_x, text_y;
-   float knob_r, knob_x, knob_y;
-
-   al_draw_circle(gfx.x, gfx.y, gfx.r, color, LINE_THIKNESS);
-   knob_r = knob->knob_r * gfx.r;
-   knob_x = knob_r * cosf(knob->angle) + gfx.x;
-   knob_y = knob_r * sinf(knob->angle) + gfx.y;
-   al_draw_circle(knob_x, knob_y, 4, color, LINE_THIKNESS);
-
-   /* draw text centered bellow the outer circle */
-   text_width = al_get_text_width(knob->font, knob->title);
-   text_x = (gfx.x - gfx.r) + (gfx.r - text_width/2);
-   text_y = (gfx.y + gfx.r) + 5/100*gfx.r;
-   al_draw_textf(knob->font, color, text_x, text_y, 0,
-                 "%s %f V", knob->title, knob->voltage_setting);
-}
-
-static void draw_rectangle(control_t *control)
-{
-   ALLEGRO_COLOR color = control->gfx_color;
-   float text_width, rec_width, rec_height;
-   float text_x, text_y;
-
-   al_draw_rectangle(control->gfx.x1, control->gfx.y1,
-                     control->gfx.x2, control->gfx.y2, color, LINE_THIKNESS);
-
-   /* draw text centered bellow the rectangle */
-   text_width = al_get_text_width(control->font, control->title);
-   rec_width = control->gfx.x2 - control->gfx.x1;
-   rec_height = control->gfx.y2 - control->gfx.y1;
-   text_x = control->gfx.x1 + (rec_width - text_width)/2;
-   text_y = control->gfx.y2 + 5/100*rec_height;
-   al_draw_textf(control->font, color, text_x, text_y, 0, "%s", control->title);
-}
-
-static void draw_filled_rectangle(control_t *controls, ALLEGRO_COLOR color)
-{
-   al_draw_filled_rectangle(controls->gfx.x1, controls->gfx.y1,
-                            controls->gfx.x2, controls->gfx.y2, color);
-}
 
-static bool init_allegro(void)
+/* a complete burst window is measured and exported on the UI thread */
+static void check_burst(power_supply_t *ps)
 {
-   bool rc = false;
-
-   if (!al_init()) {
-      fprintf(stderr, "failed to initialize allegro!\n");
-      return false;
-   }
- 
-   rc = al_install_mouse();
-   if (rc == false) {
-      fprintf(stderr, "failed to install mouse!\n");
-      return false;
-   }
- 
-   /* circles, rectangles, arcs ... */
-   rc = al_init_primitives_addon();
-   if (rc == false) {
-      fprintf(stderr, "failed to init primitives addon!\n");
-      return false;
-   }
-
-   /* font add-on is needed for ttf add-on */
-   al_init_font_addon();
-   al_init_ttf_addon();
- 
-   return true;
-}
+   ps_capture_t *capture;
 
-static bool init_fonts(void *obj, uint32_t obj_size,
-                       uint32_t n_elem, unsigned short font_size)
-{
-   ALLEGRO_FONT **font;
-   const char *font_file = "data/DejaVuSans.ttf";
-   uint32_t i = 0;
-
-   for (i = 0; i < n_elem; i++) {
-      font = obj;
-      *font = al_load_font(font_file, font_size, 0);
-      if (*font == NULL) {
-         fprintf(stderr, "failed to load title font size[%d]!\n", font_size);
-         return false; 
-      }
-      obj += obj_size;
-   }
+   capture = ctl_capture(&ps->ctl);
+   if (capture == NULL)
+      return;
 
-   return true;
+   if (burst_process(&ps->burst, capture) == false)
+      fprintf(stderr, "failed to export burst capture!\n");
+   ctl_capture_done(&ps->ctl);
+   ps->burst_dirty = true;
 }
 
-static void init_colors(void *obj, uint32_t obj_size,
-                        uint32_t n_elem)
+static void process_event_timer(power_supply_t *ps, ALLEGRO_EVENT *event)
 {
-   ALLEGRO_COLOR *color;
-   uint32_t i = 0;
-
-   for (i = 0; i < n_elem; i++) {
-      color = obj;
-      *color = al_map_rgb(32, 92, 46); /* green */
-      obj += obj_size;
-   }
+   TRACE_BEGIN(trace_event_timer, 0);
+   /* whatever the interval held back */
+   send_knobs(ps);
+   TRACE_BEGIN(trace_check_leds, 0);
+   check_leds(ps);
+   TRACE_END(trace_check_leds, 0);
+   check_burst(ps);
+   TRACE_END(trace_event_timer, 0);
 }
 
-static bool init_plugin_file(ALLEGRO_CONFIG *cfg)
+/* mouse events go to the supply under the pointer, in tile coordinates */
+static power_supply_t *event_supply(power_supply_t **supplies, uint32_t n,
+                                    ALLEGRO_EVENT *event)
 {
-   bool rc;
-   char value[256];
+   uint32_t i;
 
-   rc = read_ale_config(cfg, "plugin", "file", &value[0], 255);
-   if (rc == false) {
-      fprintf(stderr, "failed to read file value from section[plugin]!\n");
-      return false;
-   }
-   memcpy(plugin_file, value, sizeof(value));
+   if (event->mouse.x < 0)
+      return NULL;
+   i = event->mouse.x / DISPLAY_X;
+   if (i >= n)
+      return NULL;
+   event->mouse.x -= supplies[i]->x0;
 
-   return true;
+   return supplies[i];
 }
 
-static bool init_ps_config(power_supply_t *ps)
+static void process_events(power_supply_t **supplies, uint32_t n,
+                           ALLEGRO_DISPLAY *display)
 {
-   ALLEGRO_CONFIG *cfg = ps->cfg;
-   bool rc;
-   char value[256];
-   uint32_t l_value;
-
-   rc = read_ale_config(cfg, "power_supply", "voltage_full_output", &value[0], 255);
-   if (rc == false) {
-      fprintf(stderr, "failed to read configuration for voltage_full_output!\n");
-      return false;
-   }
-   l_value = strtol(value, NULL, 10);
-   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
-      fprintf(stderr, "failed to convert voltage_full_output value from section[power_supply]!\n");
-      return false;
-   }
-   ps->voltage_full_output = l_value;
-
-   memset(&value[0], 0, 255);
-   rc = read_ale_config(cfg, "power_supply", "v_program_max", &value[0], 255);
-   if (rc == false) {
-      fprintf(stderr, "failed to read configuration for v_program_max!\n");
-      return false;
-   }
-   l_value = strtol(value, NULL, 10);
-   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
-      fprintf(stderr, "failed to convert v_program_max value from section[power_supply]!\n");
-      return false;
-   }
-   ps->v_program_max = l_value;
-
-   memset(&value[0], 0, 255);
-   rc = read_ale_config(cfg, "power_supply", "v_program_min", &value[0], 255);
-   if (rc == false) {
-      fprintf(stderr, "failed to read configuration for v_program_min!\n");
-      return false;
-   }
-   l_value = strtol(value, NULL, 10);
-   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
-      fprintf(stderr, "failed to convert v_program_min value from section[power_supply]!\n");
-      return false;
-   }
-   ps->v_program_min = l_value;
-
-   memset(&value[0], 0, 255);
-   rc = read_ale_config(cfg, "power_supply", "leds", &value[0], 255);
-   if (rc == false) {
-      fprintf(stderr, "failed to read configuration for number of leds!\n");
-      return false;
-   }
-   l_value = strtol(value, NULL, 10);
-   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
-      fprintf(stderr, "failed to convert leds value from section[power_supply]!\n");
-      return false;
-   }
-   ps->LEDS_N = l_value;
-   ps->leds = malloc(ps->LEDS_N * sizeof(led_t));
-   if (ps->leds == NULL) {
-      fprintf(stderr, "failed to allocate memory for leds!\n");
-      return false;
-   }
-   memset(ps->leds, ps->LEDS_N * sizeof(led_t), 0);
-
-   memset(&value[0], 0, 255);
-   rc = read_ale_config(cfg, "power_supply", "knobs", &value[0], 255);
-   if (rc == false) {
-      fprintf(stderr, "failed to read configuration for number of knobs!\n");
-      return false;
-   }
-   l_value = strtol(value, NULL, 10);
-   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
-      fprintf(stderr, "failed to convert knobs value from section[power_supply]!\n");
-      return false;
-   }
-   ps->KNOBS_N = l_value;
-   ps->knobs = malloc(ps->KNOBS_N * sizeof(knob_t));
-   if (ps->knobs == NULL) {
-      fprintf(stderr, "failed to allocate memory for knobs!\n");
-      return false;
-   }
-   memset(ps->knobs, ps->KNOBS_N * sizeof(knob_t), 0);
+   ALLEGRO_EVENT_QUEUE *queue;
+   ALLEGRO_EVENT event;
+   ALLEGRO_TIMER *timer;
+   power_supply_t *ps;
+   uint32_t i, events = 0;
+   bool metrics = false;
 
-   memset(&value[0], 0, 255);
-   rc = read_ale_config(cfg, "power_supply", "controls", &value[0], 255);
-   if (rc == false) {
-      fprintf(stderr, "failed to read configuration for number of controls!\n");
-      return false;
-   }
-   l_value = strtol(value, NULL, 10);
-   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
-      fprintf(stderr, "failed to convert controls value from section[power_supply]!\n");
-      return false;
-   }
-   ps->CONTROLS_N = l_value;
-   ps->controls = malloc(ps->CONTROLS_N * sizeof(control_t));
-   if (ps->controls == NULL) {
-      fprintf(stderr, "failed to allocate memory for controls!\n");
-      return false;
+   for (i = 0; i < n; i++) {
+      if (supplies[i]->ctl.metrics.region != NULL)
+         metrics = true;
    }
-   memset(ps->controls, ps->CONTROLS_N * sizeof(control_t), 0);
 
-   return rc;
-}
-
-static bool init_title_gfx(ALLEGRO_CONFIG *cfg)
-{
-   bool rc;
-   char value[256];
-
-   rc = read_ale_config(cfg, "power_supply", "title", &value[0], 255);
-   if (rc == false) {
-      fprintf(stderr, "failed to read configuration for title!\n");
-      return false;
+   timer = al_create_timer(1.0 / 30);
+   if (timer == NULL) {
+      fprintf(stderr, "al_create_timer failed\n");
+      return;
    }
-   memcpy(&title[0].title, value, strlen(value));
-
-   return rc;
-}
-
-static bool init_leds_gfx(power_supply_t *ps)
-{
-   ALLEGRO_CONFIG *cfg = ps->cfg;
-   int i;
-   bool rc;
-   char section[256] = {0};
-   char value[256];
-   float f_value;
+   queue = al_create_event_queue();
+   al_register_event_source(queue, al_get_mouse_event_source());
+   al_register_event_source(queue, al_get_display_event_source(display));
+   al_register_event_source(queue, al_get_timer_event_source(timer));
+   al_start_timer(timer);
 
-   for (i = 0; i < ps->LEDS_N; i++) {
-      switch(i) {
-      case overload:
-         memcpy(section, "overload_led", sizeof("overload_led"));
+   while (true) {
+      al_wait_for_event(queue, &event);
+      switch(event.type) {
+      case ALLEGRO_EVENT_DISPLAY_CLOSE:
+          return;
+      case ALLEGRO_EVENT_DISPLAY_EXPOSE:
+         supplies[0]->redraw_all = true;
          break;
-      case thermal_overload:
-         memcpy(section, "thermal_overload_led", sizeof("thermal_overload_led"));
+      case ALLEGRO_EVENT_DISPLAY_HALT_DRAWING:
+         for (i = 0; i < n; i++)
+            supplies[i]->drawing_halted = true;
+         al_acknowledge_drawing_halt(display);
          break;
-      case interlock:
-         memcpy(section, "interlock_led", sizeof("interlock_led"));
+      case ALLEGRO_EVENT_DISPLAY_RESUME_DRAWING:
+         al_acknowledge_drawing_resume(display);
+         for (i = 0; i < n; i++)
+            supplies[i]->drawing_halted = false;
+         supplies[0]->redraw_all = true;
          break;
-      case overvoltage:
-         memcpy(section, "overvoltage_led", sizeof("overvoltage_led"));
+      case ALLEGRO_EVENT_DISPLAY_SWITCH_OUT:
+         /* the display is shared, the first configuration decides */
+         if (supplies[0]->suspend_inactive == true) {
+            for (i = 0; i < n; i++)
+               supplies[i]->drawing_halted = true;
+         }
          break;
-      case end_of_charge:
-         memcpy(section, "end_of_charge_led", sizeof("end_of_charge_led"));
+      case ALLEGRO_EVENT_DISPLAY_SWITCH_IN:
+         if (supplies[0]->suspend_inactive == true) {
+            for (i = 0; i < n; i++)
+               supplies[i]->drawing_halted = false;
+            supplies[0]->redraw_all = true;
+         }
          break;
-      case inhibit:
-         memcpy(section, "inhibit_led", sizeof("inhibit_led"));
+      case ALLEGRO_EVENT_MOUSE_AXES:
+         ps = event_supply(supplies, n, &event);
+         if (ps != NULL)
+            process_event_mouse_axes(ps, &event);
+         /* a spinning wheel queues many, write once they are all in */
+         if (al_is_event_queue_empty(queue)) {
+            for (i = 0; i < n; i++)
+               send_knobs(supplies[i]);
+         }
          break;
-      default:
-         fprintf(stderr, "unexpected led switch case!\n");
-         return false;
-      }
-
-      /* read x coordinate */
-      rc = read_ale_config(cfg, section, "x", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read x value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert x value from section[%s]!\n", section);
-         return false;
-      }
-      ps->leds[i].gfx.x = f_value;
-
-      /* read y coordinate */
-      rc = read_ale_config(cfg, section, "y", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read y value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert y value from section[%s]!\n", section);
-         return false;
-      }
-      ps->leds[i].gfx.y = f_value;
-
-      /* read r radius */
-      rc = read_ale_config(cfg, section, "r", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read r value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert r value from section[%s]!\n", section);
-         return false;
-      }
-      ps->leds[i].gfx.r = f_value;
-
-      /* read state */
-      rc = read_ale_config(cfg, section, "state", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
-         return false;
-      }
-      ps->leds[i].state = (!strcmp(value, "on") ? led_on : led_off);
-
-      /* read title */
-      rc = read_ale_config(cfg, section, "title", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
-         return false;
-      }
-      memcpy(&ps->leds[i].title, value, strlen(value));
-   }
-
-   return rc;
-}
-
-static bool init_knobs_gfx(power_supply_t *ps)
-{
-   ALLEGRO_CONFIG *cfg = ps->cfg;
-   int i;
-   bool rc;
-   char section[256] = {0};
-   char value[256];
-   float f_value;
-
-   for (i = 0; i < ps->KNOBS_N; i++) {
-      switch(i) {
-      case output_voltage_selector:
-         memcpy(section, "output_voltage_selector", sizeof("output_voltage_selector"));
+      case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
+#ifdef DEBUG
+         printf("event.type[ALLEGRO_EVENT_MOUSE_BUTTON_DOWN]\n");
+#endif
          break;
-      default:
-         fprintf(stderr, "unexpected knob switch case!\n");
-         return false;
-      }
-
-      /* read x coordinate */
-      rc = read_ale_config(cfg, section, "x", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read x value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert x value from section[%s]!\n", section);
-         return false;
-      }
-      ps->knobs[i].gfx.x = f_value;
-
-      /* read y coordinate */
-      rc = read_ale_config(cfg, section, "y", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read y value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert y value from section[%s]!\n", section);
-         return false;
-      }
-      ps->knobs[i].gfx.y = f_value;
-
-      /* read r radius */
-      rc = read_ale_config(cfg, section, "r", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read r value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert r value from section[%s]!\n", section);
-         return false;
-      }
-      ps->knobs[i].gfx.r = f_value;
-
-      /* read knob radius */
-      rc = read_ale_config(cfg, section, "knob_r", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read knob_r value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert knob_r value from section[%s]!\n", section);
-         return false;
-      }
-      ps->knobs[i].knob_r = f_value;
-
-      /* read angle */
-      rc = read_ale_config(cfg, section, "angle", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read angle value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert angle value from section[%s]!\n", section);
-         return false;
-      }
-      ps->knobs[i].angle = f_value;
-
-      /* read clock_wise limit */
-      rc = read_ale_config(cfg, section, "clock_wise_limit", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read clock_wise_limit value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert clock_wise_limit value from section[%s]!\n", section);
-         return false;
-      }
-      ps->knobs[i].clock_wise_limit = f_value;
-
-      /* read counter_clock_wise limit */
-      rc = read_ale_config(cfg, section, "counter_clock_wise_limit", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read counter_clock_wise_limit value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert counter_clock_wise_limit value from section[%s]!\n", section);
-         return false;
-      }
-      ps->knobs[i].counter_clock_wise_limit = f_value;
-
-      /* read voltage setting */
-      rc = read_ale_config(cfg, section, "voltage_setting", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read voltage_setting value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert voltage_setting value from section[%s]!\n", section);
-         return false;
-      }
-      ps->knobs[i].voltage_setting = f_value;
-
-      /* read title */
-      rc = read_ale_config(cfg, section, "title", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
-         return false;
-      }
-      memcpy(&ps->knobs[i].title, value, strlen(value));
-   }
-
-   return rc;
-}
-
-static bool init_controls_gfx(power_supply_t *ps)
-{
-   ALLEGRO_CONFIG *cfg = ps->cfg;
-   int i;
-   bool rc;
-   char section[256] = {0};
-   char value[256];
-   float f_value;
-
-   for (i = 0; i < ps->CONTROLS_N; i++) {
-      switch(i) {
-      case enable_power_supply:
-         memcpy(section, "enable_power_supply", sizeof("enable_power_supply"));
+      case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
+         ps = event_supply(supplies, n, &event);
+         if (ps != NULL)
+            process_event_mouse_button_up(ps, &event);
          break;
-      case inhibit_power_supply:
-         memcpy(section, "inhibit_power_supply", sizeof("inhibit_power_supply"));
+      case ALLEGRO_EVENT_MOUSE_WARPED:
+#ifdef DEBUG
+         printf("event.type[ALLEGRO_EVENT_MOUSE_WARPED]\n");
+#endif
          break;
-      case interlock_power_supply:
-         memcpy(section, "interlock_power_supply", sizeof("interlock_power_supply"));
+      case ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY:
+#ifdef DEBUG
+         printf("event.type[ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY]\n");
+#endif
+         break;
+      case ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY:
+#ifdef DEBUG
+         printf("event.type[ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY]\n");
+#endif
+         break;
+      case ALLEGRO_EVENT_TIMER:
+         for (i = 0; i < n; i++) {
+            check_reload(supplies[i]);
+            process_event_timer(supplies[i], &event);
+         }
+         /* does nothing unless something changed */
+         TRACE_BEGIN(trace_draw_display, n);
+         draw_display(supplies, n);
+         TRACE_END(trace_draw_display, n);
          break;
-      default:
-         fprintf(stderr, "unexpected control switch case!\n");
-         return false;
-      }
-
-      /* read x1 coordinate */
-      rc = read_ale_config(cfg, section, "x1", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read x1 value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert x1 value from section[%s]!\n", section);
-         return false;
-      }
-      ps->controls[i].gfx.x1 = f_value;
-
-      /* read y1 coordinate */
-      rc = read_ale_config(cfg, section, "y1", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read y1 value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert y1 value from section[%s]!\n", section);
-         return false;
-      }
-      ps->controls[i].gfx.y1 = f_value;
-
-      /* read x2 coordinate */
-      rc = read_ale_config(cfg, section, "x2", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read x2 value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert x2 value from section[%s]!\n", section);
-         return false;
-      }
-      ps->controls[i].gfx.x2 = f_value;
-
-      /* read y2 coordinate */
-      rc = read_ale_config(cfg, section, "y2", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read y2 value from section[%s]!\n", section);
-         return false;
-      }
-      f_value = strtof(value, NULL);
-      if (errno == ERANGE) {
-         fprintf(stderr, "failed to convert y2 value from section[%s]!\n", section);
-         return false;
-      }
-      ps->controls[i].gfx.y2 = f_value;
-
-      /* read state */
-      rc = read_ale_config(cfg, section, "state", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
-         return false;
       }
-      ps->controls[i].state = (!strcmp(value, "on") ? key_on : key_off);
 
-      /* read title */
-      rc = read_ale_config(cfg, section, "title", &value[0], 255);
-      if (rc == false) {
-         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
-         return false;
+      /* how many events piled up before the queue was drained */
+      events++;
+      if ((metrics == true) && al_is_event_queue_empty(queue)) {
+         for (i = 0; i < n; i++)
+            metrics_hist(&supplies[i]->ctl.metrics, metrics_event_queue, events);
+         events = 0;
       }
-      memcpy(&ps->controls[i].title, value, strlen(value));
    }
-
-   return rc;
 }
 
-static bool init_title(ALLEGRO_CONFIG *cfg)
+/* journal replay comes after the configuration, knobs it has a setting
+ * for and, if asked to, controls take it over
+ */
+static bool init_journal(power_supply_t *ps)
 {
+   ps_journal_t *journal = &ps->journal;
+   knob_t *knob;
+   uint32_t i;
    bool rc;
 
-   rc = init_fonts(&title[0].font, sizeof(title_t), TITLE_N, 24);
-   if (rc == false)
-      return false;
+   rc = journal_open(journal, ps->KNOBS_N, ps->CONTROLS_N);
+   if ((rc == false) || (journal->file[0] == '\0'))
+      return rc;
 
-   rc = init_title_gfx(cfg);
-   if (rc == false)
-      return false;
+   for (i = 0; i < ps->KNOBS_N; i++) {
+      knob = &ps->knobs[i];
+      if ((journal->knobs[i].valid == true) &&
+          (journal->knobs[i].voltage >= 0) &&
+          (journal->knobs[i].voltage <= ps->voltage_full_output)) {
+         knob->angle = journal->knobs[i].angle;
+         knob->voltage_setting = journal->knobs[i].voltage;
+      }
+      /* written out with the controls, see start_journal() */
+      if (journal->restore_controls == true)
+         knob->pending = true;
+      journal_knob(journal, i, knob->angle, knob->voltage_setting);
+   }
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      if ((journal->restore_controls == true) && (journal->controls[i].valid == true))
+         ps->controls[i].state = (journal->controls[i].state == key_on) ? key_on : key_off;
+      journal_control(journal, i, ps->controls[i].state);
+   }
+
+   if (journal->replayed > 0)
+      printf("%s: %u journal records replayed\n", ps->cfg_file, journal->replayed);
 
    return true;
 }
 
-static bool init_leds(power_supply_t *ps)
+/* needs the control thread running, controls taken over from the journal
+ * go out to the card
+ */
+static bool start_journal(power_supply_t *ps)
 {
+   uint32_t i;
    bool rc;
 
-   init_colors(&ps->leds[0].gfx_color, sizeof(led_t), ps->LEDS_N);
-   rc = init_fonts(&ps->leds[0].font, sizeof(led_t), ps->LEDS_N, 12);
-   if (rc == false)
+   rc = journal_start(&ps->journal);
+   if (rc == false) {
+      fprintf(stderr, "failed to start journal[%s]!\n", ps->journal.file);
       return false;
+   }
 
-   rc = init_leds_gfx(ps);
-   if (rc == false)
-      return false;
+   if (ps->journal.restore_controls == false)
+      return true;
+   send_knobs(ps);
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      rc = queue_command(ps, ps_cmd_control, i,
+                         (ps->controls[i].state == key_on) ? 1 : 0,
+                         &ps->controls[i].command);
+      if (rc == false)
+         fprintf(stderr, "output for button[%d] not queued\n", i);
+   }
 
    return true;
 }
 
-static bool init_controls(power_supply_t *ps)
+/* with the journal on the file is left alone, it holds the setting */
+static bool save_voltage_setting(power_supply_t *ps)
 {
+   ALLEGRO_CONFIG *cfg;
+   char tmp[sizeof(ps->cfg_file) + sizeof(".tmp")];
+   char angle[256];
+   char voltage[256];
    bool rc;
 
-   init_colors(&ps->controls[0].gfx_color, sizeof(control_t), ps->CONTROLS_N);
-   rc = init_fonts(&ps->controls[0].font, sizeof(control_t), ps->CONTROLS_N, 12);
-   if (rc == false)
-      return false;
+   if (ps->journal.file[0] != '\0')
+      return true;
 
-   rc = init_controls_gfx(ps);
-   if (rc == false)
+   /* whatever is in the file now, not what was loaded */
+   cfg = al_load_config_file(ps->cfg_file);
+   if (cfg == NULL) {
+      fprintf(stderr, "failed to load %s file!\n", ps->cfg_file);
       return false;
+   }
 
-   return true;
-}
-
-static bool init_knobs(power_supply_t *ps)
-{
-   bool rc;
-
-   init_colors(&ps->knobs[0].gfx_color, sizeof(knob_t), ps->KNOBS_N);
-   rc = init_fonts(&ps->knobs[0].font, sizeof(knob_t), ps->KNOBS_N, 12);
-   if (rc == false)
-      return false;
+   snprintf(angle, sizeof(angle), "%f", ps->knobs[0].angle);
+   al_set_config_value(cfg, "output_voltage_selector", "angle", angle);
+   snprintf(voltage, sizeof(voltage), "%f", ps->knobs[0].voltage_setting);
+   al_set_config_value(cfg, "output_voltage_selector", "voltage_setting", voltage);
 
-   rc = init_knobs_gfx(ps);
-   if (rc == false)
+   /* replaced as a whole, a crash while saving leaves the old one */
+   snprintf(tmp, sizeof(tmp), "%s.tmp", ps->cfg_file);
+   rc = al_save_config_file(tmp, cfg);
+   al_destroy_config(cfg);
+   if ((rc == false) || (rename(tmp, ps->cfg_file) == -1)) {
+      fprintf(stderr, "failed to save %s file!\n", ps->cfg_file);
+      unlink(tmp);
       return false;
+   }
 
    return true;
 }
 
-static void draw_display(power_supply_t *ps)
+static double startup_ms(startup_t *startup)
 {
-   ALLEGRO_COLOR white = al_map_rgb(255, 255, 255);
-   ALLEGRO_COLOR black = al_map_rgb(0, 0, 0);
-   ALLEGRO_COLOR red = al_color_name("red");
-   ALLEGRO_COLOR yellow = al_color_name("yellow");
-   float x = 0;
-   int i = 0;
-
-   al_clear_to_color(black);
-   for (i = 0; i < ps->LEDS_N; i++) {
-      if (ps->leds[i].state == led_off)
-         draw_filled_circle(&ps->leds[i], black);
-      else
-         draw_filled_circle(&ps->leds[i], yellow);
-      draw_circle(&ps->leds[i]);
-   }
-
-   for (i = 0; i < ps->KNOBS_N; i++)
-      draw_knob(&ps->knobs[i]);
-
-   for (i = 0; i < ps->CONTROLS_N; i++) {
-      if (ps->controls[i].state == key_off)
-         draw_filled_rectangle(&ps->controls[i], black);
-      else
-         draw_filled_rectangle(&ps->controls[i], red);
-      draw_rectangle(&ps->controls[i]);
-   }
-
-   x = (DISPLAY_X - al_get_text_width(title[0].font, title[0].title)) / 2;
-   al_draw_textf(title[0].font, white, x, 20, 0, "%s", title[0].title);
-
-   al_flip_display();
+   return (now_ns() - startup->t0_ns) / 1e6;
 }
 
-static bool check_button(power_supply_t *ps, ALLEGRO_EVENT *event, int *button)
+/* plugin load with the device opened and its outputs set low, control API
+ * and burst export, none of it needs more of Allegro than the configuration
+ */
+static void *init_device(void *arg)
 {
-   int i = 0;
+   startup_device_t *device = arg;
+   startup_t *startup = device->startup;
+   power_supply_t *ps = device->ps;
 
-   for (i = 0; i < ps->CONTROLS_N; i++) {
-      if ((ps->controls[i].gfx.x2 >= event->mouse.x && ps->controls[i].gfx.x1 <= event->mouse.x) &&
-          (ps->controls[i].gfx.y2 >= event->mouse.y && ps->controls[i].gfx.y1 <= event->mouse.y)) {
-         *button = i;
-         return true;
-      }
-   }
+   device->begin = startup_ms(startup);
+   device->ok = (ctl_init(&ps->ctl, ps->cfg) == true) &&
+                (api_init(&ps->api, ps->cfg) == true) &&
+                (burst_init(&ps->burst, ps->cfg) == true) &&
+                (journal_init(&ps->journal, ps->cfg) == true);
+   /* a core per supply unless the configuration pins it */
+   if ((startup->n > 1) && (ps->ctl.cpu < 0) && (startup->cpus > 0))
+      ps->ctl.cpu = device->index % startup->cpus;
+   device->end = startup_ms(startup);
 
-   return false;
+   return NULL;
 }
 
-static bool check_knob(power_supply_t *ps, ALLEGRO_EVENT *event, int *knob)
+/* without a display on this thread the fonts come up as memory bitmaps,
+ * main converts them once the display is there */
+static void *init_fonts_all(void *arg)
 {
-   int i = 0;
-   circle_t gfx;
-   float dx, dy;
+   startup_t *startup = arg;
+   uint32_t i;
 
-   for (i = 0; i < ps->KNOBS_N; i++) {
-      gfx = ps->knobs[i].gfx;
-      dx = powf(event->mouse.x - gfx.x, 2);
-      dy = powf(event->mouse.y - gfx.y, 2);
-      if ((dx + dy) <= pow(gfx.r, 2)) {
-         *knob = i;
-         return true;
-      }
-   }
+   startup->begin[phase_fonts] = startup_ms(startup);
+   startup->fonts_ok = true;
+   for (i = 0; (i < startup->n) && (startup->fonts_ok == true); i++)
+      startup->fonts_ok = init_elements(startup->supplies[i]);
+   startup->end[phase_fonts] = startup_ms(startup);
 
-   return false;
+   return NULL;
 }
 
-static void check_leds(power_supply_t *ps)
+/* draws the first frame with leds as the card reports them */
+static bool wait_first_status(power_supply_t **supplies, uint32_t n)
 {
-   int i = 0;
-   double voltage = 0.0f;
-   bool rc;
+   double timeout = al_get_time() + FIRST_STATUS_TIMEOUT;
+   ps_status_t status;
+   uint32_t i;
 
-   for (i = 0; i < ps->LEDS_N; i++) {
-      rc = handler.analog_channel_input(i + INPUT_CHANNEL_SHIFT, &voltage);
-      if (rc == false) {
-         fprintf(stderr, "analog channel input failed\n");
-         return;
+   for (i = 0; i < n; i++) {
+      ctl_status(&supplies[i]->ctl, &status);
+      while (status.polls == 0) {
+         if (al_get_time() > timeout)
+            return false;
+         al_rest(0.0005);
+         ctl_status(&supplies[i]->ctl, &status);
       }
-      if ((voltage < VOLTAGE_UPPER_THRESHOLD) &&
-          (voltage > VOLTAGE_LOWER_THRESHOLD))
-         ps->leds[i].state = led_on;
-      else
-         ps->leds[i].state = led_off;
    }
+
+   for (i = 0; i < n; i++)
+      check_leds(supplies[i]);
+   draw_display(supplies, n);
+
+   return true;
 }
 
-static void process_event_mouse_axes(power_supply_t *ps, ALLEGRO_EVENT *event)
+static void report_startup(startup_t *startup)
 {
-   double voltage;
-   float angle = 0;
-   float angle_delta = 0;
-   int knob = -1;
-   int channel = -1;
-   bool rc = false;
+   static const char *names[PHASES_N] = {
+      "config", "allegro", "fonts", "display", "start",
+   };
+   startup_device_t *device;
+   uint32_t i;
 
-#ifdef DEBUG
-   printf("event type[ALLEGRO_EVENT_MOUSE_AXES]\n");
-   printf("event->mouse.x[%d]\n", event->mouse.x);
-   printf("event->mouse.y[%d]\n", event->mouse.y);
-#endif
-   rc = check_knob(ps, event, &knob);
-   if (rc == true) {
-      angle_delta = ALLEGRO_PI * event->mouse.dz / 256;
-      angle = ps->knobs[knob].angle + angle_delta;
-      if (angle < ps->knobs[knob].counter_clock_wise_limit) {
-         angle = ps->knobs[knob].counter_clock_wise_limit;
-         angle_delta = 0;
-         ps->knobs[knob].voltage_setting = 0;
-      } else if (angle > ps->knobs[knob].clock_wise_limit) {
-         angle = ps->knobs[knob].clock_wise_limit;
-         angle_delta = 0;
-         ps->knobs[knob].voltage_setting = ps->voltage_full_output;
-      }
-
-      ps->knobs[knob].angle = angle;
-      ps->knobs[knob].voltage_setting += ps->voltage_full_output*angle_delta/(CW_LIMIT - COUNTER_CW_LIMIT);
-      if (ps->knobs[knob].voltage_setting < 0)
-         ps->knobs[knob].voltage_setting = 0;
-      if (ps->knobs[knob].voltage_setting > ps->voltage_full_output)
-         ps->knobs[knob].voltage_setting = ps->voltage_full_output;
-      voltage = convert_to_ps_voltage(ps, ps->knobs[knob].voltage_setting);
-#ifdef DEBUG
-      printf("voltage for ale102 [%g]\n", voltage);
-#endif
-      channel = handler.convert_knob_to_channel(knob);
-      if (channel == -1) {
-         fprintf(stderr, "conversion for knob[%d] failed\n", knob);
-         return;
-      }
-      rc = handler.analog_channel_output(channel, voltage, ps->v_program_max, ps->v_program_min);
-      if (rc == false) {
-         fprintf(stderr, "output to pcidas1602/16 analog channel[%d] failed\n",
-                 channel);
-      }
-      draw_display(ps);
+   printf("%-16s %8s %8s\n", "startup [ms]", "begin", "end");
+   printf("%-16s %8.1f %8.1f\n", names[phase_config],
+          startup->begin[phase_config], startup->end[phase_config]);
+   for (i = 0; i < startup->n; i++) {
+      device = &startup->devices[i];
+      printf("ps%u %-12s %8.1f %8.1f  %s open %.1f\n", i, "device", device->begin,
+             device->end, device->ps->ctl.handler.plugin->name,
+             device->ps->ctl.handler.open_ms);
    }
+   for (i = phase_allegro; i < PHASES_N; i++)
+      printf("%-16s %8.1f %8.1f\n", names[i], startup->begin[i], startup->end[i]);
+   printf("%-16s %8s %8.1f\n", "first status", "", startup->first_status);
+   fflush(stdout);
 }
 
-static void process_event_mouse_button_up(power_supply_t *ps, ALLEGRO_EVENT *event)
+/* editors write the file in place or rename a new one over it, the
+ * directory sees both */
+static bool watch_config(power_supply_t *ps)
 {
-   ALLEGRO_COLOR yellow = al_color_name("yellow");
-   ALLEGRO_COLOR green1 = al_map_rgb(75, 105, 47);
+   char dir[256];
+   char *slash;
 
-   int button = -1;
-   int channel = -1;
-   bool rc = false;
+   strcpy(dir, ps->cfg_file);
+   slash = strrchr(dir, '/');
+   if (slash == NULL)
+      strcpy(dir, ".");
+   else if (slash == dir)
+      slash[1] = '\0';
+   else
+      *slash = '\0';
 
-#ifdef DEBUG
-   printf("event type[ALLEGRO_EVENT_MOUSE_BUTTON_UP]\n");
-#endif
-   rc = check_button(ps, event, &button);
-   if (rc == true) {
-#ifdef DEBUG
-      printf("button[%d] state[%d]\n", button, controls[button].state);
-#endif
-      channel = handler.convert_button_to_channel(button);
-      if (channel == -1) {
-         fprintf(stderr, "conversion for button[%d] failed\n", button);
-         return;
-      }
-      if (ps->controls[button].state == key_on) {
-         ps->controls[button].state = key_off;
-         draw_filled_rectangle(&ps->controls[button], yellow);
-         rc = handler.digital_channel_output_low(channel);
-         if (rc == false)
-            fprintf(stderr,
-                    "digital_channel_output_low for channel[%d] failed\n",
-                    channel);
-      } else {
-         ps->controls[button].state = key_on;
-         draw_filled_rectangle(&ps->controls[button], green1);
-         rc = handler.digital_channel_output_high(channel);
-         if (rc == false)
-            fprintf(stderr,
-                    "digital_channel_output_high for channel[%d] failed\n",
-                    channel);
-      }
-      draw_display(ps);
+   ps->reload_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (ps->reload_fd == -1) {
+      perror("inotify_init1");
+      return false;
+   }
+   if (inotify_add_watch(ps->reload_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+      perror("inotify_add_watch");
+      close(ps->reload_fd);
+      ps->reload_fd = -1;
+      return false;
    }
-}
 
-static void process_event_timer(power_supply_t *ps, ALLEGRO_EVENT *event)
-{
-   check_leds(ps);
+   return true;
 }
 
-static void process_events(power_supply_t *ps, ALLEGRO_DISPLAY *display)
+static bool config_section_changed(ALLEGRO_CONFIG *old, ALLEGRO_CONFIG *new,
+                                   const char *section)
 {
-   ALLEGRO_EVENT_QUEUE *queue;
-   ALLEGRO_EVENT event;
-   ALLEGRO_TIMER *timer;
+   ALLEGRO_CONFIG_ENTRY *entry;
+   const char *key, *value;
 
-   timer = al_create_timer(1.0 / 30);
-   if (timer == NULL) {
-      fprintf(stderr, "al_create_timer failed\n");
-      return;
+   for (key = al_get_first_config_entry(new, section, &entry); key != NULL;
+        key = al_get_next_config_entry(&entry)) {
+      value = al_get_config_value(old, section, key);
+      if ((value == NULL) || strcmp(value, al_get_config_value(new, section, key)))
+         return true;
    }
-   queue = al_create_event_queue();
-   al_register_event_source(queue, al_get_mouse_event_source());
-   al_register_event_source(queue, al_get_display_event_source(display));
-   al_register_event_source(queue, al_get_timer_event_source(timer));
-   al_start_timer(timer);
-
-   while (true) {
-      al_wait_for_event(queue, &event);
-      switch(event.type) {
-      case ALLEGRO_EVENT_DISPLAY_CLOSE:
-          return;
-      case ALLEGRO_EVENT_MOUSE_AXES:
-         process_event_mouse_axes(ps, &event);
-         break;
-      case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
-#ifdef DEBUG
-         printf("event.type[ALLEGRO_EVENT_MOUSE_BUTTON_DOWN]\n");
-#endif
-         break;
-      case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
-         process_event_mouse_button_up(ps, &event);
-         break;
-      case ALLEGRO_EVENT_MOUSE_WARPED:
-#ifdef DEBUG
-         printf("event.type[ALLEGRO_EVENT_MOUSE_WARPED]\n");
-#endif
-         break;
-      case ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY:
-#ifdef DEBUG
-         printf("event.type[ALLEGRO_EVENT_MOUSE_ENTER_DISPLAY]\n");
-#endif
-         break;
-      case ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY:
-#ifdef DEBUG
-         printf("event.type[ALLEGRO_EVENT_MOUSE_LEAVE_DISPLAY]\n");
-#endif
-         break;
-      case ALLEGRO_EVENT_TIMER:
-         process_event_timer(ps, &event);
-         draw_display(ps);
-         break;
-      }
+   for (key = al_get_first_config_entry(old, section, &entry); key != NULL;
+        key = al_get_next_config_entry(&entry)) {
+      if (al_get_config_value(new, section, key) == NULL)
+         return true;
    }
+
+   return false;
 }
 
-static bool init_elements(power_supply_t *ps)
+/* takes over what differs from the shadow, led and control states and the
+ * knob setting stay with the running supply, they mirror the outputs */
+static uint32_t apply_config(power_supply_t *ps, power_supply_t *shadow)
 {
-   ALLEGRO_CONFIG* cfg = ps->cfg;
-   bool rc = false;
-
-   rc = init_ps_config(ps);
-   if (rc == false)
-      return false;
-
-#ifdef DEBUG
-   printf("leds[%d]\n", ps->LEDS_N);
-   printf("knobs[%d]\n", ps->KNOBS_N);
-   printf("controls[%d]\n", ps->CONTROLS_N);
-#endif
+   led_t *led, *new_led;
+   knob_t *knob, *new_knob;
+   control_t *control, *new_control;
+   uint32_t changed = 0;
+   int i;
 
-   rc = init_leds(ps);
-   if (rc == false)
-      return false;
+   ps->knob_interval = shadow->knob_interval;
+   ps->suspend_inactive = shadow->suspend_inactive;
 
-   rc = init_controls(ps);
-   if (rc == false)
-      return false;
+   if (strcmp(ps->title.title, shadow->title.title)) {
+      strcpy(ps->title.title, shadow->title.title);
+      changed++;
+   }
 
-   rc = init_knobs(ps);
-   if (rc == false)
-      return false;
+   for (i = 0; i < ps->LEDS_N; i++) {
+      led = &ps->leds[i];
+      new_led = &shadow->leds[i];
+      if ((led->gfx.x == new_led->gfx.x) && (led->gfx.y == new_led->gfx.y) &&
+          (led->gfx.r == new_led->gfx.r) && !strcmp(led->title, new_led->title))
+         continue;
+      led->gfx = new_led->gfx;
+      strcpy(led->title, new_led->title);
+      led->dirty = true;
+      changed++;
+   }
 
-   rc = init_title(cfg);
-   if (rc == false)
-      return false;
+   for (i = 0; i < ps->KNOBS_N; i++) {
+      knob = &ps->knobs[i];
+      new_knob = &shadow->knobs[i];
+      if ((knob->gfx.x == new_knob->gfx.x) && (knob->gfx.y == new_knob->gfx.y) &&
+          (knob->gfx.r == new_knob->gfx.r) && (knob->knob_r == new_knob->knob_r) &&
+          (knob->clock_wise_limit == new_knob->clock_wise_limit) &&
+          (knob->counter_clock_wise_limit == new_knob->counter_clock_wise_limit) &&
+          !strcmp(knob->title, new_knob->title))
+         continue;
+      knob->gfx = new_knob->gfx;
+      knob->knob_r = new_knob->knob_r;
+      knob->clock_wise_limit = new_knob->clock_wise_limit;
+      knob->counter_clock_wise_limit = new_knob->counter_clock_wise_limit;
+      knob->angle = knob->counter_clock_wise_limit +
+                    (knob->clock_wise_limit - knob->counter_clock_wise_limit) *
+                    knob->voltage_setting / ps->voltage_full_output;
+      strcpy(knob->title, new_knob->title);
+      knob->text_valid = false;
+      knob->dirty = true;
+      changed++;
+   }
 
-   al_destroy_config(cfg);
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      control = &ps->controls[i];
+      new_control = &shadow->controls[i];
+      if ((control->gfx.x1 == new_control->gfx.x1) &&
+          (control->gfx.y1 == new_control->gfx.y1) &&
+          (control->gfx.x2 == new_control->gfx.x2) &&
+          (control->gfx.y2 == new_control->gfx.y2) &&
+          !strcmp(control->title, new_control->title))
+         continue;
+      control->gfx = new_control->gfx;
+      strcpy(control->title, new_control->title);
+      control->dirty = true;
+      changed++;
+   }
 
-   return true;
+   return changed;
 }
 
-static bool save_voltage_setting(power_supply_t *ps)
+/* The file is parsed into a shadow supply first, a broken or incompatible
+ * one leaves everything as it is. Nothing here touches the control thread.
+ */
+static void reload_config(power_supply_t *ps)
 {
-   char angle[256];
-   char voltage[256];
+   power_supply_t *shadow;
+   ALLEGRO_CONFIG *cfg;
+   ALLEGRO_BITMAP *background;
+   double start = al_get_time();
+   uint32_t changed = 0, i;
    bool rc;
 
-   ps->cfg = al_load_config_file(CFG_FILE);
-   if (ps->cfg == NULL) {
-      fprintf(stderr, "failed to load %s file!\n", CFG_FILE);
-      return false;
+   cfg = al_load_config_file(ps->cfg_file);
+   if (cfg == NULL) {
+      fprintf(stderr, "failed to reload %s file!\n", ps->cfg_file);
+      return;
    }
 
-   snprintf(angle, sizeof(angle), "%f", ps->knobs[0].angle);
-   al_set_config_value(ps->cfg, "output_voltage_selector", "angle", angle);
-   snprintf(voltage, sizeof(voltage), "%f", ps->knobs[0].voltage_setting);
-   al_set_config_value(ps->cfg, "output_voltage_selector", "voltage_setting", voltage);
-
-   rc = al_save_config_file(CFG_FILE, ps->cfg);
-   if (rc == false) {
-      fprintf(stderr, "failed to save %s file!\n", CFG_FILE);
-      return false;
+   shadow = allocate_main_object();
+   if (shadow == NULL) {
+      al_destroy_config(cfg);
+      return;
+   }
+   shadow->cfg = cfg;
+   rc = init_elements(shadow);
+   if ((rc == true) &&
+       ((shadow->LEDS_N != ps->LEDS_N) || (shadow->KNOBS_N != ps->KNOBS_N) ||
+        (shadow->CONTROLS_N != ps->CONTROLS_N) ||
+        (shadow->voltage_full_output != ps->voltage_full_output) ||
+        (shadow->v_program_max != ps->v_program_max) ||
+        (shadow->v_program_min != ps->v_program_min))) {
+      fprintf(stderr, "%s: number of leds, knobs or controls or the voltages "
+              "changed, takes a restart\n", ps->cfg_file);
+      rc = false;
    }
 
-   al_destroy_config(ps->cfg);
-
-   return true;
-}
-
-static bool load_config_file(power_supply_t *ps)
-{
-   ps->cfg = al_load_config_file(CFG_FILE);
-   if (ps->cfg == NULL) {
-      fprintf(stderr, "failed to load %s file!\n", CFG_FILE);
-      return false;
+   if (rc == true) {
+      changed = apply_config(ps, shadow);
+      for (i = 0; i < sizeof(restart_sections) / sizeof(restart_sections[0]); i++) {
+         if (config_section_changed(ps->cfg, cfg, restart_sections[i]) == true)
+            fprintf(stderr, "%s: section[%s] changed, takes a restart\n",
+                    ps->cfg_file, restart_sections[i]);
+      }
+      al_destroy_config(ps->cfg);
+      ps->cfg = cfg;
+   } else {
+      fprintf(stderr, "%s not reloaded!\n", ps->cfg_file);
+      al_destroy_config(cfg);
+   }
+   free(shadow->leds);
+   free(shadow->knobs);
+   free(shadow->controls);
+   free(shadow);
+
+   /* outlines and titles moved, the old background stays if that fails */
+   if (changed > 0) {
+      background = ps->background;
+      if (init_background(ps) == true)
+         al_destroy_bitmap(background);
+      else
+         ps->background = background;
+      ps->redraw_all = true;
    }
 
-   return true;
+   if (rc == true) {
+      printf("%s reloaded, %u elements changed, %.2f ms\n", ps->cfg_file, changed,
+             (al_get_time() - start) * 1e3);
+      fflush(stdout);
+   }
 }
 
-static power_supply_t *allocate_main_object()
+static void check_reload(power_supply_t *ps)
 {
-   power_supply_t *ps = NULL;
+   char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+   const struct inotify_event *event;
+   const char *name;
+   bool changed = false;
+   ssize_t len;
+   char *p;
+
+   if (ps->reload_fd == -1)
+      return;
 
-   ps = malloc(sizeof(power_supply_t));
-   if (ps == NULL) {
-      perror("malloc error");
+   name = strrchr(ps->cfg_file, '/');
+   name = (name != NULL) ? name + 1 : ps->cfg_file;
+   while ((len = read(ps->reload_fd, buf, sizeof(buf))) > 0) {
+      for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+         event = (const struct inotify_event *)p;
+         if ((event->len > 0) && !strcmp(event->name, name))
+            changed = true;
+      }
    }
 
-   return ps;
+   if (changed == true)
+      reload_config(ps);
 }
 
 int main(int argc, char **argv)
 {
+   startup_t startup;
+   power_supply_t *supplies[PS_SUPPLIES_MAX];
    power_supply_t *ps = NULL;
    ALLEGRO_DISPLAY *display = NULL;
+   pthread_t fonts_thread;
+   uint32_t n = 1, i = 0;
+   int retval;
    bool rc = false;
 
-   ps = allocate_main_object();
-   if (ps == NULL)
-      return EXIT_FAILURE;
+   memset(&startup, 0, sizeof(startup));
+   startup.t0_ns = now_ns();
 
-   rc = load_config_file(ps);
-   if (rc == false)
+   /* one configuration file per supply, side by side on one display */
+   if (argc > 1)
+      n = argc - 1;
+   if (n > PS_SUPPLIES_MAX) {
+      fprintf(stderr, "at most %d supplies!\n", PS_SUPPLIES_MAX);
       return EXIT_FAILURE;
+   }
+   startup.supplies = supplies;
+   startup.n = n;
+   startup.cpus = sysconf(_SC_NPROCESSORS_ONLN);
 
-   rc = load_io_plugin(ps);
-   if (rc == false)
-      return EXIT_FAILURE;
-   if (*handler.io_plugin_initialized != true) {
-      fprintf(stderr, "failed to initialize comedi!\n");
-      return EXIT_FAILURE;
+   startup.begin[phase_config] = startup_ms(&startup);
+   for (i = 0; i < n; i++) {
+      ps = allocate_main_object();
+      if (ps == NULL)
+         return EXIT_FAILURE;
+      supplies[i] = ps;
+      ps->x0 = i * DISPLAY_X;
+
+      rc = load_config_file(ps, (argc > 1) ? argv[i + 1] : CFG_FILE);
+      if (rc == false)
+         return EXIT_FAILURE;
    }
+   startup.end[phase_config] = startup_ms(&startup);
 
+   /* devices open while Allegro, the fonts and the display come up */
+   for (i = 0; i < n; i++) {
+      startup.devices[i].startup = &startup;
+      startup.devices[i].ps = supplies[i];
+      startup.devices[i].index = i;
+      retval = pthread_create(&startup.devices[i].thread, NULL, init_device,
+                              &startup.devices[i]);
+      if (retval != 0) {
+         fprintf(stderr, "failed to create device thread: %s\n", strerror(retval));
+         return EXIT_FAILURE;
+      }
+   }
+
+   startup.begin[phase_allegro] = startup_ms(&startup);
    rc = init_allegro();
    if (rc == false)
       return EXIT_FAILURE;
+   init_palette();
+   startup.end[phase_allegro] = startup_ms(&startup);
 
-   rc = init_elements(ps);
-   if (rc == false)
+   retval = pthread_create(&fonts_thread, NULL, init_fonts_all, &startup);
+   if (retval != 0) {
+      fprintf(stderr, "failed to create font thread: %s\n", strerror(retval));
       return EXIT_FAILURE;
+   }
+
+   /* redraws are change driven, the window manager has to tell us */
+   startup.begin[phase_display] = startup_ms(&startup);
+   al_set_new_display_flags(ALLEGRO_GENERATE_EXPOSE_EVENTS);
+   display = al_create_display(n * DISPLAY_X, DISPLAY_Y);
+   startup.end[phase_display] = startup_ms(&startup);
 
-   display = al_create_display(DISPLAY_X, DISPLAY_Y);
+   pthread_join(fonts_thread, NULL);
+   for (i = 0; i < n; i++)
+      pthread_join(startup.devices[i].thread, NULL);
    if (display == NULL) {
       fprintf(stderr, "failed to create display!\n");
       return EXIT_FAILURE; 
    }
-   draw_display(ps);
- 
-   process_events(ps, display);
+   if (startup.fonts_ok == false)
+      return EXIT_FAILURE;
+   for (i = 0; i < n; i++) {
+      if (startup.devices[i].ok == false)
+         return EXIT_FAILURE;
+   }
+   al_convert_memory_bitmaps();
+   supplies[0]->redraw_all = true;
+
+   startup.begin[phase_start] = startup_ms(&startup);
+   for (i = 0; i < n; i++) {
+      ps = supplies[i];
+      rc = init_journal(ps);
+      if (rc == false)
+         return EXIT_FAILURE;
+
+      rc = init_background(ps);
+      if (rc == false)
+         return EXIT_FAILURE;
+
+      rc = ctl_start(&ps->ctl, ps->LEDS_N, ps->v_program_max, ps->v_program_min);
+      if (rc == false)
+         return EXIT_FAILURE;
+
+      rc = api_start(&ps->api, &ps->ctl, ps->KNOBS_N,
+                     ps->voltage_full_output, ps->v_program_max);
+      if (rc == false)
+         return EXIT_FAILURE;
+
+      rc = start_journal(ps);
+      if (rc == false)
+         return EXIT_FAILURE;
+   }
+   draw_display(supplies, n);
+   startup.end[phase_start] = startup_ms(&startup);
 
+   rc = wait_first_status(supplies, n);
+   if (rc == false)
+      fprintf(stderr, "no status within %g s!\n", FIRST_STATUS_TIMEOUT);
+   startup.first_status = startup_ms(&startup);
+   report_startup(&startup);
+
+   /* the configuration in effect stays for comparing against changes */
+   for (i = 0; i < n; i++) {
+      if (watch_config(supplies[i]) == false)
+         fprintf(stderr, "changes to %s need a restart!\n", supplies[i]->cfg_file);
+   }
+ 
+   process_events(supplies, n, display);
 #if 0
    al_rest(5.0);
 #endif
 
-   rc = save_voltage_setting(ps);
-   if (rc == false)
-      fprintf(stderr, "failed to save voltage!\n");
+   for (i = 0; i < n; i++) {
+      if (supplies[i]->reload_fd != -1)
+         close(supplies[i]->reload_fd);
+      journal_stop(&supplies[i]->journal);
+      rc = save_voltage_setting(supplies[i]);
+      if (rc == false)
+         fprintf(stderr, "failed to save voltage!\n");
+      al_destroy_config(supplies[i]->cfg);
+      al_destroy_bitmap(supplies[i]->background);
+   }
 
+   destroy_fonts();
    al_destroy_display(display);
 
-   if (handler.handle != NULL)
-      dlclose(handler.handle);
+   for (i = 0; i < n; i++) {
+      api_stop(&supplies[i]->api);
+      ctl_stop(&supplies[i]->ctl);
+   }
  
    return EXIT_SUCCESS;
 }
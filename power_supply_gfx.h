@@ -27,15 +27,32 @@ typedef struct title {
    ALLEGRO_FONT *font;
 } title_t;
 
+/* one loaded font per file and size, shared by the widgets */
+typedef struct font_cache {
+   char file[256];
+   unsigned short size;
+   ALLEGRO_FONT *font;
+} font_cache_t;
+
 typedef struct circle {
    float x;
    float y;
    float r;
 } circle_t;
 
+typedef struct region {
+   float x1;
+   float y1;
+   float x2;
+   float y2;
+} region_t;
+
 typedef struct led {
    circle_t gfx;
    uint32_t state;
+   bool dirty;
+   /* area of the led and its title, measured once */
+   region_t bounds;
    char title[256];
    ALLEGRO_FONT *font;
    ALLEGRO_COLOR gfx_color;
@@ -49,6 +66,21 @@ typedef struct knob {
    float clock_wise_limit;
    float counter_clock_wise_limit;
    double voltage_setting;
+   bool dirty;
+   /* setting not sent to the control thread yet, and when the last went */
+   bool pending;
+   double sent_time;
+   /* last command queued for it, see power_supply_t commands */
+   uint64_t command;
+   /* setting text, formatted and measured when the setting changes */
+   bool text_valid;
+   double text_voltage;
+   char text[512];
+   float text_x;
+   float text_y;
+   float text_width;
+   /* width of the text on screen, the new one may be narrower */
+   float text_width_shown;
    char title[256];
    ALLEGRO_FONT *font;
    ALLEGRO_COLOR gfx_color;
@@ -64,6 +96,11 @@ typedef struct rectangle {
 typedef struct control {
    rectangle_t gfx;
    uint32_t state;
+   bool dirty;
+   /* last command queued for it, see power_supply_t commands */
+   uint64_t command;
+   /* area of the control and its title, measured once */
+   region_t bounds;
    char title[256];
    ALLEGRO_FONT *font;
    ALLEGRO_COLOR gfx_color;
@@ -72,6 +109,13 @@ typedef struct control {
 
 typedef struct power_supply {
    ALLEGRO_CONFIG *cfg;
+   char cfg_file[256];
+   /* inotify on the directory of cfg_file, -1 when changes are not
+    * picked up */
+   int reload_fd;
+   /* left edge of the tile of this supply on the shared display */
+   float x0;
+   title_t title;
    uint32_t voltage_full_output;
    uint32_t LEDS_N;
    uint32_t KNOBS_N;
@@ -81,8 +125,72 @@ typedef struct power_supply {
    control_t *controls;
    double v_program_max;
    double v_program_min;
+   /* outlines and titles, drawn once */
+   ALLEGRO_BITMAP *background;
+   /* whole frame has to be redrawn, e.g. after expose */
+   bool redraw_all;
+   /* display is not visible, nothing gets drawn */
+   bool drawing_halted;
+   /* also stop drawing when the display loses focus */
+   bool suspend_inactive;
+   /* at most one knob write per knob_interval seconds */
+   double knob_interval;
+   /* control API writes and ended profiles seen by the UI */
+   uint32_t batch_writes;
+   uint32_t profile_ends;
+   /* UI commands queued, in flight until ps_status_t commands reaches
+    * their number */
+   uint64_t commands;
+   /* statistics of the last regulation window, above the burst line */
+   uint32_t reg_windows;
+   char reg_text[256];
+   bool reg_dirty;
+   /* summary of the last burst capture, bottom line of the display */
+   ps_burst_t burst;
+   bool burst_dirty;
+   ALLEGRO_FONT *summary_font;
+   ps_control_t ctl;
+   ps_api_t api;
+   /* knob settings and control states as they change */
+   ps_journal_t journal;
 } power_supply_t;
 
+/* startup phases of ps_prog, device, fonts and display overlap */
+enum {
+   phase_config = 0,
+   phase_allegro,
+   phase_fonts,
+   phase_display,
+   phase_start,
+   PHASES_N,
+};
+
+struct startup;
+
+/* plugin load and device open of one supply, on a thread of its own */
+typedef struct startup_device {
+   struct startup *startup;
+   power_supply_t *ps;
+   uint32_t index;
+   pthread_t thread;
+   double begin;
+   double end;
+   bool ok;
+} startup_device_t;
+
+typedef struct startup {
+   power_supply_t **supplies;
+   uint32_t n;
+   long cpus;
+   /* times are ms since main() was entered */
+   uint64_t t0_ns;
+   double begin[PHASES_N];
+   double end[PHASES_N];
+   startup_device_t devices[PS_SUPPLIES_MAX];
+   bool fonts_ok;
+   double first_status;
+} startup_t;
+
 /* enums */
 
 enum {
@@ -110,6 +218,15 @@ enum {
    output_voltage_selector = 0,
 };
 
+/* colors used when drawing */
+enum {
+   color_black = 0,
+   color_white,
+   color_red,
+   color_yellow,
+   COLORS_N,
+};
+
 /* different controls in the system */
 enum {
    enable_power_supply = 0,
@@ -117,16 +234,4 @@ enum {
    interlock_power_supply,
 };
 
-typedef struct power_supply_handler {
-   void *handle;
-   bool (*init_pcidas1602_16)(void);
-   bool (*analog_channel_input)(uint32_t channel, double *value);
-   bool (*digital_channel_output_high)(uint32_t channel);
-   bool (*digital_channel_output_low)(uint32_t channel);
-   bool (*analog_channel_output)(uint32_t channel, double value, double v_max, double v_min);
-   int (*convert_button_to_channel)(uint32_t button);
-   int (*convert_knob_to_channel)(uint32_t knob);
-   bool *io_plugin_initialized;
-} ps_handler_t;
-
 #endif /* __POWER_SUPPLY_GFX_H */
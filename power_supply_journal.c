@@ -0,0 +1,529 @@
+/*
+ * State journal
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The journal keeps knob settings and control states across crashes. An
+ * append from the UI thread copies a record into memory under a mutex and
+ * returns, no syscall. The journal thread writes what piled up once every
+ * [journal] sync_ms and syncs it with a single fdatasync. Once the file
+ * holds [journal] compact records, or appends overflowed the memory, the
+ * current state is written to <file>.tmp, synced and renamed over the
+ * journal. Either file is complete at any time, a torn append is cut off
+ * by replay.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "power_supply_journal.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define JOURNAL_SYNC_MS_DEFAULT 100
+#define JOURNAL_COMPACT_DEFAULT 4096
+
+_Static_assert(sizeof(journal_record_t) == JOURNAL_RECORD_SIZE, "record size");
+
+static uint32_t journal_check(const journal_record_t *record);
+static bool journal_replay(ps_journal_t *journal, int fd);
+static journal_record_t *journal_pending(ps_journal_t *journal, uint32_t type, uint32_t index);
+static uint32_t journal_snapshot(ps_journal_t *journal, journal_record_t *records);
+static void journal_seal(ps_journal_t *journal, journal_record_t *records, uint32_t n);
+static bool write_all(int fd, const void *buf, size_t size);
+static bool sync_dir(const char *file);
+static bool journal_append(ps_journal_t *journal, journal_record_t *records, uint32_t n);
+static bool journal_rewrite(ps_journal_t *journal, journal_record_t *records, uint32_t n);
+static void journal_flush(ps_journal_t *journal);
+static void *journal_thread(void *arg);
+
+bool journal_init(ps_journal_t *journal, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+   double value;
+
+   memset(journal, 0, sizeof(*journal));
+   journal->fd = -1;
+
+   /* journal is optional, off without a file */
+   str = al_get_config_value(cfg, "journal", "file");
+   if (str == NULL)
+      return true;
+   if (strlen(str) >= sizeof(journal->file) - sizeof(".tmp")) {
+      fprintf(stderr, "requested value (key[file] in section[journal]) too long!\n");
+      return false;
+   }
+   strcpy(journal->file, str);
+
+   journal->sync_interval = JOURNAL_SYNC_MS_DEFAULT / 1e3;
+   str = al_get_config_value(cfg, "journal", "sync_ms");
+   if (str != NULL) {
+      errno = 0;
+      value = strtod(str, NULL);
+      if ((errno == ERANGE) || (value < 1) || (value > 60000)) {
+         fprintf(stderr, "sync_ms[%s] in section[journal] out of range!\n", str);
+         return false;
+      }
+      journal->sync_interval = value / 1e3;
+   }
+
+   journal->compact = JOURNAL_COMPACT_DEFAULT;
+   str = al_get_config_value(cfg, "journal", "compact");
+   if (str != NULL) {
+      errno = 0;
+      value = strtod(str, NULL);
+      if ((errno == ERANGE) || (value < JOURNAL_PENDING_N) || (value > (1U << 24))) {
+         fprintf(stderr, "compact[%s] in section[journal] out of range!\n", str);
+         return false;
+      }
+      journal->compact = value;
+   }
+
+   str = al_get_config_value(cfg, "journal", "restore_controls");
+   journal->restore_controls = (str != NULL) && !strcmp(str, "on");
+
+   return true;
+}
+
+/* FNV-1a over the record up to check */
+static uint32_t journal_check(const journal_record_t *record)
+{
+   const uint8_t *p = (const uint8_t *)record;
+   uint32_t hash = 2166136261U;
+   size_t i;
+
+   for (i = 0; i < offsetof(journal_record_t, check); i++) {
+      hash ^= p[i];
+      hash *= 16777619U;
+   }
+
+   return hash;
+}
+
+/* takes over the state of every complete record, knobs and controls the
+ * configuration no longer has are skipped
+ */
+static bool journal_replay(ps_journal_t *journal, int fd)
+{
+   journal_record_t records[JOURNAL_PENDING_N];
+   journal_header_t header;
+   journal_record_t *record;
+   ssize_t len;
+   uint32_t i, n;
+
+   len = read(fd, &header, sizeof(header));
+   if (len == 0)
+      return true;
+   if ((len != sizeof(header)) || (header.magic != JOURNAL_MAGIC) ||
+       (header.version != JOURNAL_VERSION) || (header.record_size != JOURNAL_RECORD_SIZE)) {
+      fprintf(stderr, "journal[%s] is not a state journal!\n", journal->file);
+      return false;
+   }
+
+   while ((len = read(fd, records, sizeof(records))) > 0) {
+      n = len / sizeof(journal_record_t);
+      for (i = 0; i < n; i++) {
+         record = &records[i];
+         if ((record->check != journal_check(record)) ||
+             ((journal->replayed > 0) && (record->seq != journal->seq + 1)))
+            return true;
+         journal->seq = record->seq;
+         journal->replayed++;
+
+         if ((record->type == journal_type_knob) && (record->index < journal->knobs_n)) {
+            journal->knobs[record->index].valid = true;
+            journal->knobs[record->index].angle = record->angle;
+            journal->knobs[record->index].voltage = record->voltage;
+         } else if ((record->type == journal_type_control) &&
+                    (record->index < journal->controls_n)) {
+            journal->controls[record->index].valid = true;
+            journal->controls[record->index].state = record->state;
+         }
+      }
+      /* a torn record at the end */
+      if (n * sizeof(journal_record_t) != (size_t)len)
+         return true;
+   }
+   if (len == -1) {
+      fprintf(stderr, "failed to read journal[%s]: %s\n", journal->file, strerror(errno));
+      return false;
+   }
+
+   return true;
+}
+
+bool journal_open(ps_journal_t *journal, uint32_t knobs_n, uint32_t controls_n)
+{
+   bool rc;
+   int fd;
+
+   if (journal->file[0] == '\0')
+      return true;
+
+   /* a compaction writes every knob and control in one go */
+   if (knobs_n + controls_n > JOURNAL_PENDING_N) {
+      fprintf(stderr, "too many knobs and controls for the journal!\n");
+      return false;
+   }
+   journal->knobs = calloc(knobs_n, sizeof(journal_knob_t));
+   journal->controls = calloc(controls_n, sizeof(journal_control_t));
+   if ((journal->knobs == NULL) || (journal->controls == NULL)) {
+      fprintf(stderr, "failed to allocate journal state\n");
+      return false;
+   }
+   journal->knobs_n = knobs_n;
+   journal->controls_n = controls_n;
+   pthread_mutex_init(&journal->lock, NULL);
+
+   fd = open(journal->file, O_RDONLY | O_CLOEXEC);
+   if (fd == -1) {
+      if (errno == ENOENT)
+         return true;
+      fprintf(stderr, "failed to open journal[%s]: %s\n", journal->file, strerror(errno));
+      return false;
+   }
+   rc = journal_replay(journal, fd);
+   close(fd);
+
+#ifdef DEBUG
+   printf("journal[%s] replayed %u records up to seq %llu\n", journal->file,
+          journal->replayed, (unsigned long long)journal->seq);
+#endif
+   return rc;
+}
+
+/* next free record in memory, NULL and a compaction owed when full */
+static journal_record_t *journal_pending(ps_journal_t *journal, uint32_t type, uint32_t index)
+{
+   journal_record_t *record;
+
+   if (journal->pending_n == JOURNAL_PENDING_N) {
+      journal->overflow = true;
+      return NULL;
+   }
+
+   record = &journal->pending[journal->pending_n++];
+   memset(record, 0, sizeof(*record));
+   record->type = type;
+   record->index = index;
+
+   return record;
+}
+
+void journal_knob(ps_journal_t *journal, uint32_t knob, float angle, double voltage)
+{
+   journal_record_t *record;
+
+   if (knob >= journal->knobs_n)
+      return;
+
+   pthread_mutex_lock(&journal->lock);
+   journal->knobs[knob].valid = true;
+   journal->knobs[knob].angle = angle;
+   journal->knobs[knob].voltage = voltage;
+   record = journal_pending(journal, journal_type_knob, knob);
+   if (record != NULL) {
+      record->angle = angle;
+      record->voltage = voltage;
+   }
+   pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_control(ps_journal_t *journal, uint32_t control, uint32_t state)
+{
+   journal_record_t *record;
+
+   if (control >= journal->controls_n)
+      return;
+
+   pthread_mutex_lock(&journal->lock);
+   journal->controls[control].valid = true;
+   journal->controls[control].state = state;
+   record = journal_pending(journal, journal_type_control, control);
+   if (record != NULL)
+      record->state = state;
+   pthread_mutex_unlock(&journal->lock);
+}
+
+/* one record per known knob and control, called with the lock held */
+static uint32_t journal_snapshot(ps_journal_t *journal, journal_record_t *records)
+{
+   uint32_t i, n = 0;
+
+   for (i = 0; i < journal->knobs_n; i++) {
+      if (journal->knobs[i].valid == false)
+         continue;
+      memset(&records[n], 0, sizeof(records[n]));
+      records[n].type = journal_type_knob;
+      records[n].index = i;
+      records[n].angle = journal->knobs[i].angle;
+      records[n].voltage = journal->knobs[i].voltage;
+      n++;
+   }
+   for (i = 0; i < journal->controls_n; i++) {
+      if (journal->controls[i].valid == false)
+         continue;
+      memset(&records[n], 0, sizeof(records[n]));
+      records[n].type = journal_type_control;
+      records[n].index = i;
+      records[n].state = journal->controls[i].state;
+      n++;
+   }
+
+   return n;
+}
+
+static void journal_seal(ps_journal_t *journal, journal_record_t *records, uint32_t n)
+{
+   uint32_t i;
+
+   for (i = 0; i < n; i++) {
+      records[i].seq = ++journal->seq;
+      records[i].check = journal_check(&records[i]);
+   }
+}
+
+static bool write_all(int fd, const void *buf, size_t size)
+{
+   const char *p = buf;
+   ssize_t len;
+
+   while (size > 0) {
+      len = write(fd, p, size);
+      if (len == -1) {
+         if (errno == EINTR)
+            continue;
+         return false;
+      }
+      p += len;
+      size -= len;
+   }
+
+   return true;
+}
+
+/* makes a rename in the directory of file durable */
+static bool sync_dir(const char *file)
+{
+   char dir[256];
+   char *slash;
+   int fd;
+   bool rc;
+
+   strcpy(dir, file);
+   slash = strrchr(dir, '/');
+   if (slash == dir)
+      slash[1] = '\0';
+   else if (slash != NULL)
+      *slash = '\0';
+   else
+      strcpy(dir, ".");
+
+   fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd == -1)
+      return false;
+   rc = (fsync(fd) == 0);
+   close(fd);
+
+   return rc;
+}
+
+static bool journal_append(ps_journal_t *journal, journal_record_t *records, uint32_t n)
+{
+   journal_seal(journal, records, n);
+   if ((write_all(journal->fd, records, n * sizeof(journal_record_t)) == false) ||
+       (fdatasync(journal->fd) == -1))
+      return false;
+   journal->records += n;
+   journal->writes++;
+
+   return true;
+}
+
+/* the state so far goes to a new file, which replaces the journal once
+ * it is on disk
+ */
+static bool journal_rewrite(ps_journal_t *journal, journal_record_t *records, uint32_t n)
+{
+   char tmp[sizeof(journal->file)];
+   journal_header_t header;
+   int fd, err;
+
+   snprintf(tmp, sizeof(tmp), "%s.tmp", journal->file);
+   fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd == -1)
+      return false;
+
+   memset(&header, 0, sizeof(header));
+   header.magic = JOURNAL_MAGIC;
+   header.version = JOURNAL_VERSION;
+   header.record_size = JOURNAL_RECORD_SIZE;
+   journal_seal(journal, records, n);
+   if ((write_all(fd, &header, sizeof(header)) == false) ||
+       (write_all(fd, records, n * sizeof(journal_record_t)) == false) ||
+       (fdatasync(fd) == -1) || (rename(tmp, journal->file) == -1)) {
+      err = errno;
+      close(fd);
+      unlink(tmp);
+      errno = err;
+      return false;
+   }
+   if (sync_dir(journal->file) == false)
+      fprintf(stderr, "journal[%s] renamed, but not synced: %s\n", journal->file,
+              strerror(errno));
+
+   if (journal->fd != -1)
+      close(journal->fd);
+   journal->fd = fd;
+   journal->records = n;
+   journal->writes++;
+   journal->compactions++;
+
+   return true;
+}
+
+/* writes what was appended, called and returns with the lock held but
+ * does the IO without it
+ */
+static void journal_flush(ps_journal_t *journal)
+{
+   journal_record_t records[JOURNAL_PENDING_N];
+   uint32_t n;
+   bool compact, rc;
+
+   if ((journal->pending_n == 0) && (journal->overflow == false))
+      return;
+
+   compact = (journal->overflow == true) ||
+             (journal->records + journal->pending_n > journal->compact);
+   if (compact == true) {
+      n = journal_snapshot(journal, records);
+   } else {
+      n = journal->pending_n;
+      memcpy(records, journal->pending, n * sizeof(journal_record_t));
+   }
+   journal->pending_n = 0;
+   journal->overflow = false;
+   /* the first failure stops the journal, the UI goes on */
+   if (journal->failed == true)
+      return;
+   pthread_mutex_unlock(&journal->lock);
+
+   if (compact == true)
+      rc = journal_rewrite(journal, records, n);
+   else
+      rc = journal_append(journal, records, n);
+   if (rc == false) {
+      fprintf(stderr, "journal[%s] stopped: %s\n", journal->file, strerror(errno));
+      if (journal->fd != -1)
+         close(journal->fd);
+      journal->fd = -1;
+      journal->failed = true;
+   }
+
+   pthread_mutex_lock(&journal->lock);
+}
+
+static void *journal_thread(void *arg)
+{
+   ps_journal_t *journal = arg;
+   struct timespec deadline;
+   uint64_t ns;
+
+   pthread_mutex_lock(&journal->lock);
+   while (journal->stop == false) {
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      ns = deadline.tv_nsec + (uint64_t)(journal->sync_interval * 1e9);
+      deadline.tv_sec += ns / 1000000000ULL;
+      deadline.tv_nsec = ns % 1000000000ULL;
+      while ((journal->stop == false) &&
+             (pthread_cond_timedwait(&journal->cond, &journal->lock, &deadline) != ETIMEDOUT))
+         ;
+      journal_flush(journal);
+   }
+   pthread_mutex_unlock(&journal->lock);
+
+   return NULL;
+}
+
+/* the replayed state, with whatever was appended since, is compacted
+ * into a new file before the thread takes over
+ */
+bool journal_start(ps_journal_t *journal)
+{
+   pthread_condattr_t attr;
+   int retval;
+
+   if (journal->file[0] == '\0')
+      return true;
+
+   /* deadlines of the thread do not move with the wall clock */
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+   pthread_cond_init(&journal->cond, &attr);
+   pthread_condattr_destroy(&attr);
+
+   pthread_mutex_lock(&journal->lock);
+   journal->overflow = true;
+   journal_flush(journal);
+   pthread_mutex_unlock(&journal->lock);
+   if (journal->failed == true)
+      return false;
+
+   retval = pthread_create(&journal->thread, NULL, journal_thread, journal);
+   if (retval != 0) {
+      fprintf(stderr, "failed to create journal thread: %s\n", strerror(retval));
+      return false;
+   }
+   journal->running = true;
+
+   return true;
+}
+
+/* the last appends are written before it returns */
+void journal_stop(ps_journal_t *journal)
+{
+   if (journal->running == false)
+      return;
+
+   pthread_mutex_lock(&journal->lock);
+   journal->stop = true;
+   pthread_cond_signal(&journal->cond);
+   pthread_mutex_unlock(&journal->lock);
+   pthread_join(journal->thread, NULL);
+   journal->running = false;
+
+#ifdef DEBUG
+   printf("journal[%s] %u writes, %u compactions\n", journal->file,
+          journal->writes, journal->compactions);
+#endif
+   if (journal->fd != -1)
+      close(journal->fd);
+   journal->fd = -1;
+}
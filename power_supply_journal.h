@@ -0,0 +1,120 @@
+/*
+ * Header file for the state journal
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_JOURNAL_H
+#define __POWER_SUPPLY_JOURNAL_H
+
+/* File format, native byte order.
+ *
+ * A journal_header_t is followed by records of JOURNAL_RECORD_SIZE bytes.
+ * Seq counts up by one from record to record, check covers the record up
+ * to it. Replay stops at the first record that breaks either, that is
+ * the end of the last complete write. A compacted file starts with one
+ * record per knob and control.
+ */
+
+#define JOURNAL_MAGIC 0x314c524a /* "JRL1" */
+#define JOURNAL_VERSION 1
+#define JOURNAL_RECORD_SIZE 32
+/* appends held in memory between two writes */
+#define JOURNAL_PENDING_N 256
+
+/* record types */
+enum {
+   journal_type_knob = 1,
+   journal_type_control,
+};
+
+typedef struct journal_record {
+   uint64_t seq;
+   uint8_t type;
+   uint8_t index;
+   uint16_t reserved;
+   /* control state, key_on or key_off */
+   uint32_t state;
+   /* knob setting in volts at the supply output and its angle */
+   double voltage;
+   float angle;
+   uint32_t check;
+} journal_record_t;
+
+typedef struct journal_header {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t record_size;
+   uint32_t reserved;
+} journal_header_t;
+
+/* types */
+
+typedef struct journal_knob {
+   bool valid;
+   float angle;
+   double voltage;
+} journal_knob_t;
+
+typedef struct journal_control {
+   bool valid;
+   uint32_t state;
+} journal_control_t;
+
+typedef struct ps_journal {
+   /* settings, the journal is off without a file */
+   char file[256];
+   /* seconds between two writes to the file */
+   double sync_interval;
+   /* records in the file before it is compacted */
+   uint32_t compact;
+   /* controls come back as journaled, otherwise as configured */
+   bool restore_controls;
+   /* state as last appended, what replay found before the first one */
+   uint32_t knobs_n;
+   uint32_t controls_n;
+   journal_knob_t *knobs;
+   journal_control_t *controls;
+   uint32_t replayed;
+   /* appends not written yet, a compaction replaces them on overflow */
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   journal_record_t pending[JOURNAL_PENDING_N];
+   uint32_t pending_n;
+   bool overflow;
+   bool stop;
+   /* file side, journal thread only once it runs */
+   int fd;
+   uint64_t seq;
+   uint32_t records;
+   uint32_t writes;
+   uint32_t compactions;
+   /* a write failed, later appends are dropped */
+   bool failed;
+   bool running;
+   pthread_t thread;
+} ps_journal_t;
+
+/* functions */
+
+bool journal_init(ps_journal_t *journal, ALLEGRO_CONFIG *cfg);
+bool journal_open(ps_journal_t *journal, uint32_t knobs_n, uint32_t controls_n);
+bool journal_start(ps_journal_t *journal);
+void journal_knob(ps_journal_t *journal, uint32_t knob, float angle, double voltage);
+void journal_control(ps_journal_t *journal, uint32_t control, uint32_t state);
+void journal_stop(ps_journal_t *journal);
+
+#endif /* __POWER_SUPPLY_JOURNAL_H */
@@ -0,0 +1,185 @@
+/*
+ * Shared memory metrics
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Counters and histograms of the control and UI threads in a shared
+ * file mapping, /dev/shm keeps it off the disk. An update is a few plain
+ * stores into a page that stays mapped, no lock and no syscall, the
+ * owner of a field is the only one writing it. ps_metrics reads the
+ * mapping from outside, the controller never waits for it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "power_supply_metrics.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+_Static_assert(sizeof(metrics_region_t) <= METRICS_SIZE, "metrics size");
+
+static uint64_t clock_ns(clockid_t clock);
+static void metrics_add(uint64_t *field, uint64_t n);
+
+bool metrics_init(ps_metrics_t *metrics, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+
+   memset(metrics, 0, sizeof(*metrics));
+
+   /* metrics are optional, off without a file */
+   str = al_get_config_value(cfg, "metrics", "file");
+   if (str == NULL)
+      return true;
+   if (strlen(str) >= sizeof(metrics->file)) {
+      fprintf(stderr, "requested value (key[file] in section[metrics]) too long!\n");
+      return false;
+   }
+   strcpy(metrics->file, str);
+
+   return true;
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+   struct timespec ts;
+
+   clock_gettime(clock, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool metrics_open(ps_metrics_t *metrics)
+{
+   metrics_region_t *region;
+   void *map;
+   int fd, err;
+
+   if (metrics->file[0] == '\0')
+      return true;
+
+   /* a reader still holding the old file keeps it, ours is a new one */
+   if ((unlink(metrics->file) == -1) && (errno != ENOENT)) {
+      fprintf(stderr, "failed to remove metrics[%s]: %s\n", metrics->file, strerror(errno));
+      return false;
+   }
+   fd = open(metrics->file, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+   if (fd == -1) {
+      fprintf(stderr, "failed to create metrics[%s]: %s\n", metrics->file, strerror(errno));
+      return false;
+   }
+   err = posix_fallocate(fd, 0, METRICS_SIZE);
+   if (err != 0) {
+      fprintf(stderr, "failed to allocate metrics[%s]: %s\n", metrics->file, strerror(err));
+      close(fd);
+      return false;
+   }
+   map = mmap(NULL, METRICS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "failed to map metrics[%s]: %s\n", metrics->file, strerror(errno));
+      return false;
+   }
+
+   region = map;
+   region->version = METRICS_VERSION;
+   region->size = METRICS_SIZE;
+   region->buckets = METRICS_BUCKETS;
+   region->counters_n = METRICS_COUNTERS;
+   region->hists_n = METRICS_HISTS;
+   region->pid = getpid();
+   region->start_ns = clock_ns(CLOCK_REALTIME);
+   /* magic last, a reader ignores a file without it */
+   __atomic_store_n(&region->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+   metrics->region = region;
+
+   return true;
+}
+
+/* CLOCK_MONOTONIC [ns] to time a call with, 0 when off */
+uint64_t metrics_now(ps_metrics_t *metrics)
+{
+   if (metrics->region == NULL)
+      return 0;
+
+   return clock_ns(CLOCK_MONOTONIC);
+}
+
+/* single writer, a load and a store instead of a locked add */
+static void metrics_add(uint64_t *field, uint64_t n)
+{
+   __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+void metrics_count(ps_metrics_t *metrics, uint32_t counter, uint64_t n)
+{
+   if (metrics->region == NULL)
+      return;
+
+   metrics_add(&metrics->region->counters[counter], n);
+}
+
+void metrics_hist(ps_metrics_t *metrics, uint32_t hist, uint64_t value)
+{
+   metrics_hist_t *h;
+   uint32_t bucket;
+
+   if (metrics->region == NULL)
+      return;
+
+   h = &metrics->region->hists[hist];
+   bucket = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+   if (bucket >= METRICS_BUCKETS)
+      bucket = METRICS_BUCKETS - 1;
+   metrics_add(&h->buckets[bucket], 1);
+   metrics_add(&h->sum, value);
+   if (value > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+      __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+   /* count last, it never runs ahead of the buckets */
+   __atomic_store_n(&h->count, __atomic_load_n(&h->count, __ATOMIC_RELAXED) + 1,
+                    __ATOMIC_RELEASE);
+}
+
+/* time since start, taken with metrics_now() */
+void metrics_since(ps_metrics_t *metrics, uint32_t hist, uint64_t start_ns)
+{
+   if (metrics->region == NULL)
+      return;
+
+   metrics_hist(metrics, hist, clock_ns(CLOCK_MONOTONIC) - start_ns);
+}
+
+/* the file stays for a last look after the controller is gone */
+void metrics_close(ps_metrics_t *metrics)
+{
+   if (metrics->region == NULL)
+      return;
+
+   munmap(metrics->region, METRICS_SIZE);
+   metrics->region = NULL;
+}
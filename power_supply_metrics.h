@@ -0,0 +1,114 @@
+/*
+ * Header file for the shared memory metrics
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_METRICS_H
+#define __POWER_SUPPLY_METRICS_H
+
+#include <stdint.h>
+
+/* File format, native byte order.
+ *
+ * The file is one metrics_region_t padded to METRICS_SIZE. Counters and
+ * histograms are indexed by the enums below, new ones are appended and
+ * counted in counters_n and hists_n. Every field has a single writer, the
+ * control thread or the UI thread, and is updated with relaxed 64 bit
+ * stores, so a reader sees each value whole but the fields of a histogram
+ * may be a sample apart. Values only grow until the controller restarts,
+ * which recreates the file.
+ *
+ * Histogram bucket 0 counts zeros, bucket b counts values from 2^(b-1)
+ * to 2^b - 1, the last bucket everything above. Times are in ns.
+ */
+
+#define METRICS_MAGIC 0x3152544d /* "MTR1" */
+#define METRICS_VERSION 1
+#define METRICS_SIZE 4096
+#define METRICS_BUCKETS 32
+
+/* counters */
+enum {
+   metrics_polls = 0,
+   /* polls that started a whole period or more after they were due */
+   metrics_polls_missed,
+   metrics_commands,
+   metrics_batches,
+   /* plugin calls that failed */
+   metrics_io_errors,
+   /* ps_prog only */
+   metrics_frames,
+   METRICS_COUNTERS,
+};
+
+/* histograms */
+enum {
+   /* plugin calls, the time each one took */
+   metrics_analog_input = 0,
+   metrics_analog_output,
+   /* single line and masked digital writes */
+   metrics_digital_output,
+   /* start of a poll after its deadline */
+   metrics_poll_late,
+   /* draw_display() of ps_prog */
+   metrics_frame,
+   /* events ps_prog took from its queue in one go, a count, not a time */
+   metrics_event_queue,
+   METRICS_HISTS,
+};
+
+typedef struct metrics_hist {
+   uint64_t count;
+   uint64_t sum;
+   uint64_t max;
+   uint64_t buckets[METRICS_BUCKETS];
+} metrics_hist_t;
+
+typedef struct metrics_region {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t size;
+   uint32_t buckets;
+   uint32_t counters_n;
+   uint32_t hists_n;
+   int64_t pid;
+   /* CLOCK_REALTIME [ns] the controller started at */
+   uint64_t start_ns;
+   uint64_t counters[METRICS_COUNTERS];
+   metrics_hist_t hists[METRICS_HISTS];
+} metrics_region_t;
+
+/* types */
+
+typedef struct ps_metrics {
+   /* empty when the metrics are off */
+   char file[256];
+   /* mapping of the file, NULL unless on */
+   metrics_region_t *region;
+} ps_metrics_t;
+
+/* functions */
+
+bool metrics_init(ps_metrics_t *metrics, ALLEGRO_CONFIG *cfg);
+bool metrics_open(ps_metrics_t *metrics);
+uint64_t metrics_now(ps_metrics_t *metrics);
+void metrics_count(ps_metrics_t *metrics, uint32_t counter, uint64_t n);
+void metrics_hist(ps_metrics_t *metrics, uint32_t hist, uint64_t value);
+void metrics_since(ps_metrics_t *metrics, uint32_t hist, uint64_t start_ns);
+void metrics_close(ps_metrics_t *metrics);
+
+#endif /* __POWER_SUPPLY_METRICS_H */
@@ -0,0 +1,301 @@
+/*
+ * Output voltage profile
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* A profile is a list of time:volts breakpoints at the supply output,
+ * linear in between, held before the first and after the last one. Two
+ * points at the same time make a step. It comes from [profile] points or
+ * from a CSV table of time,volts rows named by [profile] file. Before the
+ * control thread starts it is sampled at the card rate into program
+ * volts, the plugin turns those into DAC codes and streams them out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "power_supply_profile.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define PROFILE_RATE_DEFAULT 1000
+
+static bool read_profile_config(ALLEGRO_CONFIG *cfg, char *section,
+                                char *key, double *value);
+static bool add_point(ps_profile_t *profile, double t, double volts);
+static bool parse_points(ps_profile_t *profile, const char *str);
+static bool read_points(ps_profile_t *profile, const char *file);
+
+/* optional numeric key, value untouched if absent */
+static bool read_profile_config(ALLEGRO_CONFIG *cfg, char *section,
+                                char *key, double *value)
+{
+   const char *str;
+   double d_value;
+
+   str = al_get_config_value(cfg, section, key);
+   if (str == NULL)
+      return true;
+
+   errno = 0;
+   d_value = strtod(str, NULL);
+   if (errno == ERANGE) {
+      fprintf(stderr, "failed to convert %s value from section[%s]!\n", key, section);
+      return false;
+   }
+   *value = d_value;
+
+   return true;
+}
+
+/* in output volts, converted once all points are in */
+static bool add_point(ps_profile_t *profile, double t, double volts)
+{
+   uint32_t n = profile->points_n;
+
+   if (n == PS_PROFILE_POINTS_MAX) {
+      fprintf(stderr, "profile longer than %d points\n", PS_PROFILE_POINTS_MAX);
+      return false;
+   }
+   if (!(t >= 0) || ((n > 0) && (t < profile->times[n - 1]))) {
+      fprintf(stderr, "profile time[%g] out of order\n", t);
+      return false;
+   }
+   if (!(volts >= 0)) {
+      fprintf(stderr, "profile voltage[%g] out of range\n", volts);
+      return false;
+   }
+
+   profile->times[n] = t;
+   profile->volts[n] = volts;
+   profile->points_n++;
+
+   return true;
+}
+
+/* t:volts[,t:volts...] */
+static bool parse_points(ps_profile_t *profile, const char *str)
+{
+   double t, volts;
+   char *end;
+
+   for (;;) {
+      t = strtod(str, &end);
+      if ((end == str) || (*end != ':')) {
+         fprintf(stderr, "profile point[%s] is not time:volts\n", str);
+         return false;
+      }
+      str = end + 1;
+      volts = strtod(str, &end);
+      if (end == str) {
+         fprintf(stderr, "profile point[%s] is not time:volts\n", str);
+         return false;
+      }
+      if (add_point(profile, t, volts) == false)
+         return false;
+      str = end;
+      while ((*str == ' ') || (*str == '\t'))
+         str++;
+      if (*str == '\0')
+         return true;
+      if (*str != ',') {
+         fprintf(stderr, "profile point[%s] is not time:volts\n", str);
+         return false;
+      }
+      str++;
+   }
+}
+
+/* time,volts rows, lines not starting with a number are skipped so a
+ * header row or comments do no harm
+ */
+static bool read_points(ps_profile_t *profile, const char *file)
+{
+   char line[256];
+   double t, volts;
+   char *end, *str;
+   FILE *fp;
+   bool rc = true;
+
+   fp = fopen(file, "r");
+   if (fp == NULL) {
+      fprintf(stderr, "failed to open profile[%s]: %s\n", file, strerror(errno));
+      return false;
+   }
+
+   while ((rc == true) && (fgets(line, sizeof(line), fp) != NULL)) {
+      t = strtod(line, &end);
+      if (end == line)
+         continue;
+      str = end;
+      while ((*str == ' ') || (*str == '\t'))
+         str++;
+      if (*str != ',') {
+         fprintf(stderr, "profile row[%s] is not time,volts\n", line);
+         rc = false;
+         break;
+      }
+      volts = strtod(str + 1, &end);
+      if (end == str + 1) {
+         fprintf(stderr, "profile row[%s] is not time,volts\n", line);
+         rc = false;
+         break;
+      }
+      rc = add_point(profile, t, volts);
+   }
+   fclose(fp);
+
+   if ((rc == true) && (profile->points_n == 0)) {
+      fprintf(stderr, "no points in profile[%s]\n", file);
+      rc = false;
+   }
+
+   return rc;
+}
+
+bool profile_init(ps_profile_t *profile, ALLEGRO_CONFIG *cfg)
+{
+   const char *points, *file, *str;
+   double full_output = 0, v_program_max = 0;
+   uint32_t i;
+   bool rc;
+
+   memset(profile, 0, sizeof(*profile));
+
+   /* profile is optional, off without points */
+   points = al_get_config_value(cfg, "profile", "points");
+   file = al_get_config_value(cfg, "profile", "file");
+   if ((points == NULL) && (file == NULL))
+      return true;
+   if ((points != NULL) && (file != NULL)) {
+      fprintf(stderr, "profile takes either points or file in section[profile]!\n");
+      return false;
+   }
+
+   rc = read_profile_config(cfg, "power_supply", "voltage_full_output", &full_output);
+   if (rc == false)
+      return false;
+   rc = read_profile_config(cfg, "power_supply", "v_program_max", &v_program_max);
+   if (rc == false)
+      return false;
+   if ((full_output <= 0) || (v_program_max <= 0)) {
+      fprintf(stderr, "profile needs voltage_full_output and v_program_max!\n");
+      return false;
+   }
+
+   profile->rate = PROFILE_RATE_DEFAULT;
+   rc = read_profile_config(cfg, "profile", "rate", &profile->rate);
+   if (rc == false)
+      return false;
+   if (!(profile->rate > 0)) {
+      fprintf(stderr, "profile rate[%g] out of range!\n", profile->rate);
+      return false;
+   }
+
+   str = al_get_config_value(cfg, "profile", "start");
+   if ((str == NULL) || (strcmp(str, "api") == 0)) {
+      profile->on_enable = false;
+   } else if (strcmp(str, "enable") == 0) {
+      profile->on_enable = true;
+   } else {
+      fprintf(stderr, "profile start[%s] is neither api nor enable!\n", str);
+      return false;
+   }
+
+   if (points != NULL)
+      rc = parse_points(profile, points);
+   else
+      rc = read_points(profile, file);
+   if (rc == false) {
+      profile->points_n = 0;
+      return false;
+   }
+
+   for (i = 0; i < profile->points_n; i++) {
+      if (profile->volts[i] > full_output) {
+         fprintf(stderr, "profile voltage[%g] above full output!\n", profile->volts[i]);
+         profile->points_n = 0;
+         return false;
+      }
+      profile->volts[i] *= v_program_max / full_output;
+   }
+
+   return true;
+}
+
+/* sample the breakpoints every 1/rate seconds, one sample past the last */
+bool profile_compile(ps_profile_t *profile, double rate)
+{
+   const double *times = profile->times;
+   const double *volts = profile->volts;
+   uint32_t last = profile->points_n - 1;
+   double samples, t;
+   double *values;
+   uint32_t n, i, j = 0;
+
+   if (profile->points_n == 0)
+      return false;
+
+   samples = times[last] * rate + 1;
+   if (samples > PS_PROFILE_SAMPLES_MAX) {
+      fprintf(stderr, "profile of %g s at %g Hz longer than %d samples\n",
+              times[last], rate, PS_PROFILE_SAMPLES_MAX);
+      return false;
+   }
+   n = samples;
+
+   values = realloc(profile->values, n * sizeof(double));
+   if (values == NULL) {
+      fprintf(stderr, "no memory for a profile of %d samples\n", n);
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      t = i / rate;
+      while ((j < last) && (times[j + 1] <= t))
+         j++;
+      if ((j == last) || (t <= times[j]))
+         values[i] = volts[j];
+      else
+         values[i] = volts[j] + (volts[j + 1] - volts[j]) *
+                     (t - times[j]) / (times[j + 1] - times[j]);
+   }
+   /* the output is left at the last point */
+   values[n - 1] = volts[last];
+
+   profile->values = values;
+   profile->n = n;
+
+#ifdef DEBUG
+   printf("profile of %d points, %d samples at %g Hz\n", profile->points_n, n, rate);
+#endif
+
+   return true;
+}
+
+void profile_free(ps_profile_t *profile)
+{
+   free(profile->values);
+   profile->values = NULL;
+   profile->n = 0;
+}
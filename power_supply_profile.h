@@ -0,0 +1,48 @@
+/*
+ * Header file for the output voltage profile
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_PROFILE_H
+#define __POWER_SUPPLY_PROFILE_H
+
+#define PS_PROFILE_POINTS_MAX 4096
+/* 17 minutes at 1 kHz */
+#define PS_PROFILE_SAMPLES_MAX (1 << 20)
+
+/* types */
+
+typedef struct ps_profile {
+   /* breakpoints in seconds and program volts, none when off */
+   uint32_t points_n;
+   double times[PS_PROFILE_POINTS_MAX];
+   double volts[PS_PROFILE_POINTS_MAX];
+   double rate;
+   /* run when enable is written high, a soft start */
+   bool on_enable;
+   /* program volts every 1/rate seconds, NULL until compiled */
+   double *values;
+   uint32_t n;
+} ps_profile_t;
+
+/* functions */
+
+bool profile_init(ps_profile_t *profile, ALLEGRO_CONFIG *cfg);
+bool profile_compile(ps_profile_t *profile, double rate);
+void profile_free(ps_profile_t *profile);
+
+#endif /* __POWER_SUPPLY_PROFILE_H */
@@ -0,0 +1,274 @@
+/*
+ * Telemetry flight recorder
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The recorder keeps the raw status samples, every program voltage and
+ * every digital write in a ring of fixed size records inside a shared
+ * file mapping. Only the control thread writes, a record costs a few
+ * stores and a vDSO clock read, no syscall. The pages belong to the page
+ * cache, so whatever was stored survives a crash of the process and
+ * ps_recdump reads it back. The recording of the previous run is kept
+ * as <file>.prev when a new one starts.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "power_supply_rec.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define REC_RECORDS_DEFAULT (1 << 20)
+
+_Static_assert(sizeof(rec_record_t) == REC_RECORD_SIZE, "record size");
+_Static_assert(sizeof(rec_header_t) <= REC_HEADER_SIZE, "header size");
+
+static uint64_t clock_ns(clockid_t clock);
+static rec_record_t *rec_begin(ps_recorder_t *rec, uint64_t t_ns, uint32_t type);
+static void rec_end(ps_recorder_t *rec, rec_record_t *record);
+
+bool rec_init(ps_recorder_t *rec, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+   double value;
+
+   memset(rec, 0, sizeof(*rec));
+
+   /* recorder is optional, off without a file */
+   str = al_get_config_value(cfg, "recorder", "file");
+   if (str == NULL)
+      return true;
+   if (strlen(str) >= sizeof(rec->file)) {
+      fprintf(stderr, "requested value (key[file] in section[recorder]) too long!\n");
+      return false;
+   }
+   strcpy(rec->file, str);
+
+   rec->capacity = REC_RECORDS_DEFAULT;
+   str = al_get_config_value(cfg, "recorder", "records");
+   if (str != NULL) {
+      errno = 0;
+      value = strtod(str, NULL);
+      if ((errno == ERANGE) || (value < 1) || (value > (1ULL << 32))) {
+         fprintf(stderr, "records[%s] in section[recorder] out of range!\n", str);
+         return false;
+      }
+      rec->capacity = value;
+   }
+
+   return true;
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+   struct timespec ts;
+
+   clock_gettime(clock, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool rec_open(ps_recorder_t *rec)
+{
+   char prev[sizeof(rec->file) + sizeof(".prev")];
+   size_t size;
+   void *map;
+   int fd, err;
+
+   if (rec->file[0] == '\0')
+      return true;
+
+   snprintf(prev, sizeof(prev), "%s.prev", rec->file);
+   if ((rename(rec->file, prev) == -1) && (errno != ENOENT))
+      fprintf(stderr, "failed to keep previous recording: %s\n", strerror(errno));
+
+   size = REC_HEADER_SIZE + rec->capacity * REC_RECORD_SIZE;
+   fd = open(rec->file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd == -1) {
+      fprintf(stderr, "failed to create recording[%s]: %s\n", rec->file, strerror(errno));
+      return false;
+   }
+   /* blocks are allocated now, a full disk must not SIGBUS a store later */
+   err = posix_fallocate(fd, 0, size);
+   if (err != 0) {
+      fprintf(stderr, "failed to allocate recording[%s]: %s\n", rec->file, strerror(err));
+      close(fd);
+      return false;
+   }
+   /* populated so the first pass over the ring takes no page faults */
+   map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "failed to map recording[%s]: %s\n", rec->file, strerror(errno));
+      return false;
+   }
+
+   rec->header = map;
+   rec->records = (rec_record_t *)((char *)map + REC_HEADER_SIZE);
+   rec->map_size = size;
+   rec->written = 0;
+
+   rec->header->version = REC_VERSION;
+   rec->header->record_size = REC_RECORD_SIZE;
+   rec->header->header_size = REC_HEADER_SIZE;
+   rec->header->capacity = rec->capacity;
+   rec->header->written = 0;
+   rec->header->realtime_offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+   /* magic last, a reader ignores a file without it */
+   __atomic_store_n(&rec->header->magic, REC_MAGIC, __ATOMIC_RELEASE);
+
+   return true;
+}
+
+void rec_scan_setup(ps_recorder_t *rec, const uint32_t *channels, uint32_t n,
+                    double scan_rate, const double *range_min,
+                    const double *range_max, const uint32_t *maxdata)
+{
+   uint32_t i;
+
+   if ((rec->header == NULL) || (n > REC_CHANNELS_MAX))
+      return;
+
+   for (i = 0; i < n; i++) {
+      rec->header->scan_channels[i] = channels[i];
+      rec->header->range_min[i] = range_min[i];
+      rec->header->range_max[i] = range_max[i];
+      rec->header->maxdata[i] = maxdata[i];
+   }
+   rec->header->scan_rate = scan_rate;
+   rec->header->scan_n = n;
+   rec->scan_period_ns = 1e9 / scan_rate;
+}
+
+/* slot of the next record, seq cleared first so a reader skips it */
+static rec_record_t *rec_begin(ps_recorder_t *rec, uint64_t t_ns, uint32_t type)
+{
+   rec_record_t *record = &rec->records[rec->written % rec->capacity];
+
+   __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   record->t_ns = t_ns;
+   record->type = type;
+   record->n = 0;
+   record->channel = 0;
+
+   return record;
+}
+
+static void rec_end(ps_recorder_t *rec, rec_record_t *record)
+{
+   rec->written++;
+   __atomic_store_n(&record->seq, (uint32_t)rec->written, __ATOMIC_RELEASE);
+   __atomic_store_n(&rec->header->written, rec->written, __ATOMIC_RELEASE);
+}
+
+/* scan_tap_t of the plugin, the newest scan of a pass is taken as now
+ * and the older ones a scan period apart before it
+ */
+void rec_scan(void *ctx, const uint32_t *codes, uint32_t first,
+              uint32_t scans, uint32_t total)
+{
+   ps_recorder_t *rec = ctx;
+   rec_record_t *record;
+   uint32_t scan_n, s, c, i;
+   uint64_t t_ns;
+
+   if (rec->header == NULL)
+      return;
+
+   if (first == 0)
+      rec->scan_now_ns = clock_ns(CLOCK_MONOTONIC);
+
+   scan_n = rec->header->scan_n;
+   for (s = 0; s < scans; s++) {
+      t_ns = rec->scan_now_ns - (uint64_t)(total - 1 - first - s) * rec->scan_period_ns;
+      for (c = 0; c < scan_n; c += REC_CODES_N) {
+         record = rec_begin(rec, t_ns, rec_type_scan);
+         record->channel = c;
+         for (i = 0; (i < REC_CODES_N) && (c + i < scan_n); i++)
+            record->u.codes[i] = codes[s * scan_n + c + i];
+         record->n = i;
+         rec_end(rec, record);
+      }
+   }
+}
+
+void rec_input(ps_recorder_t *rec, uint32_t channel, double value)
+{
+   rec_record_t *record;
+
+   if (rec->header == NULL)
+      return;
+
+   record = rec_begin(rec, clock_ns(CLOCK_MONOTONIC), rec_type_input);
+   record->channel = channel;
+   record->n = 1;
+   record->u.value = value;
+   rec_end(rec, record);
+}
+
+void rec_setpoint(ps_recorder_t *rec, uint32_t channel, double value)
+{
+   rec_record_t *record;
+
+   if (rec->header == NULL)
+      return;
+
+   record = rec_begin(rec, clock_ns(CLOCK_MONOTONIC), rec_type_setpoint);
+   record->channel = channel;
+   record->n = 1;
+   record->u.value = value;
+   rec_end(rec, record);
+}
+
+void rec_dio(ps_recorder_t *rec, uint32_t mask, uint32_t bits)
+{
+   rec_record_t *record;
+
+   if (rec->header == NULL)
+      return;
+
+   record = rec_begin(rec, clock_ns(CLOCK_MONOTONIC), rec_type_dio);
+   record->u.dio.mask = mask;
+   record->u.dio.bits = bits & mask;
+   rec_end(rec, record);
+}
+
+void rec_close(ps_recorder_t *rec)
+{
+   if (rec->header == NULL)
+      return;
+
+#ifdef DEBUG
+   printf("recorded %llu records\n", (unsigned long long)rec->written);
+#endif
+   /* no msync, the page cache writes it back like after a crash */
+   munmap(rec->header, rec->map_size);
+   rec->header = NULL;
+   rec->records = NULL;
+}
@@ -0,0 +1,122 @@
+/*
+ * Header file for the telemetry flight recorder
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_REC_H
+#define __POWER_SUPPLY_REC_H
+
+#include <stdint.h>
+
+/* File format, native byte order.
+ *
+ * A rec_header_t padded to REC_HEADER_SIZE is followed by capacity
+ * records of REC_RECORD_SIZE bytes. Record number i, counted from the
+ * start of the recording, lives in slot i % capacity and carries
+ * seq = i + 1 once complete, written records are counted by written.
+ * The oldest record still in the file is written - capacity when the
+ * ring has wrapped and zero otherwise.
+ */
+
+#define REC_MAGIC 0x31434552 /* "REC1" */
+#define REC_VERSION 1
+#define REC_HEADER_SIZE 4096
+#define REC_RECORD_SIZE 32
+#define REC_CHANNELS_MAX 16
+/* raw codes of one scan record, longer scans take several records */
+#define REC_CODES_N 8
+
+/* record types */
+enum {
+   /* raw codes of scan channels channel .. channel + n - 1 */
+   rec_type_scan = 1,
+   /* single read of analog input channel in volts */
+   rec_type_input,
+   /* program voltage written to analog output channel */
+   rec_type_setpoint,
+   /* digital lines in mask written with bits */
+   rec_type_dio,
+};
+
+typedef struct rec_record {
+   /* CLOCK_MONOTONIC [ns] */
+   uint64_t t_ns;
+   /* written last, record number + 1, zero while the slot is updated */
+   uint32_t seq;
+   uint8_t type;
+   uint8_t n;
+   uint16_t channel;
+   union {
+      uint16_t codes[REC_CODES_N];
+      double value;
+      struct {
+         uint32_t mask;
+         uint32_t bits;
+      } dio;
+   } u;
+} rec_record_t;
+
+typedef struct rec_header {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t record_size;
+   uint32_t header_size;
+   uint64_t capacity;
+   /* records written so far */
+   uint64_t written;
+   /* add to t_ns for CLOCK_REALTIME */
+   int64_t realtime_offset_ns;
+   /* status scan, scan_n is zero without one */
+   double scan_rate;
+   uint32_t scan_n;
+   uint32_t scan_channels[REC_CHANNELS_MAX];
+   double range_min[REC_CHANNELS_MAX];
+   double range_max[REC_CHANNELS_MAX];
+   uint32_t maxdata[REC_CHANNELS_MAX];
+} rec_header_t;
+
+/* types */
+
+typedef struct ps_recorder {
+   /* empty when the recorder is off */
+   char file[256];
+   uint64_t capacity;
+   /* mapping of the whole file, NULL unless recording */
+   rec_header_t *header;
+   rec_record_t *records;
+   size_t map_size;
+   uint64_t written;
+   /* scan period and the time the scans of one tap pass end at */
+   uint64_t scan_period_ns;
+   uint64_t scan_now_ns;
+} ps_recorder_t;
+
+/* functions */
+
+bool rec_init(ps_recorder_t *rec, ALLEGRO_CONFIG *cfg);
+bool rec_open(ps_recorder_t *rec);
+void rec_scan_setup(ps_recorder_t *rec, const uint32_t *channels, uint32_t n,
+                    double scan_rate, const double *range_min,
+                    const double *range_max, const uint32_t *maxdata);
+void rec_scan(void *ctx, const uint32_t *codes, uint32_t first,
+              uint32_t scans, uint32_t total);
+void rec_input(ps_recorder_t *rec, uint32_t channel, double value);
+void rec_setpoint(ps_recorder_t *rec, uint32_t channel, double value);
+void rec_dio(ps_recorder_t *rec, uint32_t mask, uint32_t bits);
+void rec_close(ps_recorder_t *rec);
+
+#endif /* __POWER_SUPPLY_REC_H */
@@ -0,0 +1,183 @@
+/*
+ * Output voltage regulator
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Closed loop on the voltage monitor of the supply. The requested program
+ * voltage goes out as it is, a PID controller adds a correction of at most
+ * [regulation] trim volts so the monitor reads what was requested. The
+ * derivative acts on the measurement so a setpoint step gives no kick,
+ * the integral stops growing while the correction or the output is at its
+ * limit. The control thread runs it at [regulation] rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <allegro5/allegro.h>
+
+#include "types.h"
+#include "power_supply_reg.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define REG_RATE_DEFAULT 1000
+#define REG_MONITOR_FULL_DEFAULT 10
+#define REG_KP_DEFAULT 0.5
+#define REG_KI_DEFAULT 20
+#define REG_TRIM_DEFAULT 0.5
+#define REG_WINDOW_DEFAULT 10
+/* the status leds are read from inputs 8 and up, the monitor takes a
+ * free one below */
+#define REG_CHANNEL_MAX 7
+
+static bool read_reg_config(ALLEGRO_CONFIG *cfg, char *key, double *value);
+
+/* optional numeric key, value untouched if absent */
+static bool read_reg_config(ALLEGRO_CONFIG *cfg, char *key, double *value)
+{
+   const char *str;
+   double d_value;
+
+   str = al_get_config_value(cfg, "regulation", key);
+   if (str == NULL)
+      return true;
+
+   errno = 0;
+   d_value = strtod(str, NULL);
+   if (errno == ERANGE) {
+      fprintf(stderr, "failed to convert %s value from section[regulation]!\n", key);
+      return false;
+   }
+   *value = d_value;
+
+   return true;
+}
+
+bool reg_init(ps_regulator_t *reg, ALLEGRO_CONFIG *cfg)
+{
+   const char *str;
+   char *end;
+   long channel;
+
+   memset(reg, 0, sizeof(*reg));
+
+   /* regulation is optional, off without a monitor input */
+   str = al_get_config_value(cfg, "regulation", "channel");
+   if (str == NULL)
+      return true;
+   errno = 0;
+   channel = strtol(str, &end, 10);
+   if ((errno != 0) || (end == str) || (*end != '\0') ||
+       (channel < 0) || (channel > REG_CHANNEL_MAX)) {
+      fprintf(stderr, "regulation channel[%s] is not a free input 0..%d!\n",
+              str, REG_CHANNEL_MAX);
+      return false;
+   }
+   reg->channel = channel;
+
+   reg->rate = REG_RATE_DEFAULT;
+   reg->monitor_full = REG_MONITOR_FULL_DEFAULT;
+   reg->kp = REG_KP_DEFAULT;
+   reg->ki = REG_KI_DEFAULT;
+   reg->trim = REG_TRIM_DEFAULT;
+   reg->window = REG_WINDOW_DEFAULT;
+   if ((read_reg_config(cfg, "rate", &reg->rate) == false) ||
+       (read_reg_config(cfg, "monitor_full", &reg->monitor_full) == false) ||
+       (read_reg_config(cfg, "kp", &reg->kp) == false) ||
+       (read_reg_config(cfg, "ki", &reg->ki) == false) ||
+       (read_reg_config(cfg, "kd", &reg->kd) == false) ||
+       (read_reg_config(cfg, "trim", &reg->trim) == false) ||
+       (read_reg_config(cfg, "window", &reg->window) == false))
+      return false;
+
+   if (!(reg->rate > 0) || !(reg->monitor_full > 0) || !(reg->trim >= 0) ||
+       !(reg->window > 0) || (reg->kp < 0) || (reg->ki < 0) || (reg->kd < 0)) {
+      fprintf(stderr, "regulation settings out of range!\n");
+      return false;
+   }
+   reg->on = true;
+
+   return true;
+}
+
+/* open loop again, the next update starts from scratch */
+void reg_reset(ps_regulator_t *reg)
+{
+   reg->primed = false;
+   reg->integral = 0;
+}
+
+/* program voltage to write for setpoint given the measured one */
+double reg_update(ps_regulator_t *reg, double setpoint, double measured,
+                  double v_max, double v_min)
+{
+   double error = setpoint - measured;
+   double integral, derivative = 0, correction, output;
+
+   if (reg->primed == true)
+      derivative = -(measured - reg->measured) * reg->rate;
+   reg->measured = measured;
+   reg->primed = true;
+
+   /* a charger only pushes up, boosting while it slews overshoots,
+    * the loop takes over once the output got within trim */
+   if (fabs(error) > reg->trim) {
+      reg->output = setpoint;
+      return setpoint;
+   }
+
+   integral = reg->integral + reg->ki * error / reg->rate;
+   if (integral > reg->trim)
+      integral = reg->trim;
+   else if (integral < -reg->trim)
+      integral = -reg->trim;
+
+   correction = reg->kp * error + integral + reg->kd * derivative;
+   if (correction > reg->trim) {
+      correction = reg->trim;
+      if (error > 0)
+         integral = reg->integral;
+   } else if (correction < -reg->trim) {
+      correction = -reg->trim;
+      if (error < 0)
+         integral = reg->integral;
+   }
+
+   output = setpoint + correction;
+   if (output > v_max) {
+      output = v_max;
+      if (error > 0)
+         integral = reg->integral;
+   } else if (output < v_min) {
+      output = v_min;
+      if (error < 0)
+         integral = reg->integral;
+   }
+   reg->integral = integral;
+   reg->output = output;
+
+#ifdef DEBUG
+   printf("regulation sp %g pv %g out %g\n", setpoint, measured, output);
+#endif
+
+   return output;
+}
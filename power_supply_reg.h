@@ -0,0 +1,53 @@
+/*
+ * Header file for the output voltage regulator
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_REG_H
+#define __POWER_SUPPLY_REG_H
+
+/* types */
+
+typedef struct ps_regulator {
+   /* settings, off without a monitor channel */
+   bool on;
+   uint32_t channel;
+   double rate;
+   /* monitor volts at full output */
+   double monitor_full;
+   double kp;
+   double ki;
+   double kd;
+   /* largest correction of the program voltage [V] */
+   double trim;
+   /* seconds covered by the published statistics */
+   double window;
+   /* controller state, program volts */
+   bool primed;
+   double integral;
+   double measured;
+   double output;
+} ps_regulator_t;
+
+/* functions */
+
+bool reg_init(ps_regulator_t *reg, ALLEGRO_CONFIG *cfg);
+void reg_reset(ps_regulator_t *reg);
+double reg_update(ps_regulator_t *reg, double setpoint, double measured,
+                  double v_max, double v_min);
+
+#endif /* __POWER_SUPPLY_REG_H */
@@ -0,0 +1,193 @@
+/*
+ * Header file for the tracepoints
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_TRACE_H
+#define __POWER_SUPPLY_TRACE_H
+
+#include <stdint.h>
+
+/* TRACE_BEGIN() and TRACE_END() mark where a span of work starts and
+ * ends, arg is a channel, an index or a result. Without PS_TRACE, make
+ * TRACE=1 sets it, they compile to nothing.
+ *
+ * With it every thread gets a ring of its own the first time it passes a
+ * tracepoint, a file mapping in PS_TRACE_DIR, /tmp unless set, named
+ * ps-trace-<pid>-<tid>-<n>.bin. Each source file and each plugin has its
+ * own ring per thread, so a record is a few plain stores, no lock and no
+ * syscall. The oldest records are overwritten once a ring is full.
+ * ps_trace2json turns the files into Chrome trace JSON.
+ *
+ * File format, native byte order: a trace_header_t padded to
+ * TRACE_HEADER_SIZE followed by capacity records of TRACE_RECORD_SIZE
+ * bytes, record number i lives in slot i % capacity, written counts the
+ * records.
+ */
+
+#define TRACE_MAGIC 0x31435254 /* "TRC1" */
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 4096
+#define TRACE_RECORD_SIZE 16
+#define TRACE_RECORDS (1 << 16)
+
+/* tracepoints, names in ps_trace2json.c */
+enum {
+   /* plugin calls of the control thread, arg is the channel or mask,
+    * the result at the end */
+   trace_analog_input = 1,
+   trace_analog_output,
+   trace_digital_output,
+   /* status poll of the control thread */
+   trace_poll,
+   /* UI command, arg its type */
+   trace_command,
+   /* comedi calls inside pcidas1602_16, arg is the channel or mask */
+   trace_comedi_read,
+   trace_comedi_write,
+   trace_comedi_dio,
+   /* UI thread, the knob or button at the end of a mouse event, the
+    * supplies for draw_display */
+   trace_event_timer,
+   trace_event_mouse_axes,
+   trace_event_mouse_button_up,
+   trace_send_knobs,
+   trace_check_leds,
+   trace_draw_display,
+   TRACE_IDS,
+};
+
+/* phases */
+enum {
+   trace_begin = 0,
+   trace_end,
+};
+
+typedef struct trace_record {
+   /* CLOCK_MONOTONIC [ns] */
+   uint64_t t_ns;
+   uint16_t id;
+   uint8_t phase;
+   uint8_t reserved;
+   uint32_t arg;
+} trace_record_t;
+
+typedef struct trace_header {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t record_size;
+   uint32_t header_size;
+   uint64_t capacity;
+   uint64_t written;
+   int64_t pid;
+   int64_t tid;
+   /* add to t_ns for CLOCK_REALTIME */
+   int64_t realtime_offset_ns;
+} trace_header_t;
+
+#ifdef PS_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* ring of this thread in this source file, MAP_FAILED when it could not
+ * be set up */
+static __thread trace_header_t *trace_ring;
+
+static inline trace_header_t *trace_open(void)
+{
+   char file[256];
+   const char *dir;
+   struct timespec mono, real;
+   size_t size = TRACE_HEADER_SIZE + (size_t)TRACE_RECORDS * TRACE_RECORD_SIZE;
+   trace_header_t *header;
+   void *map;
+   int fd = -1, n;
+
+   dir = getenv("PS_TRACE_DIR");
+   if (dir == NULL)
+      dir = "/tmp";
+   for (n = 0; (fd == -1) && (n < 1000); n++) {
+      snprintf(file, sizeof(file), "%s/ps-trace-%d-%ld-%d.bin", dir, (int)getpid(),
+               (long)syscall(SYS_gettid), n);
+      fd = open(file, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+   }
+   if ((fd == -1) || (posix_fallocate(fd, 0, size) != 0)) {
+      fprintf(stderr, "no trace for this thread\n");
+      if (fd != -1)
+         close(fd);
+      return MAP_FAILED;
+   }
+   map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      return MAP_FAILED;
+
+   header = map;
+   header->version = TRACE_VERSION;
+   header->record_size = TRACE_RECORD_SIZE;
+   header->header_size = TRACE_HEADER_SIZE;
+   header->capacity = TRACE_RECORDS;
+   header->pid = getpid();
+   header->tid = syscall(SYS_gettid);
+   clock_gettime(CLOCK_MONOTONIC, &mono);
+   clock_gettime(CLOCK_REALTIME, &real);
+   header->realtime_offset_ns = (real.tv_sec - mono.tv_sec) * 1000000000LL +
+                                real.tv_nsec - mono.tv_nsec;
+   /* magic last, a reader ignores a file without it */
+   __atomic_store_n(&header->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+
+   return header;
+}
+
+static inline void trace_record(uint32_t id, uint32_t phase, uint32_t arg)
+{
+   trace_header_t *header = trace_ring;
+   trace_record_t *record;
+   struct timespec ts;
+
+   if (header == NULL)
+      header = trace_ring = trace_open();
+   if (header == MAP_FAILED)
+      return;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   record = (trace_record_t *)((char *)header + TRACE_HEADER_SIZE) +
+            header->written % TRACE_RECORDS;
+   record->t_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+   record->id = id;
+   record->phase = phase;
+   record->arg = arg;
+   __atomic_store_n(&header->written, header->written + 1, __ATOMIC_RELEASE);
+}
+
+#define TRACE_BEGIN(id, arg) trace_record((id), trace_begin, (arg))
+#define TRACE_END(id, arg) trace_record((id), trace_end, (arg))
+
+#else
+
+#define TRACE_BEGIN(id, arg) do { } while (0)
+#define TRACE_END(id, arg) do { } while (0)
+
+#endif /* PS_TRACE */
+
+#endif /* __POWER_SUPPLY_TRACE_H */
@@ -0,0 +1,1413 @@
+/*
+ * Widgets, drawing and mouse input of a supply
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdio.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_ttf.h>
+#include <allegro5/allegro_primitives.h>
+#include <allegro5/allegro_color.h>
+
+#include "types.h"
+#include "io_plugin.h"
+#include "power_supply_rec.h"
+#include "power_supply_profile.h"
+#include "power_supply_reg.h"
+#include "power_supply_metrics.h"
+#include "power_supply_ctl.h"
+#include "power_supply_api.h"
+#include "power_supply_burst.h"
+#include "power_supply_journal.h"
+#include "power_supply_trace.h"
+#include "power_supply_gfx.h"
+#include "power_supply_ui.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define LINE_THIKNESS 2.0f
+
+#define FONT_SIZE_12 12
+#define FONT_SIZE_24 24
+
+#define FONT_FILE "data/DejaVuSans.ttf"
+#define FONT_CACHE_N 8
+/* glyphs of a knob setting besides its title */
+#define FONT_WARM_TEXT "0123456789.- V"
+
+#define START_ANGLE 2*ALLEGRO_PI/3
+#define COUNTER_CW_LIMIT 2*ALLEGRO_PI/3
+#define CW_LIMIT 7*ALLEGRO_PI/3
+/* a turning knob is written at most every 20 ms */
+#define KNOB_INTERVAL_DEFAULT 0.02
+
+/* strips at the bottom for the regulation and burst summaries */
+#define SUMMARY_TEXT_X 20
+#define BURST_TEXT_Y (DISPLAY_Y - 20)
+#define REG_TEXT_Y (DISPLAY_Y - 40)
+
+static double convert_to_ps_voltage(power_supply_t *ps, double voltage);
+static bool read_ale_config(ALLEGRO_CONFIG *cfg, char *section,
+                            char *key, char *value, uint32_t len);
+static void draw_circle(led_t *led);
+static void draw_filled_circle(led_t *leds, ALLEGRO_COLOR color);
+static void draw_knob(knob_t *knob);
+static void draw_knob_text(knob_t *knob);
+static void layout_knob_text(knob_t *knob);
+static void draw_rectangle(control_t *controls);
+static void draw_filled_rectangle(control_t *controls, ALLEGRO_COLOR color);
+static ALLEGRO_FONT *load_cached_font(const char *file, unsigned short size);
+static void warm_font(ALLEGRO_FONT *font, const char *text);
+static bool init_fonts(void *obj, uint32_t obj_size,
+                       uint32_t n_elem, unsigned short font_size);
+static void init_colors(void *obj, uint32_t obj_size,
+                        uint32_t n_elem);
+static bool init_ps_config(power_supply_t *ps);
+static bool init_title_gfx(power_supply_t *ps);
+static bool init_leds_gfx(power_supply_t *ps);
+static bool init_knobs_gfx(power_supply_t *ps);
+static bool init_controls_gfx(power_supply_t *ps);
+static bool init_title(power_supply_t *ps);
+static bool init_leds(power_supply_t *ps);
+static bool init_knobs(power_supply_t *ps);
+static bool init_controls(power_supply_t *ps);
+static void region_add(region_t *region, bool *empty,
+                       float x1, float y1, float x2, float y2);
+static void dirty_region(power_supply_t *ps, region_t *region, bool *empty);
+static void changed_supply(power_supply_t *ps, region_t *region, bool *empty);
+static void draw_supply(power_supply_t *ps);
+static bool check_button(power_supply_t *ps, ALLEGRO_EVENT *event, int *button);
+static bool check_knob(power_supply_t *ps, ALLEGRO_EVENT *event, int *knob);
+
+static font_cache_t font_cache[FONT_CACHE_N];
+static uint32_t font_cache_n = 0;
+
+/* resolved once, see init_palette() */
+static ALLEGRO_COLOR palette[COLORS_N];
+
+static double convert_to_ps_voltage(power_supply_t *ps, double voltage)
+{
+   return ((ps->v_program_max * voltage) / ps->voltage_full_output);
+}
+
+static bool read_ale_config(ALLEGRO_CONFIG *cfg, char *section,
+                            char *key, char *value, uint32_t len)
+{
+   const char *str;
+   size_t str_len;
+
+   str = al_get_config_value(cfg, section, key);
+   if (str == NULL) {
+      fprintf(stderr, "failed to read key[%s] in section[%s]!\n", key, section);
+      return false;
+   }
+   str_len = strlen(str);
+   if (str_len > len) {
+      fprintf(stderr, "requested value (key[%s] in section[%s]) too long!\n",
+              key, section);
+      return false;
+   }
+   memset(value, 0, len);
+   memcpy(value, str, str_len);
+
+   return true;
+}
+
+static void draw_circle(led_t *led)
+{
+   ALLEGRO_COLOR color = led->gfx_color;
+   float text_width;
+   float text_x, text_y;
+
+   al_draw_circle(led->gfx.x, led->gfx.y, led->gfx.r, color, LINE_THIKNESS);
+
+   /* draw text centered bellow the circle */
+   text_width = al_get_text_width(led->font, led->title);
+   text_x = (led->gfx.x - led->gfx.r) + (led->gfx.r - text_width/2);
+   text_y = (led->gfx.y + led->gfx.r) + 5/100*led->gfx.r;
+   al_draw_textf(led->font, color, text_x, text_y, 0, "%s", led->title);
+}
+
+/* stays inside the outline drawn on the background */
+static void draw_filled_circle(led_t *led, ALLEGRO_COLOR color)
+{
+   al_draw_filled_circle(led->gfx.x, led->gfx.y,
+                         led->gfx.r - LINE_THIKNESS/2, color);
+}
+
+/* outer ring is on the background, only the indicator moves */
+static void draw_knob(knob_t *knob)
+{
+   ALLEGRO_COLOR color = knob->gfx_color;
+   circle_t gfx = knob->gfx;
+   float knob_r, knob_x, knob_y;
+
+   knob_r = knob->knob_r * gfx.r;
+   knob_x = knob_r * cosf(knob->angle) + gfx.x;
+   knob_y = knob_r * sinf(knob->angle) + gfx.y;
+   al_draw_circle(knob_x, knob_y, 4, color, LINE_THIKNESS);
+}
+
+static void draw_knob_text(knob_t *knob)
+{
+   al_draw_text(knob->font, knob->gfx_color, knob->text_x, knob->text_y, 0, knob->text);
+}
+
+/* formats and measures the setting text only when the setting changed */
+static void layout_knob_text(knob_t *knob)
+{
+   circle_t gfx = knob->gfx;
+   float title_width;
+
+   if ((knob->text_valid == true) && (knob->text_voltage == knob->voltage_setting))
+      return;
+
+   if (knob->text_valid == false) {
+      /* text starts where the title alone would be centered bellow the circle */
+      title_width = al_get_text_width(knob->font, knob->title);
+      knob->text_x = (gfx.x - gfx.r) + (gfx.r - title_width/2);
+      knob->text_y = (gfx.y + gfx.r) + 5/100*gfx.r;
+   }
+
+   snprintf(knob->text, sizeof(knob->text), "%s %f V", knob->title, knob->voltage_setting);
+   knob->text_width = al_get_text_width(knob->font, knob->text);
+   knob->text_voltage = knob->voltage_setting;
+   knob->text_valid = true;
+}
+
+static void draw_rectangle(control_t *control)
+{
+   ALLEGRO_COLOR color = control->gfx_color;
+   float text_width, rec_width, rec_height;
+   float text_x, text_y;
+
+   al_draw_rectangle(control->gfx.x1, control->gfx.y1,
+                     control->gfx.x2, control->gfx.y2, color, LINE_THIKNESS);
+
+   /* draw text centered bellow the rectangle */
+   text_width = al_get_text_width(control->font, control->title);
+   rec_width = control->gfx.x2 - control->gfx.x1;
+   rec_height = control->gfx.y2 - control->gfx.y1;
+   text_x = control->gfx.x1 + (rec_width - text_width)/2;
+   text_y = control->gfx.y2 + 5/100*rec_height;
+   al_draw_textf(control->font, color, text_x, text_y, 0, "%s", control->title);
+}
+
+/* stays inside the outline drawn on the background */
+static void draw_filled_rectangle(control_t *controls, ALLEGRO_COLOR color)
+{
+   al_draw_filled_rectangle(controls->gfx.x1 + LINE_THIKNESS/2,
+                            controls->gfx.y1 + LINE_THIKNESS/2,
+                            controls->gfx.x2 - LINE_THIKNESS/2,
+                            controls->gfx.y2 - LINE_THIKNESS/2, color);
+}
+
+bool init_allegro(void)
+{
+   bool rc = false;
+
+   if (!al_init()) {
+      fprintf(stderr, "failed to initialize allegro!\n");
+      return false;
+   }
+ 
+   rc = al_install_mouse();
+   if (rc == false) {
+      fprintf(stderr, "failed to install mouse!\n");
+      return false;
+   }
+ 
+   /* circles, rectangles, arcs ... */
+   rc = al_init_primitives_addon();
+   if (rc == false) {
+      fprintf(stderr, "failed to init primitives addon!\n");
+      return false;
+   }
+
+   /* font add-on is needed for ttf add-on */
+   al_init_font_addon();
+   al_init_ttf_addon();
+ 
+   return true;
+}
+
+static ALLEGRO_FONT *load_cached_font(const char *file, unsigned short size)
+{
+   font_cache_t *entry;
+   uint32_t i = 0;
+
+   for (i = 0; i < font_cache_n; i++) {
+      if ((font_cache[i].size == size) && !strcmp(font_cache[i].file, file))
+         return font_cache[i].font;
+   }
+
+   if (font_cache_n == FONT_CACHE_N) {
+      fprintf(stderr, "font cache full, file[%s] size[%d] not loaded!\n", file, size);
+      return NULL;
+   }
+   if (strlen(file) >= sizeof(font_cache[0].file)) {
+      fprintf(stderr, "font file name[%s] too long!\n", file);
+      return NULL;
+   }
+
+   entry = &font_cache[font_cache_n];
+   entry->font = al_load_font(file, size, 0);
+   if (entry->font == NULL)
+      return NULL;
+   strcpy(entry->file, file);
+   entry->size = size;
+   font_cache_n++;
+
+   return entry->font;
+}
+
+void destroy_fonts(void)
+{
+   uint32_t i = 0;
+
+   for (i = 0; i < font_cache_n; i++)
+      al_destroy_font(font_cache[i].font);
+   font_cache_n = 0;
+}
+
+/* draws nothing, gets the glyphs into the font's bitmap cache up front */
+static void warm_font(ALLEGRO_FONT *font, const char *text)
+{
+   al_draw_text(font, al_map_rgba(0, 0, 0, 0), 0, 0, 0, text);
+}
+
+static bool init_fonts(void *obj, uint32_t obj_size,
+                       uint32_t n_elem, unsigned short font_size)
+{
+   ALLEGRO_FONT **font;
+   uint32_t i = 0;
+
+   for (i = 0; i < n_elem; i++) {
+      font = obj;
+      *font = load_cached_font(FONT_FILE, font_size);
+      if (*font == NULL) {
+         fprintf(stderr, "failed to load title font size[%d]!\n", font_size);
+         return false; 
+      }
+      obj += obj_size;
+   }
+
+   return true;
+}
+
+static void init_colors(void *obj, uint32_t obj_size,
+                        uint32_t n_elem)
+{
+   ALLEGRO_COLOR *color;
+   uint32_t i = 0;
+
+   for (i = 0; i < n_elem; i++) {
+      color = obj;
+      *color = al_map_rgb(32, 92, 46); /* green */
+      obj += obj_size;
+   }
+}
+
+static bool init_ps_config(power_supply_t *ps)
+{
+   ALLEGRO_CONFIG *cfg = ps->cfg;
+   bool rc;
+   char value[256];
+   uint32_t l_value;
+
+   rc = read_ale_config(cfg, "power_supply", "voltage_full_output", &value[0], 255);
+   if (rc == false) {
+      fprintf(stderr, "failed to read configuration for voltage_full_output!\n");
+      return false;
+   }
+   l_value = strtol(value, NULL, 10);
+   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
+      fprintf(stderr, "failed to convert voltage_full_output value from section[power_supply]!\n");
+      return false;
+   }
+   ps->voltage_full_output = l_value;
+
+   memset(&value[0], 0, 255);
+   rc = read_ale_config(cfg, "power_supply", "v_program_max", &value[0], 255);
+   if (rc == false) {
+      fprintf(stderr, "failed to read configuration for v_program_max!\n");
+      return false;
+   }
+   l_value = strtol(value, NULL, 10);
+   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
+      fprintf(stderr, "failed to convert v_program_max value from section[power_supply]!\n");
+      return false;
+   }
+   ps->v_program_max = l_value;
+
+   memset(&value[0], 0, 255);
+   rc = read_ale_config(cfg, "power_supply", "v_program_min", &value[0], 255);
+   if (rc == false) {
+      fprintf(stderr, "failed to read configuration for v_program_min!\n");
+      return false;
+   }
+   l_value = strtol(value, NULL, 10);
+   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
+      fprintf(stderr, "failed to convert v_program_min value from section[power_supply]!\n");
+      return false;
+   }
+   ps->v_program_min = l_value;
+
+   /* optional, milliseconds in between two writes of a turning knob */
+   ps->knob_interval = KNOB_INTERVAL_DEFAULT;
+   if (al_get_config_value(cfg, "power_supply", "knob_interval") != NULL) {
+      memset(&value[0], 0, 255);
+      rc = read_ale_config(cfg, "power_supply", "knob_interval", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read configuration for knob_interval!\n");
+         return false;
+      }
+      l_value = strtol(value, NULL, 10);
+      if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
+         fprintf(stderr, "failed to convert knob_interval value from section[power_supply]!\n");
+         return false;
+      }
+      ps->knob_interval = l_value / 1000.0;
+   }
+
+   /* optional, drawing goes on without focus unless asked otherwise */
+   ps->suspend_inactive = false;
+   if (al_get_config_value(cfg, "power_supply", "suspend_inactive") != NULL) {
+      memset(&value[0], 0, 255);
+      rc = read_ale_config(cfg, "power_supply", "suspend_inactive", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read configuration for suspend_inactive!\n");
+         return false;
+      }
+      ps->suspend_inactive = !strcmp(value, "on");
+   }
+
+   memset(&value[0], 0, 255);
+   rc = read_ale_config(cfg, "power_supply", "leds", &value[0], 255);
+   if (rc == false) {
+      fprintf(stderr, "failed to read configuration for number of leds!\n");
+      return false;
+   }
+   l_value = strtol(value, NULL, 10);
+   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
+      fprintf(stderr, "failed to convert leds value from section[power_supply]!\n");
+      return false;
+   }
+   ps->LEDS_N = l_value;
+   ps->leds = malloc(ps->LEDS_N * sizeof(led_t));
+   if (ps->leds == NULL) {
+      fprintf(stderr, "failed to allocate memory for leds!\n");
+      return false;
+   }
+   memset(ps->leds, 0, ps->LEDS_N * sizeof(led_t));
+
+   memset(&value[0], 0, 255);
+   rc = read_ale_config(cfg, "power_supply", "knobs", &value[0], 255);
+   if (rc == false) {
+      fprintf(stderr, "failed to read configuration for number of knobs!\n");
+      return false;
+   }
+   l_value = strtol(value, NULL, 10);
+   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
+      fprintf(stderr, "failed to convert knobs value from section[power_supply]!\n");
+      return false;
+   }
+   ps->KNOBS_N = l_value;
+   ps->knobs = malloc(ps->KNOBS_N * sizeof(knob_t));
+   if (ps->knobs == NULL) {
+      fprintf(stderr, "failed to allocate memory for knobs!\n");
+      return false;
+   }
+   memset(ps->knobs, 0, ps->KNOBS_N * sizeof(knob_t));
+
+   memset(&value[0], 0, 255);
+   rc = read_ale_config(cfg, "power_supply", "controls", &value[0], 255);
+   if (rc == false) {
+      fprintf(stderr, "failed to read configuration for number of controls!\n");
+      return false;
+   }
+   l_value = strtol(value, NULL, 10);
+   if ((l_value == LONG_MIN) || (l_value == LONG_MAX)) {
+      fprintf(stderr, "failed to convert controls value from section[power_supply]!\n");
+      return false;
+   }
+   ps->CONTROLS_N = l_value;
+   ps->controls = malloc(ps->CONTROLS_N * sizeof(control_t));
+   if (ps->controls == NULL) {
+      fprintf(stderr, "failed to allocate memory for controls!\n");
+      return false;
+   }
+   memset(ps->controls, 0, ps->CONTROLS_N * sizeof(control_t));
+
+   return rc;
+}
+
+static bool init_title_gfx(power_supply_t *ps)
+{
+   ALLEGRO_CONFIG *cfg = ps->cfg;
+   bool rc;
+   char value[256];
+
+   rc = read_ale_config(cfg, "power_supply", "title", &value[0], 255);
+   if (rc == false) {
+      fprintf(stderr, "failed to read configuration for title!\n");
+      return false;
+   }
+   memcpy(&ps->title.title, value, strlen(value));
+
+   return rc;
+}
+
+static bool init_leds_gfx(power_supply_t *ps)
+{
+   ALLEGRO_CONFIG *cfg = ps->cfg;
+   int i;
+   bool rc;
+   char section[256] = {0};
+   char value[256];
+   float f_value;
+
+   for (i = 0; i < ps->LEDS_N; i++) {
+      switch(i) {
+      case overload:
+         memcpy(section, "overload_led", sizeof("overload_led"));
+         break;
+      case thermal_overload:
+         memcpy(section, "thermal_overload_led", sizeof("thermal_overload_led"));
+         break;
+      case interlock:
+         memcpy(section, "interlock_led", sizeof("interlock_led"));
+         break;
+      case overvoltage:
+         memcpy(section, "overvoltage_led", sizeof("overvoltage_led"));
+         break;
+      case end_of_charge:
+         memcpy(section, "end_of_charge_led", sizeof("end_of_charge_led"));
+         break;
+      case inhibit:
+         memcpy(section, "inhibit_led", sizeof("inhibit_led"));
+         break;
+      default:
+         fprintf(stderr, "unexpected led switch case!\n");
+         return false;
+      }
+
+      /* read x coordinate */
+      rc = read_ale_config(cfg, section, "x", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read x value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert x value from section[%s]!\n", section);
+         return false;
+      }
+      ps->leds[i].gfx.x = f_value;
+
+      /* read y coordinate */
+      rc = read_ale_config(cfg, section, "y", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read y value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert y value from section[%s]!\n", section);
+         return false;
+      }
+      ps->leds[i].gfx.y = f_value;
+
+      /* read r radius */
+      rc = read_ale_config(cfg, section, "r", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read r value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert r value from section[%s]!\n", section);
+         return false;
+      }
+      ps->leds[i].gfx.r = f_value;
+
+      /* read state */
+      rc = read_ale_config(cfg, section, "state", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
+         return false;
+      }
+      ps->leds[i].state = (!strcmp(value, "on") ? led_on : led_off);
+
+      /* read title */
+      rc = read_ale_config(cfg, section, "title", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
+         return false;
+      }
+      memcpy(&ps->leds[i].title, value, strlen(value));
+   }
+
+   return rc;
+}
+
+static bool init_knobs_gfx(power_supply_t *ps)
+{
+   ALLEGRO_CONFIG *cfg = ps->cfg;
+   int i;
+   bool rc;
+   char section[256] = {0};
+   char value[256];
+   float f_value;
+
+   for (i = 0; i < ps->KNOBS_N; i++) {
+      switch(i) {
+      case output_voltage_selector:
+         memcpy(section, "output_voltage_selector", sizeof("output_voltage_selector"));
+         break;
+      default:
+         fprintf(stderr, "unexpected knob switch case!\n");
+         return false;
+      }
+
+      /* read x coordinate */
+      rc = read_ale_config(cfg, section, "x", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read x value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert x value from section[%s]!\n", section);
+         return false;
+      }
+      ps->knobs[i].gfx.x = f_value;
+
+      /* read y coordinate */
+      rc = read_ale_config(cfg, section, "y", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read y value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert y value from section[%s]!\n", section);
+         return false;
+      }
+      ps->knobs[i].gfx.y = f_value;
+
+      /* read r radius */
+      rc = read_ale_config(cfg, section, "r", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read r value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert r value from section[%s]!\n", section);
+         return false;
+      }
+      ps->knobs[i].gfx.r = f_value;
+
+      /* read knob radius */
+      rc = read_ale_config(cfg, section, "knob_r", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read knob_r value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert knob_r value from section[%s]!\n", section);
+         return false;
+      }
+      ps->knobs[i].knob_r = f_value;
+
+      /* read angle */
+      rc = read_ale_config(cfg, section, "angle", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read angle value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert angle value from section[%s]!\n", section);
+         return false;
+      }
+      ps->knobs[i].angle = f_value;
+
+      /* read clock_wise limit */
+      rc = read_ale_config(cfg, section, "clock_wise_limit", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read clock_wise_limit value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert clock_wise_limit value from section[%s]!\n", section);
+         return false;
+      }
+      ps->knobs[i].clock_wise_limit = f_value;
+
+      /* read counter_clock_wise limit */
+      rc = read_ale_config(cfg, section, "counter_clock_wise_limit", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read counter_clock_wise_limit value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert counter_clock_wise_limit value from section[%s]!\n", section);
+         return false;
+      }
+      ps->knobs[i].counter_clock_wise_limit = f_value;
+
+      /* read voltage setting */
+      rc = read_ale_config(cfg, section, "voltage_setting", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read voltage_setting value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert voltage_setting value from section[%s]!\n", section);
+         return false;
+      }
+      ps->knobs[i].voltage_setting = f_value;
+
+      /* read title */
+      rc = read_ale_config(cfg, section, "title", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
+         return false;
+      }
+      memcpy(&ps->knobs[i].title, value, strlen(value));
+   }
+
+   return rc;
+}
+
+static bool init_controls_gfx(power_supply_t *ps)
+{
+   ALLEGRO_CONFIG *cfg = ps->cfg;
+   int i;
+   bool rc;
+   char section[256] = {0};
+   char value[256];
+   float f_value;
+
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      switch(i) {
+      case enable_power_supply:
+         memcpy(section, "enable_power_supply", sizeof("enable_power_supply"));
+         break;
+      case inhibit_power_supply:
+         memcpy(section, "inhibit_power_supply", sizeof("inhibit_power_supply"));
+         break;
+      case interlock_power_supply:
+         memcpy(section, "interlock_power_supply", sizeof("interlock_power_supply"));
+         break;
+      default:
+         fprintf(stderr, "unexpected control switch case!\n");
+         return false;
+      }
+
+      /* read x1 coordinate */
+      rc = read_ale_config(cfg, section, "x1", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read x1 value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert x1 value from section[%s]!\n", section);
+         return false;
+      }
+      ps->controls[i].gfx.x1 = f_value;
+
+      /* read y1 coordinate */
+      rc = read_ale_config(cfg, section, "y1", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read y1 value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert y1 value from section[%s]!\n", section);
+         return false;
+      }
+      ps->controls[i].gfx.y1 = f_value;
+
+      /* read x2 coordinate */
+      rc = read_ale_config(cfg, section, "x2", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read x2 value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert x2 value from section[%s]!\n", section);
+         return false;
+      }
+      ps->controls[i].gfx.x2 = f_value;
+
+      /* read y2 coordinate */
+      rc = read_ale_config(cfg, section, "y2", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read y2 value from section[%s]!\n", section);
+         return false;
+      }
+      f_value = strtof(value, NULL);
+      if (errno == ERANGE) {
+         fprintf(stderr, "failed to convert y2 value from section[%s]!\n", section);
+         return false;
+      }
+      ps->controls[i].gfx.y2 = f_value;
+
+      /* read state */
+      rc = read_ale_config(cfg, section, "state", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
+         return false;
+      }
+      ps->controls[i].state = (!strcmp(value, "on") ? key_on : key_off);
+
+      /* read title */
+      rc = read_ale_config(cfg, section, "title", &value[0], 255);
+      if (rc == false) {
+         fprintf(stderr, "failed to read title value from section[%s]!\n", section);
+         return false;
+      }
+      memcpy(&ps->controls[i].title, value, strlen(value));
+   }
+
+   return rc;
+}
+
+static bool init_title(power_supply_t *ps)
+{
+   bool rc;
+
+   rc = init_fonts(&ps->title.font, sizeof(title_t), 1, 24);
+   if (rc == false)
+      return false;
+
+   rc = init_title_gfx(ps);
+   if (rc == false)
+      return false;
+
+   return true;
+}
+
+static bool init_leds(power_supply_t *ps)
+{
+   bool rc;
+
+   init_colors(&ps->leds[0].gfx_color, sizeof(led_t), ps->LEDS_N);
+   rc = init_fonts(&ps->leds[0].font, sizeof(led_t), ps->LEDS_N, 12);
+   if (rc == false)
+      return false;
+
+   rc = init_leds_gfx(ps);
+   if (rc == false)
+      return false;
+
+   return true;
+}
+
+static bool init_controls(power_supply_t *ps)
+{
+   bool rc;
+
+   init_colors(&ps->controls[0].gfx_color, sizeof(control_t), ps->CONTROLS_N);
+   rc = init_fonts(&ps->controls[0].font, sizeof(control_t), ps->CONTROLS_N, 12);
+   if (rc == false)
+      return false;
+
+   rc = init_controls_gfx(ps);
+   if (rc == false)
+      return false;
+
+   return true;
+}
+
+static bool init_knobs(power_supply_t *ps)
+{
+   bool rc;
+
+   init_colors(&ps->knobs[0].gfx_color, sizeof(knob_t), ps->KNOBS_N);
+   rc = init_fonts(&ps->knobs[0].font, sizeof(knob_t), ps->KNOBS_N, 12);
+   if (rc == false)
+      return false;
+
+   rc = init_knobs_gfx(ps);
+   if (rc == false)
+      return false;
+
+   return true;
+}
+
+static void region_add(region_t *region, bool *empty,
+                       float x1, float y1, float x2, float y2)
+{
+   if (*empty == true) {
+      region->x1 = x1;
+      region->y1 = y1;
+      region->x2 = x2;
+      region->y2 = y2;
+      *empty = false;
+      return;
+   }
+
+   region->x1 = fminf(region->x1, x1);
+   region->y1 = fminf(region->y1, y1);
+   region->x2 = fmaxf(region->x2, x2);
+   region->y2 = fmaxf(region->y2, y2);
+}
+
+/* screen area covered by dirty widgets, their titles included */
+static void dirty_region(power_supply_t *ps, region_t *region, bool *empty)
+{
+   knob_t *knob;
+   float line;
+   int i = 0;
+
+   for (i = 0; i < ps->LEDS_N; i++) {
+      if (ps->leds[i].dirty == true)
+         region_add(region, empty, ps->leds[i].bounds.x1, ps->leds[i].bounds.y1,
+                    ps->leds[i].bounds.x2, ps->leds[i].bounds.y2);
+   }
+
+   for (i = 0; i < ps->KNOBS_N; i++) {
+      knob = &ps->knobs[i];
+      if (knob->dirty == false)
+         continue;
+      line = al_get_font_line_height(knob->font);
+      region_add(region, empty,
+                 fminf(knob->gfx.x - knob->gfx.r, knob->text_x) - LINE_THIKNESS,
+                 knob->gfx.y - knob->gfx.r - LINE_THIKNESS,
+                 fmaxf(knob->gfx.x + knob->gfx.r,
+                       knob->text_x + fmaxf(knob->text_width, knob->text_width_shown)) + LINE_THIKNESS,
+                 knob->text_y + line + LINE_THIKNESS);
+   }
+
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      if (ps->controls[i].dirty == true)
+         region_add(region, empty, ps->controls[i].bounds.x1, ps->controls[i].bounds.y1,
+                    ps->controls[i].bounds.x2, ps->controls[i].bounds.y2);
+   }
+
+   if (ps->reg_dirty == true)
+      region_add(region, empty, 0, REG_TEXT_Y, DISPLAY_X, BURST_TEXT_Y);
+
+   if (ps->burst_dirty == true)
+      region_add(region, empty, 0, BURST_TEXT_Y, DISPLAY_X, DISPLAY_Y);
+}
+
+void init_palette(void)
+{
+   palette[color_black] = al_map_rgb(0, 0, 0);
+   palette[color_white] = al_map_rgb(255, 255, 255);
+   palette[color_red] = al_color_name("red");
+   palette[color_yellow] = al_color_name("yellow");
+}
+
+/* everything that never moves, needs the display to exist,
+ * widget bounds for partial updates are measured here as well */
+bool init_background(power_supply_t *ps)
+{
+   ALLEGRO_BITMAP *target;
+   circle_t gfx;
+   rectangle_t rec;
+   float half_width, line;
+   float x = 0;
+   int i = 0;
+
+   ps->background = al_create_bitmap(DISPLAY_X, DISPLAY_Y);
+   if (ps->background == NULL) {
+      fprintf(stderr, "failed to create background bitmap!\n");
+      return false;
+   }
+
+   target = al_get_target_bitmap();
+   al_set_target_bitmap(ps->background);
+   al_clear_to_color(palette[color_black]);
+
+   for (i = 0; i < ps->LEDS_N; i++) {
+      draw_circle(&ps->leds[i]);
+      gfx = ps->leds[i].gfx;
+      half_width = fmaxf(gfx.r, al_get_text_width(ps->leds[i].font, ps->leds[i].title) / 2);
+      line = al_get_font_line_height(ps->leds[i].font);
+      ps->leds[i].bounds.x1 = gfx.x - half_width - LINE_THIKNESS;
+      ps->leds[i].bounds.y1 = gfx.y - gfx.r - LINE_THIKNESS;
+      ps->leds[i].bounds.x2 = gfx.x + half_width + LINE_THIKNESS;
+      ps->leds[i].bounds.y2 = gfx.y + gfx.r + line + LINE_THIKNESS;
+   }
+
+   for (i = 0; i < ps->KNOBS_N; i++) {
+      al_draw_circle(ps->knobs[i].gfx.x, ps->knobs[i].gfx.y, ps->knobs[i].gfx.r,
+                     ps->knobs[i].gfx_color, LINE_THIKNESS);
+      /* titles are cached by drawing them, the setting changes */
+      warm_font(ps->knobs[i].font, FONT_WARM_TEXT);
+   }
+
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      draw_rectangle(&ps->controls[i]);
+      rec = ps->controls[i].gfx;
+      half_width = al_get_text_width(ps->controls[i].font, ps->controls[i].title) / 2;
+      line = al_get_font_line_height(ps->controls[i].font);
+      ps->controls[i].bounds.x1 = fminf(rec.x1, (rec.x1 + rec.x2) / 2 - half_width) - LINE_THIKNESS;
+      ps->controls[i].bounds.y1 = rec.y1 - LINE_THIKNESS;
+      ps->controls[i].bounds.x2 = fmaxf(rec.x2, (rec.x1 + rec.x2) / 2 + half_width) + LINE_THIKNESS;
+      ps->controls[i].bounds.y2 = rec.y2 + line + LINE_THIKNESS;
+   }
+
+   x = (DISPLAY_X - al_get_text_width(ps->title.font, ps->title.title)) / 2;
+   al_draw_textf(ps->title.font, palette[color_white], x, 20, 0, "%s", ps->title.title);
+
+   ps->summary_font = load_cached_font(FONT_FILE, FONT_SIZE_12);
+   if (ps->summary_font == NULL)
+      return false;
+
+   al_set_target_bitmap(target);
+
+   return true;
+}
+
+/* region grows by the display area of the tile of a supply that changed
+ * since the last frame */
+static void changed_supply(power_supply_t *ps, region_t *region, bool *empty)
+{
+   region_t dirty;
+   bool clean = true;
+   int i = 0;
+
+   for (i = 0; i < ps->KNOBS_N; i++)
+      layout_knob_text(&ps->knobs[i]);
+
+   dirty_region(ps, &dirty, &clean);
+   if (clean == true)
+      return;
+   region_add(region, empty, dirty.x1 + ps->x0, dirty.y1,
+              dirty.x2 + ps->x0, dirty.y2);
+}
+
+/* draws the tile of a supply into the back buffer */
+static void draw_supply(power_supply_t *ps)
+{
+   ALLEGRO_TRANSFORM transform;
+   int i = 0;
+
+   /* widgets keep their configured coordinates, the tile is moved */
+   al_identity_transform(&transform);
+   al_translate_transform(&transform, ps->x0, 0);
+   al_use_transform(&transform);
+
+   /* the back buffer is always drawn whole, only presenting is partial,
+    * unlit leds and released controls show the black background */
+   al_draw_bitmap(ps->background, 0, 0, 0);
+   for (i = 0; i < ps->LEDS_N; i++) {
+      if (ps->leds[i].state == led_on)
+         draw_filled_circle(&ps->leds[i], palette[color_yellow]);
+   }
+
+   for (i = 0; i < ps->KNOBS_N; i++)
+      draw_knob(&ps->knobs[i]);
+
+   /* glyphs come from one font bitmap, let allegro batch them */
+   al_hold_bitmap_drawing(true);
+   for (i = 0; i < ps->KNOBS_N; i++)
+      draw_knob_text(&ps->knobs[i]);
+   al_hold_bitmap_drawing(false);
+
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      if (ps->controls[i].state == key_on)
+         draw_filled_rectangle(&ps->controls[i], palette[color_red]);
+   }
+
+   if (ps->reg_text[0] != '\0')
+      al_draw_text(ps->summary_font, palette[color_white], SUMMARY_TEXT_X, REG_TEXT_Y,
+                   0, ps->reg_text);
+
+   if (ps->burst.summary[0] != '\0')
+      al_draw_text(ps->summary_font, palette[color_white], SUMMARY_TEXT_X, BURST_TEXT_Y,
+                   0, ps->burst.summary);
+
+   al_identity_transform(&transform);
+   al_use_transform(&transform);
+
+   ps->redraw_all = false;
+   for (i = 0; i < ps->LEDS_N; i++)
+      ps->leds[i].dirty = false;
+   for (i = 0; i < ps->KNOBS_N; i++) {
+      ps->knobs[i].dirty = false;
+      ps->knobs[i].text_width_shown = ps->knobs[i].text_width;
+   }
+   for (i = 0; i < ps->CONTROLS_N; i++)
+      ps->controls[i].dirty = false;
+   ps->reg_dirty = false;
+   ps->burst_dirty = false;
+}
+
+/* draws a frame only when something changed since the last one, the
+ * supplies sit side by side. A flip leaves the back buffer undefined and
+ * most drivers flip for al_update_display_region() too, so every tile is
+ * redrawn for any frame, only presenting stays partial. */
+void draw_display(power_supply_t **supplies, uint32_t n)
+{
+   region_t region;
+   bool empty = true, redraw_all = false;
+   float x = 0;
+   uint32_t i = 0;
+   uint64_t start;
+
+   if (supplies[0]->drawing_halted == true)
+      return;
+
+   start = now_ns();
+   for (i = 0; i < n; i++) {
+      if (supplies[i]->redraw_all == true)
+         redraw_all = true;
+   }
+   for (i = 0; i < n; i++)
+      changed_supply(supplies[i], &region, &empty);
+   if ((redraw_all == false) && (empty == true))
+      return;
+
+   for (i = 0; i < n; i++)
+      draw_supply(supplies[i]);
+
+   if (redraw_all == true) {
+      al_flip_display();
+   } else {
+      x = floorf(region.x1);
+      al_update_display_region(x, floorf(region.y1),
+                               ceilf(region.x2) - x, ceilf(region.y2) - floorf(region.y1));
+   }
+
+   /* the display is shared, every supply sees the frame */
+   for (i = 0; i < n; i++) {
+      metrics_since(&supplies[i]->ctl.metrics, metrics_frame, start);
+      metrics_count(&supplies[i]->ctl.metrics, metrics_frames, 1);
+   }
+}
+
+static bool check_button(power_supply_t *ps, ALLEGRO_EVENT *event, int *button)
+{
+   int i = 0;
+
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      if ((ps->controls[i].gfx.x2 >= event->mouse.x && ps->controls[i].gfx.x1 <= event->mouse.x) &&
+          (ps->controls[i].gfx.y2 >= event->mouse.y && ps->controls[i].gfx.y1 <= event->mouse.y)) {
+         *button = i;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static bool check_knob(power_supply_t *ps, ALLEGRO_EVENT *event, int *knob)
+{
+   int i = 0;
+   circle_t gfx;
+   float dx, dy;
+
+   for (i = 0; i < ps->KNOBS_N; i++) {
+      gfx = ps->knobs[i].gfx;
+      dx = event->mouse.x - gfx.x;
+      dy = event->mouse.y - gfx.y;
+      if ((dx * dx + dy * dy) <= gfx.r * gfx.r) {
+         *knob = i;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void check_leds(power_supply_t *ps)
+{
+   ps_status_t status;
+   knob_t *knob;
+   double voltage;
+   uint32_t state;
+   int i = 0;
+
+   ctl_status(&ps->ctl, &status);
+   /* configured states stay until the first poll */
+   if (status.polls == 0)
+      return;
+
+   /* the loop works in program volts, the display shows output volts */
+   if (status.reg.windows != ps->reg_windows) {
+      ps->reg_windows = status.reg.windows;
+      snprintf(ps->reg_text, sizeof(ps->reg_text),
+               "regulation error rms %.2f V max %.2f V, late max %.0f us, overruns %u",
+               status.reg.error_rms * ps->voltage_full_output / ps->v_program_max,
+               status.reg.error_max * ps->voltage_full_output / ps->v_program_max,
+               status.reg.late_max_us, status.reg.overruns);
+      ps->reg_dirty = true;
+   }
+
+   for (i = 0; i < ps->LEDS_N; i++) {
+      state = (status.leds & (1 << i)) ? led_on : led_off;
+      if (ps->leds[i].state != state) {
+         ps->leds[i].state = state;
+         ps->leds[i].dirty = true;
+      }
+   }
+
+   /* knobs and controls follow writes made through the control API and
+    * the last sample of a profile, except those with a turn or a click
+    * of their own not applied yet
+    */
+   if ((status.batch_writes == ps->batch_writes) &&
+       (status.profile_ends == ps->profile_ends))
+      return;
+   ps->batch_writes = status.batch_writes;
+   ps->profile_ends = status.profile_ends;
+
+   for (i = 0; (i < ps->KNOBS_N) && (i < PS_KNOBS_MAX); i++) {
+      knob = &ps->knobs[i];
+      if ((knob->pending == true) || (knob->command > status.commands))
+         continue;
+      voltage = status.knobs[i] * ps->voltage_full_output / ps->v_program_max;
+      if (fabs(knob->voltage_setting - voltage) < 1e-6 * ps->voltage_full_output)
+         continue;
+      knob->voltage_setting = voltage;
+      knob->angle = knob->counter_clock_wise_limit +
+                    (knob->clock_wise_limit - knob->counter_clock_wise_limit) *
+                    voltage / ps->voltage_full_output;
+      knob->dirty = true;
+      journal_knob(&ps->journal, i, knob->angle, knob->voltage_setting);
+   }
+
+   for (i = 0; i < ps->CONTROLS_N; i++) {
+      if (ps->controls[i].command > status.commands)
+         continue;
+      state = (status.controls & (1 << i)) ? key_on : key_off;
+      if (ps->controls[i].state != state) {
+         ps->controls[i].state = state;
+         ps->controls[i].dirty = true;
+         journal_control(&ps->journal, i, state);
+      }
+   }
+}
+
+/* folds the turn into the knob setting, send_knobs() writes it out */
+void process_event_mouse_axes(power_supply_t *ps, ALLEGRO_EVENT *event)
+{
+   float angle = 0;
+   float angle_delta = 0;
+   int knob = -1;
+   bool rc = false;
+
+#ifdef DEBUG
+   printf("event type[ALLEGRO_EVENT_MOUSE_AXES]\n");
+   printf("event->mouse.x[%d]\n", event->mouse.x);
+   printf("event->mouse.y[%d]\n", event->mouse.y);
+#endif
+   /* the pointer only moved, the knob stays as it is */
+   if (event->mouse.dz == 0)
+      return;
+
+   TRACE_BEGIN(trace_event_mouse_axes, 0);
+   rc = check_knob(ps, event, &knob);
+   if (rc == true) {
+      angle_delta = ALLEGRO_PI * event->mouse.dz / 256;
+      angle = ps->knobs[knob].angle + angle_delta;
+      if (angle < ps->knobs[knob].counter_clock_wise_limit) {
+         angle = ps->knobs[knob].counter_clock_wise_limit;
+         angle_delta = 0;
+         ps->knobs[knob].voltage_setting = 0;
+      } else if (angle > ps->knobs[knob].clock_wise_limit) {
+         angle = ps->knobs[knob].clock_wise_limit;
+         angle_delta = 0;
+         ps->knobs[knob].voltage_setting = ps->voltage_full_output;
+      }
+
+      ps->knobs[knob].angle = angle;
+      ps->knobs[knob].voltage_setting += ps->voltage_full_output*angle_delta/(CW_LIMIT - COUNTER_CW_LIMIT);
+      if (ps->knobs[knob].voltage_setting < 0)
+         ps->knobs[knob].voltage_setting = 0;
+      if (ps->knobs[knob].voltage_setting > ps->voltage_full_output)
+         ps->knobs[knob].voltage_setting = ps->voltage_full_output;
+      ps->knobs[knob].pending = true;
+      /* drawn with the next frame */
+      ps->knobs[knob].dirty = true;
+   }
+   TRACE_END(trace_event_mouse_axes, knob);
+}
+
+/* numbers the command, the knob or control keeps the number and is in
+ * flight until the control thread has taken it
+ */
+bool queue_command(power_supply_t *ps, uint32_t type, uint32_t index,
+                   double value, uint64_t *command)
+{
+   if (ctl_command(&ps->ctl, type, index, value) == false)
+      return false;
+   *command = ++ps->commands;
+
+   return true;
+}
+
+/* one write per knob for all the turns folded in since the last one, a
+ * knob written less than knob_interval ago waits for a later call
+ */
+void send_knobs(power_supply_t *ps)
+{
+   knob_t *knob;
+   double voltage, now;
+   int i = 0;
+   bool rc;
+
+   TRACE_BEGIN(trace_send_knobs, 0);
+   now = al_get_time();
+   for (i = 0; i < ps->KNOBS_N; i++) {
+      knob = &ps->knobs[i];
+      if ((knob->pending == false) || (now - knob->sent_time < ps->knob_interval))
+         continue;
+
+      voltage = convert_to_ps_voltage(ps, knob->voltage_setting);
+#ifdef DEBUG
+      printf("voltage for ale102 [%g]\n", voltage);
+#endif
+      rc = queue_command(ps, ps_cmd_knob, i, voltage, &knob->command);
+      if (rc == false) {
+         fprintf(stderr, "output for knob[%d] not queued\n", i);
+         continue;
+      }
+      knob->pending = false;
+      knob->sent_time = now;
+      journal_knob(&ps->journal, i, knob->angle, knob->voltage_setting);
+   }
+   TRACE_END(trace_send_knobs, 0);
+}
+
+void process_event_mouse_button_up(power_supply_t *ps, ALLEGRO_EVENT *event)
+{
+   int button = -1;
+   bool rc = false;
+
+#ifdef DEBUG
+   printf("event type[ALLEGRO_EVENT_MOUSE_BUTTON_UP]\n");
+#endif
+   TRACE_BEGIN(trace_event_mouse_button_up, 0);
+   rc = check_button(ps, event, &button);
+   if (rc == true) {
+#ifdef DEBUG
+      printf("button[%d] state[%d]\n", button, controls[button].state);
+#endif
+      if (ps->controls[button].state == key_on) {
+         ps->controls[button].state = key_off;
+         rc = queue_command(ps, ps_cmd_control, button, 0,
+                            &ps->controls[button].command);
+      } else {
+         ps->controls[button].state = key_on;
+         rc = queue_command(ps, ps_cmd_control, button, 1,
+                            &ps->controls[button].command);
+      }
+      if (rc == false)
+         fprintf(stderr, "output for button[%d] not queued\n", button);
+      journal_control(&ps->journal, button, ps->controls[button].state);
+      /* drawn with the next frame */
+      ps->controls[button].dirty = true;
+   }
+   TRACE_END(trace_event_mouse_button_up, button);
+}
+
+/* the configuration stays, the control side may still be reading it */
+bool init_elements(power_supply_t *ps)
+{
+   bool rc = false;
+
+   rc = init_ps_config(ps);
+   if (rc == false)
+      return false;
+
+#ifdef DEBUG
+   printf("leds[%d]\n", ps->LEDS_N);
+   printf("knobs[%d]\n", ps->KNOBS_N);
+   printf("controls[%d]\n", ps->CONTROLS_N);
+#endif
+
+   rc = init_leds(ps);
+   if (rc == false)
+      return false;
+
+   rc = init_controls(ps);
+   if (rc == false)
+      return false;
+
+   rc = init_knobs(ps);
+   if (rc == false)
+      return false;
+
+   rc = init_title(ps);
+   if (rc == false)
+      return false;
+
+   return true;
+}
+
+bool load_config_file(power_supply_t *ps, const char *file)
+{
+   if (strlen(file) >= sizeof(ps->cfg_file)) {
+      fprintf(stderr, "configuration file name[%s] too long!\n", file);
+      return false;
+   }
+   strcpy(ps->cfg_file, file);
+
+   ps->cfg = al_load_config_file(ps->cfg_file);
+   if (ps->cfg == NULL) {
+      fprintf(stderr, "failed to load %s file!\n", ps->cfg_file);
+      return false;
+   }
+
+   return true;
+}
+
+power_supply_t *allocate_main_object()
+{
+   power_supply_t *ps = NULL;
+
+   ps = calloc(1, sizeof(power_supply_t));
+   if (ps == NULL) {
+      perror("malloc error");
+      return NULL;
+   }
+   ps->reload_fd = -1;
+
+   return ps;
+}
+
+uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,50 @@
+/*
+ * Header file for the widgets of one supply
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __POWER_SUPPLY_UI_H
+#define __POWER_SUPPLY_UI_H
+
+/* Drawing, widget setup and mouse handling of one supply, shared by
+ * ps_prog and ps_bench. Include after power_supply_gfx.h.
+ */
+
+#define DISPLAY_X 640
+#define DISPLAY_Y 480
+
+#define CFG_FILE "data/power_supply.cfg"
+
+/* functions */
+
+bool init_allegro(void);
+void destroy_fonts(void);
+bool init_background(power_supply_t *ps);
+void init_palette(void);
+void draw_display(power_supply_t **supplies, uint32_t n);
+void check_leds(power_supply_t *ps);
+void process_event_mouse_axes(power_supply_t *ps, ALLEGRO_EVENT *event);
+bool queue_command(power_supply_t *ps, uint32_t type, uint32_t index,
+                   double value, uint64_t *command);
+void send_knobs(power_supply_t *ps);
+void process_event_mouse_button_up(power_supply_t *ps, ALLEGRO_EVENT *event);
+bool init_elements(power_supply_t *ps);
+bool load_config_file(power_supply_t *ps, const char *file);
+power_supply_t *allocate_main_object();
+uint64_t now_ns(void);
+
+#endif /* __POWER_SUPPLY_UI_H */
@@ -0,0 +1,278 @@
+/*
+ * Latency benchmark for the control path
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Feeds synthetic mouse events through the same handlers process_events()
+ * uses and measures how long it takes until the write reaches the card,
+ * that includes the hop through the control thread.
+ * Meant to run with comedi_shim.so preloaded (make bench), which records
+ * when comedi calls happen. Without the shim whole handler calls are
+ * timed instead.
+ *
+ *    ./ps_bench [iterations]
+ */
+
+/* RTLD_DEFAULT */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_ttf.h>
+
+#include "types.h"
+#include "io_plugin.h"
+#include "power_supply_rec.h"
+#include "power_supply_profile.h"
+#include "power_supply_reg.h"
+#include "power_supply_metrics.h"
+#include "power_supply_ctl.h"
+#include "power_supply_api.h"
+#include "power_supply_burst.h"
+#include "power_supply_journal.h"
+#include "power_supply_gfx.h"
+#include "power_supply_ui.h"
+#include "comedi_shim.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+#define BENCH_ITERATIONS 1000
+/* give up on a write that did not show up within a second */
+#define BENCH_WRITE_TIMEOUT_NS 1000000000ULL
+
+static comedi_shim_stats_t *shim_stats;
+
+static uint64_t bench_now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t *)a;
+   uint64_t y = *(const uint64_t *)b;
+
+   return (x > y) - (x < y);
+}
+
+static void bench_report(const char *name, uint64_t *samples, uint32_t n)
+{
+   if (n == 0) {
+      printf("%-32s no samples\n", name);
+      return;
+   }
+
+   qsort(samples, n, sizeof(uint64_t), bench_compare);
+   printf("%-32s p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  max %9.1f us\n",
+          name,
+          samples[(uint32_t)(0.5 * (n - 1))] / 1e3,
+          samples[(uint32_t)(0.99 * (n - 1))] / 1e3,
+          samples[(uint32_t)(0.999 * (n - 1))] / 1e3,
+          samples[n - 1] / 1e3);
+}
+
+/* time from t0 to the first card write after writes was sampled */
+static bool bench_wait_write(uint64_t writes, uint64_t t0, uint64_t *latency)
+{
+   if (shim_stats == NULL) {
+      *latency = bench_now_ns() - t0;
+      return true;
+   }
+
+   while (shim_stats->writes == writes) {
+      if (bench_now_ns() - t0 > BENCH_WRITE_TIMEOUT_NS)
+         return false;
+   }
+   __sync_synchronize();
+   *latency = shim_stats->last_write_ns - t0;
+
+   return true;
+}
+
+static uint32_t bench_knob(power_supply_t *ps, uint64_t *samples, uint32_t n)
+{
+   ALLEGRO_EVENT event;
+   uint64_t t0, writes;
+   uint32_t i, done = 0;
+
+   memset(&event, 0, sizeof(event));
+   event.type = ALLEGRO_EVENT_MOUSE_AXES;
+   event.mouse.x = ps->knobs[0].gfx.x;
+   event.mouse.y = ps->knobs[0].gfx.y;
+
+   for (i = 0; i < n; i++) {
+      /* wiggle around the current setting */
+      event.mouse.dz = (i % 2) ? 1 : -1;
+      writes = (shim_stats != NULL) ? shim_stats->writes : 0;
+      t0 = bench_now_ns();
+      process_event_mouse_axes(ps, &event);
+      send_knobs(ps);
+      if (bench_wait_write(writes, t0, &samples[done]) == true)
+         done++;
+   }
+
+   return done;
+}
+
+static uint32_t bench_button(power_supply_t *ps, uint64_t *samples, uint32_t n)
+{
+   ALLEGRO_EVENT event;
+   control_t *control;
+   uint64_t t0, writes;
+   uint32_t i, done = 0;
+
+   memset(&event, 0, sizeof(event));
+   event.type = ALLEGRO_EVENT_MOUSE_BUTTON_UP;
+
+   /* even number of clicks per control leaves it as it was */
+   for (i = 0; i < n; i++) {
+      control = &ps->controls[(i / 2) % ps->CONTROLS_N];
+      event.mouse.x = (control->gfx.x1 + control->gfx.x2) / 2;
+      event.mouse.y = (control->gfx.y1 + control->gfx.y2) / 2;
+      writes = (shim_stats != NULL) ? shim_stats->writes : 0;
+      t0 = bench_now_ns();
+      process_event_mouse_button_up(ps, &event);
+      if (bench_wait_write(writes, t0, &samples[done]) == true)
+         done++;
+   }
+
+   return done;
+}
+
+static uint32_t bench_cycle(power_supply_t *ps, uint64_t *samples, uint32_t n)
+{
+   uint64_t t0;
+   uint32_t i;
+
+   for (i = 0; i < n; i++) {
+      /* time a full frame, not the usual nothing to do */
+      ps->redraw_all = true;
+      t0 = bench_now_ns();
+      check_leds(ps);
+      draw_display(&ps, 1);
+      samples[i] = bench_now_ns() - t0;
+   }
+
+   return n;
+}
+
+int main(int argc, char **argv)
+{
+   power_supply_t *ps = NULL;
+   ALLEGRO_DISPLAY *display = NULL;
+   uint64_t *samples;
+   uint32_t iterations = BENCH_ITERATIONS;
+   uint32_t n;
+   bool rc = false;
+
+   if (argc > 1)
+      iterations = strtoul(argv[1], NULL, 10);
+   if (iterations == 0)
+      iterations = BENCH_ITERATIONS;
+
+   samples = malloc(iterations * sizeof(uint64_t));
+   if (samples == NULL) {
+      perror("malloc error");
+      return EXIT_FAILURE;
+   }
+
+   shim_stats = dlsym(RTLD_DEFAULT, "comedi_shim_stats");
+   if (shim_stats == NULL)
+      printf("comedi shim not preloaded, timing whole handlers\n");
+
+   ps = allocate_main_object();
+   if (ps == NULL)
+      return EXIT_FAILURE;
+
+   rc = load_config_file(ps, CFG_FILE);
+   if (rc == false)
+      return EXIT_FAILURE;
+
+   rc = ctl_init(&ps->ctl, ps->cfg);
+   if (rc == false)
+      return EXIT_FAILURE;
+
+   /* measured through the UI handlers, the control API is never started */
+   rc = api_init(&ps->api, ps->cfg);
+   if (rc == false)
+      return EXIT_FAILURE;
+
+   rc = burst_init(&ps->burst, ps->cfg);
+   if (rc == false)
+      return EXIT_FAILURE;
+
+   rc = init_allegro();
+   if (rc == false)
+      return EXIT_FAILURE;
+   init_palette();
+
+   rc = init_elements(ps);
+   if (rc == false)
+      return EXIT_FAILURE;
+   al_destroy_config(ps->cfg);
+   /* every event is timed on its own, nothing is held back */
+   ps->knob_interval = 0;
+
+   /* frames must not wait for the vertical retrace */
+   al_set_new_display_option(ALLEGRO_VSYNC, 2, ALLEGRO_SUGGEST);
+   display = al_create_display(DISPLAY_X, DISPLAY_Y);
+   if (display == NULL) {
+      fprintf(stderr, "failed to create display!\n");
+      return EXIT_FAILURE;
+   }
+   ps->redraw_all = true;
+
+   rc = init_background(ps);
+   if (rc == false)
+      return EXIT_FAILURE;
+
+   rc = ctl_start(&ps->ctl, ps->LEDS_N, ps->v_program_max, ps->v_program_min);
+   if (rc == false)
+      return EXIT_FAILURE;
+   draw_display(&ps, 1);
+
+   printf("%d iterations, status %s at %g Hz\n", iterations,
+          (ps->ctl.scan_running == true) ? "scan" : "single reads",
+          ps->ctl.poll_rate);
+
+   n = bench_knob(ps, samples, iterations);
+   bench_report("knob event -> analog output", samples, n);
+
+   n = bench_button(ps, samples, iterations);
+   bench_report("button event -> digital output", samples, n);
+
+   n = bench_cycle(ps, samples, iterations);
+   bench_report("check_leds + draw_display", samples, n);
+
+   al_destroy_bitmap(ps->background);
+   destroy_fonts();
+   al_destroy_display(display);
+
+   ctl_stop(&ps->ctl);
+
+   free(samples);
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,274 @@
+/*
+ * Shared memory metrics reader
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* ps_metrics prints the metrics of a running or finished controller, as
+ * a table or in the Prometheus text format. It maps the file read only
+ * and takes a copy, the controller does not notice.
+ *
+ *    ./ps_metrics <metrics> [prom]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* the metrics header needs it for metrics_init() only */
+typedef struct ALLEGRO_CONFIG ALLEGRO_CONFIG;
+
+#include "power_supply_metrics.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+typedef struct metric_name {
+   const char *name;
+   const char *help;
+   /* divides the raw values, 1e9 for times in seconds */
+   double scale;
+   const char *unit;
+} metric_name_t;
+
+static const metric_name_t counter_names[] = {
+   { "polls", "status polls of the control thread", 1, "" },
+   { "polls_missed", "polls a whole period or more behind", 1, "" },
+   { "commands", "UI commands applied", 1, "" },
+   { "batches", "control API batches applied", 1, "" },
+   { "io_errors", "plugin calls that failed", 1, "" },
+   { "frames", "frames drawn by ps_prog", 1, "" },
+};
+
+static const metric_name_t hist_names[] = {
+   { "analog_input", "analog_channel_input() call time", 1e9, "seconds" },
+   { "analog_output", "analog_channel_output() call time", 1e9, "seconds" },
+   { "digital_output", "digital write call time", 1e9, "seconds" },
+   { "poll_late", "start of a poll after its deadline", 1e9, "seconds" },
+   { "frame", "draw_display() time", 1e9, "seconds" },
+   { "event_queue", "events taken from the queue in one go", 1, "events" },
+};
+
+_Static_assert(sizeof(counter_names) / sizeof(counter_names[0]) == METRICS_COUNTERS,
+               "counter names");
+_Static_assert(sizeof(hist_names) / sizeof(hist_names[0]) == METRICS_HISTS,
+               "histogram names");
+
+static bool check_region(metrics_region_t *region, size_t size);
+static uint64_t bucket_upper(uint32_t bucket);
+static uint64_t hist_total(const metrics_hist_t *hist);
+static uint64_t hist_quantile(const metrics_hist_t *hist, double q);
+static void print_table(metrics_region_t *region);
+static void print_prom(metrics_region_t *region);
+
+static bool check_region(metrics_region_t *region, size_t size)
+{
+   if (size < METRICS_SIZE) {
+      fprintf(stderr, "file too short for metrics\n");
+      return false;
+   }
+   if (region->magic != METRICS_MAGIC) {
+      fprintf(stderr, "not a metrics file\n");
+      return false;
+   }
+   if ((region->version != METRICS_VERSION) || (region->size != METRICS_SIZE) ||
+       (region->buckets != METRICS_BUCKETS) || (region->counters_n > METRICS_COUNTERS) ||
+       (region->hists_n > METRICS_HISTS)) {
+      fprintf(stderr, "unsupported metrics version[%u]\n", region->version);
+      return false;
+   }
+
+   return true;
+}
+
+/* largest value counted in bucket, the last one has no bound */
+static uint64_t bucket_upper(uint32_t bucket)
+{
+   if (bucket == 0)
+      return 0;
+
+   return (1ULL << bucket) - 1;
+}
+
+/* the buckets, not count, a copy may catch count a sample behind */
+static uint64_t hist_total(const metrics_hist_t *hist)
+{
+   uint64_t total = 0;
+   uint32_t b;
+
+   for (b = 0; b < METRICS_BUCKETS; b++)
+      total += hist->buckets[b];
+
+   return total;
+}
+
+/* upper bound of the bucket holding quantile q, max for the last one */
+static uint64_t hist_quantile(const metrics_hist_t *hist, double q)
+{
+   uint64_t total, seen = 0;
+   uint32_t b;
+
+   total = hist_total(hist);
+   if (total == 0)
+      return 0;
+
+   for (b = 0; b < METRICS_BUCKETS - 1; b++) {
+      seen += hist->buckets[b];
+      if (seen >= q * total)
+         return (bucket_upper(b) < hist->max) ? bucket_upper(b) : hist->max;
+   }
+
+   return hist->max;
+}
+
+static void print_table(metrics_region_t *region)
+{
+   const metrics_hist_t *hist;
+   const metric_name_t *name;
+   struct timespec now;
+   uint64_t total;
+   double unit;
+   uint32_t i;
+
+   clock_gettime(CLOCK_REALTIME, &now);
+   printf("pid %lld, up %.1f s\n\n", (long long)region->pid,
+          ((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec - region->start_ns) / 1e9);
+
+   for (i = 0; i < region->counters_n; i++)
+      printf("%-16s %12llu\n", counter_names[i].name,
+             (unsigned long long)region->counters[i]);
+
+   printf("\n%-16s %10s %10s %10s %10s %10s\n", "[us, events]", "count", "mean",
+          "p50 <=", "p99 <=", "max");
+   for (i = 0; i < region->hists_n; i++) {
+      hist = &region->hists[i];
+      name = &hist_names[i];
+      total = hist_total(hist);
+      /* times in us, counts as they are */
+      unit = (name->scale == 1) ? 1 : 1e6 / name->scale;
+      printf("%-16s %10llu %10.1f %10.1f %10.1f %10.1f\n", name->name,
+             (unsigned long long)total,
+             (total > 0) ? hist->sum * unit / total : 0,
+             hist_quantile(hist, 0.5) * unit, hist_quantile(hist, 0.99) * unit,
+             hist->max * unit);
+   }
+}
+
+/* one cumulative bucket per power of two, empty ones at the top left out */
+static void print_prom(metrics_region_t *region)
+{
+   const metrics_hist_t *hist;
+   const metric_name_t *name;
+   uint64_t total, seen;
+   uint32_t i, b, last;
+
+   for (i = 0; i < region->counters_n; i++) {
+      name = &counter_names[i];
+      printf("# HELP ps_%s_total %s\n", name->name, name->help);
+      printf("# TYPE ps_%s_total counter\n", name->name);
+      printf("ps_%s_total %llu\n", name->name, (unsigned long long)region->counters[i]);
+   }
+
+   for (i = 0; i < region->hists_n; i++) {
+      hist = &region->hists[i];
+      name = &hist_names[i];
+      total = hist_total(hist);
+      last = 0;
+      for (b = 0; b < METRICS_BUCKETS - 1; b++) {
+         if (hist->buckets[b] != 0)
+            last = b;
+      }
+
+      printf("# HELP ps_%s_%s %s\n", name->name, name->unit, name->help);
+      printf("# TYPE ps_%s_%s histogram\n", name->name, name->unit);
+      seen = 0;
+      for (b = 0; b <= last; b++) {
+         seen += hist->buckets[b];
+         printf("ps_%s_%s_bucket{le=\"%.9g\"} %llu\n", name->name, name->unit,
+                bucket_upper(b) / name->scale, (unsigned long long)seen);
+      }
+      printf("ps_%s_%s_bucket{le=\"+Inf\"} %llu\n", name->name, name->unit,
+             (unsigned long long)total);
+      printf("ps_%s_%s_sum %.9g\n", name->name, name->unit, hist->sum / name->scale);
+      printf("ps_%s_%s_count %llu\n", name->name, name->unit, (unsigned long long)total);
+   }
+}
+
+int main(int argc, char **argv)
+{
+   metrics_region_t region;
+   struct stat st;
+   bool prom = false;
+   void *map;
+   int fd;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s <metrics> [prom]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   if (argc > 2) {
+      if (strcmp(argv[2], "prom") != 0) {
+         fprintf(stderr, "unknown format[%s]\n", argv[2]);
+         return EXIT_FAILURE;
+      }
+      prom = true;
+   }
+
+   fd = open(argv[1], O_RDONLY);
+   if (fd == -1) {
+      fprintf(stderr, "failed to open %s: %s\n", argv[1], strerror(errno));
+      return EXIT_FAILURE;
+   }
+   if (fstat(fd, &st) == -1) {
+      perror("fstat");
+      return EXIT_FAILURE;
+   }
+   if (st.st_size < METRICS_SIZE) {
+      fprintf(stderr, "file too short for metrics\n");
+      return EXIT_FAILURE;
+   }
+   map = mmap(NULL, METRICS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      perror("mmap");
+      return EXIT_FAILURE;
+   }
+
+   /* magic is stored last, after it the layout fields stay put */
+   if (__atomic_load_n(&((metrics_region_t *)map)->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC) {
+      fprintf(stderr, "not a metrics file\n");
+      return EXIT_FAILURE;
+   }
+   memcpy(&region, map, sizeof(region));
+   munmap(map, METRICS_SIZE);
+   if (check_region(&region, st.st_size) == false)
+      return EXIT_FAILURE;
+
+   if (prom == true)
+      print_prom(&region);
+   else
+      print_table(&region);
+
+   return EXIT_SUCCESS;
+}
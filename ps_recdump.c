@@ -0,0 +1,205 @@
+/*
+ * Flight recorder dump
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* ps_recdump prints a recording as CSV, oldest record first. Raw scan
+ * codes are turned into volts with the ranges from the header. Works on
+ * the file of a running controller too, records being written are left
+ * out. With a number of seconds only the end of the recording is shown.
+ *
+ *    ./ps_recdump <recording> [seconds]
+ *
+ * time,type,channel,value
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* the recorder header needs it for rec_init() only */
+typedef struct ALLEGRO_CONFIG ALLEGRO_CONFIG;
+
+#include "power_supply_rec.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+static bool check_header(rec_header_t *header, size_t size);
+static void print_record(rec_header_t *header, rec_record_t *record);
+
+static bool check_header(rec_header_t *header, size_t size)
+{
+   if (size < REC_HEADER_SIZE) {
+      fprintf(stderr, "file too short for a recording\n");
+      return false;
+   }
+   if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != REC_MAGIC) {
+      fprintf(stderr, "not a recording\n");
+      return false;
+   }
+   if ((header->version != REC_VERSION) ||
+       (header->record_size != REC_RECORD_SIZE) ||
+       (header->header_size != REC_HEADER_SIZE)) {
+      fprintf(stderr, "unsupported recording version[%u]\n", header->version);
+      return false;
+   }
+   if ((header->capacity == 0) ||
+       (size < REC_HEADER_SIZE + header->capacity * REC_RECORD_SIZE)) {
+      fprintf(stderr, "recording truncated\n");
+      return false;
+   }
+   if (header->scan_n > REC_CHANNELS_MAX) {
+      fprintf(stderr, "scan_n[%u] out of range\n", header->scan_n);
+      return false;
+   }
+
+   return true;
+}
+
+static void print_record(rec_header_t *header, rec_record_t *record)
+{
+   uint64_t t_ns = record->t_ns + header->realtime_offset_ns;
+   uint32_t channel, i;
+   double volts;
+
+   switch (record->type) {
+   case rec_type_scan:
+      for (i = 0; (i < record->n) && (i < REC_CODES_N); i++) {
+         channel = record->channel + i;
+         if ((channel >= header->scan_n) || (header->maxdata[channel] == 0))
+            break;
+         volts = header->range_min[channel] +
+                 (header->range_max[channel] - header->range_min[channel]) *
+                 record->u.codes[i] / header->maxdata[channel];
+         printf("%llu.%09llu,scan,%u,%.6f\n",
+                (unsigned long long)(t_ns / 1000000000ULL),
+                (unsigned long long)(t_ns % 1000000000ULL),
+                header->scan_channels[channel], volts);
+      }
+      break;
+   case rec_type_input:
+   case rec_type_setpoint:
+      printf("%llu.%09llu,%s,%u,%.6f\n",
+             (unsigned long long)(t_ns / 1000000000ULL),
+             (unsigned long long)(t_ns % 1000000000ULL),
+             (record->type == rec_type_input) ? "input" : "setpoint",
+             record->channel, record->u.value);
+      break;
+   case rec_type_dio:
+      for (i = 0; i < 32; i++) {
+         if ((record->u.dio.mask & (1U << i)) == 0)
+            continue;
+         printf("%llu.%09llu,dio,%u,%u\n",
+                (unsigned long long)(t_ns / 1000000000ULL),
+                (unsigned long long)(t_ns % 1000000000ULL),
+                i, (record->u.dio.bits >> i) & 1);
+      }
+      break;
+   default:
+      fprintf(stderr, "unknown record type[%u]\n", record->type);
+      break;
+   }
+}
+
+int main(int argc, char **argv)
+{
+   rec_header_t *header;
+   rec_record_t *records, *record, copy;
+   uint64_t written, first, last_ns = 0, since_ns = 0, i;
+   double seconds = 0;
+   struct stat st;
+   void *map;
+   int fd;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s <recording> [seconds]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   if (argc > 2) {
+      errno = 0;
+      seconds = strtod(argv[2], NULL);
+      if ((errno == ERANGE) || (seconds < 0)) {
+         fprintf(stderr, "seconds[%s] out of range\n", argv[2]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   fd = open(argv[1], O_RDONLY);
+   if (fd == -1) {
+      fprintf(stderr, "failed to open %s: %s\n", argv[1], strerror(errno));
+      return EXIT_FAILURE;
+   }
+   if (fstat(fd, &st) == -1) {
+      perror("fstat");
+      return EXIT_FAILURE;
+   }
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      perror("mmap");
+      return EXIT_FAILURE;
+   }
+
+   header = map;
+   if (check_header(header, st.st_size) == false)
+      return EXIT_FAILURE;
+   records = (rec_record_t *)((char *)map + REC_HEADER_SIZE);
+
+   written = __atomic_load_n(&header->written, __ATOMIC_ACQUIRE);
+   first = (written > header->capacity) ? written - header->capacity : 0;
+
+   /* newest complete record tells where the requested window starts */
+   if (seconds > 0) {
+      for (i = written; i > first; i--) {
+         record = &records[(i - 1) % header->capacity];
+         if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) == (uint32_t)i) {
+            last_ns = record->t_ns;
+            break;
+         }
+      }
+      if (last_ns > seconds * 1e9)
+         since_ns = last_ns - seconds * 1e9;
+   }
+
+   printf("time,type,channel,value\n");
+   for (i = first; i < written; i++) {
+      record = &records[i % header->capacity];
+      /* overwritten or still being written by a live controller, the
+       * copy is only good if seq did not move while it was taken */
+      if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != (uint32_t)(i + 1))
+         continue;
+      memcpy(&copy, record, sizeof(copy));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) != (uint32_t)(i + 1))
+         continue;
+      if (copy.t_ns < since_ns)
+         continue;
+      print_record(header, &copy);
+   }
+
+   munmap(map, st.st_size);
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+/*
+ * Tracepoint ring converter
+ * Copyright (C) 2015 Tribula Mel <tribula.mel@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* ps_trace2json merges the rings of a traced build, make TRACE=1, into
+ * one Chrome trace JSON file for chrome://tracing or ui.perfetto.dev.
+ * Records of all rings are put in time order, timestamps stay on
+ * CLOCK_MONOTONIC so the controller and the daemon line up.
+ *
+ *    ./ps_trace2json /tmp/ps-trace-*.bin > trace.json
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "power_supply_trace.h"
+
+/* enable for debugging */
+#undef DEBUG
+
+typedef struct event {
+   trace_record_t record;
+   int64_t pid;
+   int64_t tid;
+   /* file and place in it, keeps the order of equal timestamps */
+   uint32_t file;
+   uint64_t seq;
+} event_t;
+
+static const char *trace_names[TRACE_IDS] = {
+   [trace_analog_input] = "analog_channel_input",
+   [trace_analog_output] = "analog_channel_output",
+   [trace_digital_output] = "digital_channel_output",
+   [trace_poll] = "poll",
+   [trace_command] = "command",
+   [trace_comedi_read] = "comedi_data_read",
+   [trace_comedi_write] = "comedi_data_write",
+   [trace_comedi_dio] = "comedi_dio_bitfield2",
+   [trace_event_timer] = "event_timer",
+   [trace_event_mouse_axes] = "event_mouse_axes",
+   [trace_event_mouse_button_up] = "event_mouse_button_up",
+   [trace_send_knobs] = "send_knobs",
+   [trace_check_leds] = "check_leds",
+   [trace_draw_display] = "draw_display",
+};
+
+static bool read_trace(const char *file, uint32_t index, event_t **events, uint64_t *events_n);
+static int compare_events(const void *a, const void *b);
+
+/* appends the records still in the ring, oldest first */
+static bool read_trace(const char *file, uint32_t index, event_t **events, uint64_t *events_n)
+{
+   trace_header_t header;
+   trace_record_t record;
+   uint64_t first, seq, n;
+   event_t *more;
+   FILE *fp;
+
+   fp = fopen(file, "rb");
+   if (fp == NULL) {
+      fprintf(stderr, "failed to open %s: %s\n", file, strerror(errno));
+      return false;
+   }
+   if (fread(&header, sizeof(header), 1, fp) != 1) {
+      fprintf(stderr, "%s: file too short for a trace\n", file);
+      fclose(fp);
+      return false;
+   }
+   /* a thread that died before its magic went in left nothing */
+   if (header.magic != TRACE_MAGIC) {
+      fprintf(stderr, "%s: not a trace file\n", file);
+      fclose(fp);
+      return false;
+   }
+   if ((header.version != TRACE_VERSION) || (header.record_size != TRACE_RECORD_SIZE) ||
+       (header.header_size != TRACE_HEADER_SIZE) || (header.capacity == 0)) {
+      fprintf(stderr, "%s: unsupported trace version[%u]\n", file, header.version);
+      fclose(fp);
+      return false;
+   }
+
+   first = (header.written > header.capacity) ? header.written - header.capacity : 0;
+   n = header.written - first;
+   more = realloc(*events, (*events_n + n) * sizeof(event_t));
+   if ((more == NULL) && (*events_n + n > 0)) {
+      fprintf(stderr, "no memory for %llu records\n", (unsigned long long)n);
+      fclose(fp);
+      return false;
+   }
+   *events = more;
+
+   for (seq = first; seq < header.written; seq++) {
+      if ((fseek(fp, TRACE_HEADER_SIZE + (seq % header.capacity) * TRACE_RECORD_SIZE,
+                 SEEK_SET) == -1) ||
+          (fread(&record, sizeof(record), 1, fp) != 1)) {
+         fprintf(stderr, "%s: truncated at record[%llu]\n", file, (unsigned long long)seq);
+         break;
+      }
+      if ((record.id >= TRACE_IDS) || (trace_names[record.id] == NULL) ||
+          (record.phase > trace_end))
+         continue;
+      more = &(*events)[(*events_n)++];
+      more->record = record;
+      more->pid = header.pid;
+      more->tid = header.tid;
+      more->file = index;
+      more->seq = seq;
+   }
+#ifdef DEBUG
+   printf("%s: tid[%lld] written[%llu]\n", file, (long long)header.tid,
+          (unsigned long long)header.written);
+#endif
+
+   fclose(fp);
+   return true;
+}
+
+static int compare_events(const void *a, const void *b)
+{
+   const event_t *ea = a, *eb = b;
+
+   if (ea->record.t_ns != eb->record.t_ns)
+      return (ea->record.t_ns < eb->record.t_ns) ? -1 : 1;
+   if (ea->file != eb->file)
+      return (ea->file < eb->file) ? -1 : 1;
+   if (ea->seq != eb->seq)
+      return (ea->seq < eb->seq) ? -1 : 1;
+
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   event_t *events = NULL, *event;
+   uint64_t events_n = 0, i;
+   int failed = 0, f;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s <trace>...\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   for (f = 1; f < argc; f++) {
+      if (read_trace(argv[f], f, &events, &events_n) == false)
+         failed++;
+   }
+   if (failed == argc - 1)
+      return EXIT_FAILURE;
+
+   qsort(events, events_n, sizeof(event_t), compare_events);
+
+   /* ts in us, ns kept as the fraction */
+   printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+   for (i = 0; i < events_n; i++) {
+      event = &events[i];
+      printf("%s\n{\"name\":\"%s\",\"cat\":\"ps\",\"ph\":\"%s\",\"ts\":%llu.%03u,"
+             "\"pid\":%lld,\"tid\":%lld,\"args\":{\"arg\":%u}}",
+             (i == 0) ? "" : ",", trace_names[event->record.id],
+             (event->record.phase == trace_begin) ? "B" : "E",
+             (unsigned long long)(event->record.t_ns / 1000),
+             (unsigned)(event->record.t_ns % 1000),
+             (long long)event->pid, (long long)event->tid, event->record.arg);
+   }
+   printf("\n]}\n");
+
+   free(events);
+   return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
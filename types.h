@@ -34,4 +34,18 @@ enum {
    voltage_program_knob = 0,
 };
 
+/* gets the raw codes of scans as a plugin consumes them, scan_n codes per
+ * scan, scans first .. first + scans - 1 of total consumed by one call
+ */
+typedef void (*scan_tap_t)(void *ctx, const uint32_t *codes, uint32_t first,
+                           uint32_t scans, uint32_t total);
+
+/* states of a burst capture */
+enum {
+   burst_idle = 0,
+   burst_armed,
+   burst_triggered,
+   burst_done,
+};
+
 #endif /* __TYPES_H */